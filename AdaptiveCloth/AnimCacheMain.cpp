@@ -0,0 +1,65 @@
+/*************************************************************************
+**********************    ARCSim_AnimCacheMain    ************************
+*************************************************************************/
+
+#include "animcache.hpp"
+#include "cxxopts.hpp"
+#include "util.hpp"
+#include "utils/FileUtil.h"
+#include "utils/LogUtil.h"
+
+/*************************************************************************
+*******************************    Main    *******************************
+*************************************************************************/
+
+// Converts frames of an animation cache back to obj files, named like the
+// headless frame output: <output>/<frame>_<mesh>.obj.
+int main(int argc, char *argv[])
+{
+    std::string cache = "", output = "";
+    int frame = -1;
+    try
+    {
+        cxxopts::Options options(argv[0], " - arcsim animation cache to obj");
+        options.positional_help("[optional args]").show_positional_help();
+
+        options.add_options()("cache", "animation cache path",
+                              cxxopts::value<std::string>())(
+            "o,output", "directory for the obj files",
+            cxxopts::value<std::string>()->default_value("."))(
+            "f,frame", "only convert this frame (< 0: all of them)",
+            cxxopts::value<int>()->default_value("-1"));
+
+        options.parse_positional({"cache"});
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("cache"))
+            cache = result["cache"].as<std::string>();
+        output = result["output"].as<std::string>();
+        frame = result["frame"].as<int>();
+    }
+    catch (const cxxopts::OptionException &e)
+    {
+        std::cout << "[error] when parsing, " << e.what() << std::endl;
+        exit(1);
+    }
+    if (cache.size() == 0)
+    {
+        SIM_ERROR("please offer an animation cache!");
+        return 1;
+    }
+    AnimCacheReader reader;
+    if (!reader.open(cache))
+        return 1;
+    if (!cFileUtil::ExistsDir(output))
+        cFileUtil::CreateDir(output.c_str());
+    int begin = frame < 0 ? 0 : frame,
+        end = frame < 0 ? reader.frames() : frame + 1;
+    for (int f = begin; f < end; f++)
+        if (!reader.write_obj(f, stringf("%s/%04d", output.c_str(), f)))
+            return 1;
+    printf("animcache: %d of %d frames written to %s\n", end - begin,
+           reader.frames(), output.c_str());
+    return 0;
+}
@@ -13,10 +13,6 @@ using namespace ARCSim;
 Application g_App;
 
 extern void zoom(bool in);
-extern "C"
-{
-	FILE __iob_func[3] = {*stdin, *stdout, *stderr};
-}
 
 /*************************************************************************
 ***************************    Application    ****************************
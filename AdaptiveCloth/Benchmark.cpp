@@ -0,0 +1,173 @@
+/*************************************************************************
+*************************    ARCSim_Benchmark    *************************
+*************************************************************************/
+
+#include "Benchmark.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "Simulation.hpp"
+#include "utils/FileUtil.h"
+#include "utils/SysUtil.h"
+#include "utils/TimeUtil.hpp"
+#include <cstdio>
+
+using namespace std;
+
+// forward slashes only, so paths can go into json strings verbatim
+static string json_path(string path)
+{
+	for (int i = 0; i < path.size(); i++)
+		if (path[i] == '\\')
+			path[i] = '/';
+	return path;
+}
+
+string write_sheet_scene(const string &dir, int n, const string &material)
+{
+	string obj = json_path(stringf("%s/sheet_%d.obj", dir.c_str(), n));
+	if (!cFileUtil::ExistsFile(obj))
+	{
+		FILE *f = fopen(obj.c_str(), "w");
+		if (!f)
+		{
+			fprintf(stderr, "Error: failed to open file %s\n", obj.c_str());
+			return "";
+		}
+		for (int j = 0; j <= n; j++)
+			for (int i = 0; i <= n; i++)
+				fprintf(f, "v %g %g 0\n", (double)i / n, (double)j / n);
+		for (int j = 0; j <= n; j++)
+			for (int i = 0; i <= n; i++)
+				fprintf(f, "vt %g %g\n", (double)i / n, (double)j / n);
+		for (int j = 0; j < n; j++)
+			for (int i = 0; i < n; i++)
+			{
+				int a = j * (n + 1) + i + 1, b = a + 1, c = a + n + 1,
+					d = c + 1;
+				fprintf(f, "f %d/%d %d/%d %d/%d\n", a, a, b, b, d, d);
+				fprintf(f, "f %d/%d %d/%d %d/%d\n", a, a, d, d, c, c);
+			}
+		fclose(f);
+	}
+	string stem = cFileUtil::RemoveExtension(cFileUtil::GetFilename(material));
+	string json = json_path(
+		stringf("%s/sheet_%d_%s.json", dir.c_str(), n, stem.c_str()));
+	FILE *f = fopen(json.c_str(), "w");
+	if (!f)
+	{
+		fprintf(stderr, "Error: failed to open file %s\n", json.c_str());
+		return "";
+	}
+	fprintf(f,
+			"{\n"
+			"    \"frame_time\": 0.01,\n"
+			"    \"frame_steps\": 1,\n"
+			"    \"end_time\": 1000,\n"
+			"    \"cloths\": [{\n"
+			"        \"mesh\": \"%s\",\n"
+			"        \"materials\": [{\"data\": \"%s\"}]\n"
+			"    }],\n"
+			"    \"obstacles\": [],\n"
+			"    \"handles\": [{\"nodes\": [0, %d]}],\n"
+			"    \"gravity\": [0, 0, -9.8],\n"
+			"    \"disable\": [\"remeshing\"]\n"
+			"}\n",
+			obj.c_str(), json_path(material).c_str(), n);
+	fclose(f);
+	return json;
+}
+
+static void count_work(const Simulation &sim, BenchmarkResult &r, int sign)
+{
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		const Cloth &cloth = sim.m_Cloths[c];
+		r.pcg_solves += sign * cloth.pcg.solves;
+		r.pcg_iterations += sign * cloth.pcg.total_iterations;
+		r.factor_hits += sign * cloth.solver.hits;
+		r.factor_misses += sign * cloth.solver.misses;
+	}
+	r.collision_calls += sign * sim.m_CollisionStats.calls;
+	r.collision_iterations += sign * sim.m_CollisionStats.iterations;
+	r.strain_outer += sign * sim.m_StrainLimitingContext.outer_iterations;
+	r.strain_inner += sign * sim.m_StrainLimitingContext.inner_iterations;
+}
+
+BenchmarkResult run_benchmark(const string &name, const string &json_file,
+							  int steps)
+{
+	BenchmarkResult r = BenchmarkResult();
+	r.name = name;
+	r.config = json_file;
+	Simulation sim;
+	load_json(json_file, &sim);
+	sim.Prepare();
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		r.nodes += sim.m_Cloths[c].mesh.nodes.size();
+		r.faces += sim.m_Cloths[c].mesh.faces.size();
+	}
+	count_work(sim, r, -1);
+	cProfiler::Collect(); // drop zones recorded while preparing
+
+	cTimePoint start = cTimeUtil::GetCurrentTime_chrono();
+	for (; r.steps < steps; r.steps++)
+		sim.AdvanceStep();
+	r.seconds = cTimeUtil::CalcTimeElaspedms(
+					start, cTimeUtil::GetCurrentTime_chrono()) /
+				1e3;
+
+	count_work(sim, r, 1);
+	r.phases = cProfiler::Collect();
+	r.peak_rss = cSysUtil::GetPeakPhyMemBytes();
+	return r;
+}
+
+void write_benchmark_json(const vector<BenchmarkResult> &results,
+						  const string &path)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+	{
+		fprintf(stderr, "Error: failed to open file %s\n", path.c_str());
+		return;
+	}
+	bool phases = cProfiler::Enabled();
+	fprintf(f, "{\"profiler\": %s, \"cases\": [\n", phases ? "true" : "false");
+	for (int i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		fprintf(f, "  {\"name\": \"%s\", \"config\": \"%s\",\n", r.name.c_str(),
+				json_path(r.config).c_str());
+		fprintf(f, "   \"nodes\": %d, \"faces\": %d, \"steps\": %d, "
+				   "\"seconds\": %.6f, \"steps_per_sec\": %.4f, "
+				   "\"peak_rss_mb\": %.1f,\n",
+				r.nodes, r.faces, r.steps, r.seconds,
+				r.steps / max(r.seconds, 1e-9), r.peak_rss / 1048576.);
+		fprintf(f, "   \"pcg_solves\": %d, \"pcg_iterations\": %d, "
+				   "\"factor_hits\": %d, \"factor_misses\": %d,\n",
+				r.pcg_solves, r.pcg_iterations, r.factor_hits, r.factor_misses);
+		fprintf(f, "   \"collision_calls\": %d, \"collision_iterations\": %d, "
+				   "\"strain_limiting_outer\": %d, \"strain_limiting_inner\": %d,\n",
+				r.collision_calls, r.collision_iterations, r.strain_outer,
+				r.strain_inner);
+		if (!phases)
+		{
+			fprintf(f, "   \"phases\": null}%s\n", i + 1 < results.size() ? "," : "");
+			continue;
+		}
+		fprintf(f, "   \"phases\": [");
+		for (int p = 0; p < r.phases.size(); p++)
+		{
+			const cProfiler::tZoneStats &zs = r.phases[p];
+			fprintf(f, "%s\n    {\"zone\": \"%s\", \"count\": %d, "
+					   "\"total_ms\": %.4f, \"mean_ms\": %.4f, "
+					   "\"p50_ms\": %.4f, \"p99_ms\": %.4f}",
+					p ? "," : "", zs.path.c_str(), zs.count, zs.total_ms,
+					zs.mean_ms, zs.p50_ms, zs.p99_ms);
+		}
+		fprintf(f, "]}%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "]}\n");
+	fclose(f);
+}
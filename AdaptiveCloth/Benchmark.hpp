@@ -0,0 +1,40 @@
+/*************************************************************************
+*************************    ARCSim_Benchmark    *************************
+*************************************************************************/
+#pragma once
+
+#include "utils/Profiler.h"
+#include <string>
+#include <vector>
+
+struct BenchmarkResult
+{
+	std::string name, config;
+	int nodes, faces, steps;
+	double seconds;		   // wall time spent stepping
+	long long peak_rss;	   // process high-water mark after the run, bytes
+	// solver work during the timed steps, summed over cloths
+	int pcg_solves, pcg_iterations;
+	int factor_hits, factor_misses;
+	int collision_calls, collision_iterations;
+	int strain_outer, strain_inner;
+	// per-phase timings; only recorded when cProfiler::Enabled()
+	std::vector<cProfiler::tZoneStats> phases;
+};
+
+// Writes <dir>/sheet_<n>.obj, a 1 m square sheet of n x n quads in the xy
+// plane, and a scene <dir>/sheet_<n>_<material>.json hanging it by two
+// corners with the given material data file. Returns the scene path, or an
+// empty string if a file could not be written.
+std::string write_sheet_scene(const std::string &dir, int n,
+							  const std::string &material);
+
+// Loads the scene, prepares it outside of the timed region, then advances
+// it for the given number of steps.
+BenchmarkResult run_benchmark(const std::string &name,
+							  const std::string &json_file, int steps);
+
+// Machine-readable output, one object per case. Without the profiler
+// compiled in, "profiler" is false and every case has "phases": null.
+void write_benchmark_json(const std::vector<BenchmarkResult> &results,
+						  const std::string &path);
@@ -0,0 +1,124 @@
+/*************************************************************************
+**********************    ARCSim_BenchmarkMain    ************************
+*************************************************************************/
+
+#include "Benchmark.hpp"
+#include "cxxopts.hpp"
+#include "utils/FileUtil.h"
+#include "utils/LogUtil.h"
+#include <algorithm>
+
+/*************************************************************************
+*******************************    Main    *******************************
+*************************************************************************/
+
+// Runs every scene in conf_dir, then a sheet of each size with each material
+// in materials_dir, for a fixed number of steps each, and writes the
+// timings and solver counts of all of them to one json file.
+int main(int argc, char *argv[])
+{
+    std::string conf_dir, materials_dir, scratch, output, filter;
+    std::vector<int> sizes;
+    int steps;
+    bool no_phases;
+    try
+    {
+        cxxopts::Options options(argv[0], " - arcsim benchmark");
+
+        options.add_options()(
+            "conf_dir", "directory of the scenes to run",
+            cxxopts::value<std::string>()->default_value("conf"))(
+            "materials_dir", "directory of the materials for the sheets",
+            cxxopts::value<std::string>()->default_value("Materials"))(
+            "sizes", "quads per side of the generated sheets",
+            cxxopts::value<std::vector<int>>()->default_value("8,16,32,64"))(
+            "scratch", "directory for the generated sheet scenes",
+            cxxopts::value<std::string>()->default_value("benchmark_scenes"))(
+            "n,steps", "steps per case",
+            cxxopts::value<int>()->default_value("100"))(
+            "o,output", "results file",
+            cxxopts::value<std::string>()->default_value("benchmark.json"))(
+            "filter", "only run cases whose name contains this",
+            cxxopts::value<std::string>()->default_value(""))(
+            "no_phases",
+            "run without per-phase timings when not built with ENABLE_PROFILER");
+
+        auto result = options.parse(argc, argv);
+
+        conf_dir = result["conf_dir"].as<std::string>();
+        materials_dir = result["materials_dir"].as<std::string>();
+        sizes = result["sizes"].as<std::vector<int>>();
+        scratch = result["scratch"].as<std::string>();
+        steps = result["steps"].as<int>();
+        output = result["output"].as<std::string>();
+        filter = result["filter"].as<std::string>();
+        no_phases = result.count("no_phases") > 0;
+    }
+    catch (const cxxopts::OptionException &e)
+    {
+        std::cout << "[error] when parsing, " << e.what() << std::endl;
+        exit(1);
+    }
+
+    if (!cProfiler::Enabled() && !no_phases)
+    {
+        SIM_ERROR("built without ENABLE_PROFILER, so there are no per-phase "
+                  "timings; rebuild with -DENABLE_PROFILER=ON or pass "
+                  "--no_phases");
+        return 1;
+    }
+
+    // (name, scene) of every case, bundled scenes first
+    std::vector<std::pair<std::string, std::string>> cases;
+    if (cFileUtil::ExistsDir(conf_dir))
+    {
+        std::vector<std::string> scenes = cFileUtil::ListDir(conf_dir);
+        cFileUtil::FilterFilesByExtension(scenes, "json");
+        std::sort(scenes.begin(), scenes.end());
+        for (const std::string &scene : scenes)
+            cases.push_back(std::make_pair(
+                cFileUtil::RemoveExtension(cFileUtil::GetFilename(scene)),
+                scene));
+    }
+    if (cFileUtil::ExistsDir(materials_dir) && !sizes.empty())
+    {
+        if (!cFileUtil::ExistsDir(scratch))
+            cFileUtil::CreateDir(scratch.c_str());
+        std::vector<std::string> materials = cFileUtil::ListDir(materials_dir);
+        cFileUtil::FilterFilesByExtension(materials, "json");
+        std::sort(materials.begin(), materials.end());
+        std::sort(sizes.begin(), sizes.end());
+        for (int n : sizes)
+            for (const std::string &material : materials)
+            {
+                std::string scene = write_sheet_scene(scratch, n, material);
+                if (scene.empty())
+                    continue;
+                cases.push_back(std::make_pair(
+                    cFileUtil::RemoveExtension(cFileUtil::GetFilename(scene)),
+                    scene));
+            }
+    }
+
+    // zones are collected per case; no periodic reports in between
+    cProfiler::Configure(0, "");
+    std::vector<BenchmarkResult> results;
+    for (const auto &c : cases)
+    {
+        if (c.first.find(filter) == std::string::npos)
+            continue;
+        results.push_back(run_benchmark(c.first, c.second, steps));
+        const BenchmarkResult &r = results.back();
+        printf("benchmark: %-40s %6d nodes %8.2f steps/sec %8.1f MB\n",
+               r.name.c_str(), r.nodes, r.steps / std::max(r.seconds, 1e-9),
+               r.peak_rss / 1048576.);
+        // keep what has run so far if a later case aborts
+        write_benchmark_json(results, output);
+    }
+    if (results.empty())
+    {
+        SIM_ERROR("no benchmark cases found");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+/*************************************************************************
+*************************    ARCSim_Headless    **************************
+*************************************************************************/
+
+#include "Headless.hpp"
+#include "animcache.hpp"
+#include "checkpoint.hpp"
+#include "framewriter.hpp"
+#include "io.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "Simulation.hpp"
+#include "utils/FileUtil.h"
+#include "utils/TimeUtil.hpp"
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// whether a frame was submitted
+static bool save_frame(FrameWriter &writer, const Simulation &sim,
+					   const string &outprefix)
+{
+	if (outprefix.empty())
+		return false;
+	writer.submit(sim.m_pClothMeshes,
+				  stringf("%s/%04d", outprefix.c_str(), sim.step / sim.frame_steps));
+	return true;
+}
+
+HeadlessStats run_headless(const string &json_file, const string &outprefix,
+						   int max_steps, int checkpoint_steps,
+						   const string &resume, const string &cache,
+						   double cache_precision)
+{
+	if (!outprefix.empty() && !cFileUtil::ExistsDir(outprefix))
+		cFileUtil::CreateDir(outprefix.c_str());
+	Simulation sim;
+	load_json(json_file, &sim);
+	sim.Prepare();
+	HeadlessStats stats = {0, 0, 0};
+	FrameWriter frames;
+	if (resume.empty())
+		stats.frames += save_frame(frames, sim, outprefix);
+	else
+		load_checkpoint(sim, resume);
+	AnimCacheWriter animcache;
+	if (!cache.empty() &&
+		animcache.open(cache,
+					   cache_precision > 0 ? AnimCacheWriter::Quantized
+										   : AnimCacheWriter::Float32,
+					   cache_precision))
+		animcache.add_frame(sim.m_pClothMeshes, sim.time);
+	CheckpointWriter checkpoints;
+	string checkpoint_file =
+		outprefix.empty() ? "checkpoint.bin" : outprefix + "/checkpoint.bin";
+	while (sim.time < sim.end_time && sim.frame < sim.end_frame &&
+		   (max_steps <= 0 || stats.steps < max_steps))
+	{
+		cTimePoint start = cTimeUtil::GetCurrentTime_chrono();
+		sim.AdvanceStep();
+		stats.seconds += cTimeUtil::CalcTimeElaspedms(
+							 start, cTimeUtil::GetCurrentTime_chrono()) /
+						 1e3;
+		stats.steps++;
+		if (sim.step % sim.frame_steps == 0)
+		{
+			stats.frames += save_frame(frames, sim, outprefix);
+			animcache.add_frame(sim.m_pClothMeshes, sim.time);
+		}
+		if (checkpoint_steps > 0 && sim.step % checkpoint_steps == 0)
+			checkpoints.write(sim, checkpoint_file);
+	}
+	checkpoints.wait();
+	frames.flush();
+	animcache.close();
+
+	printf("headless: %d steps, %d frames in %.3f s, %.2f steps/sec\n",
+		   stats.steps, stats.frames, stats.seconds,
+		   stats.steps / max(stats.seconds, 1e-9));
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		const TaucsSolver &solver = sim.m_Cloths[c].solver;
+		const PcgSolver &pcg = sim.m_Cloths[c].pcg;
+		if (solver.hits + solver.misses > 0)
+			printf("headless: cloth %d factor reuse: %d hits, %d misses\n", c,
+				   solver.hits, solver.misses);
+		if (pcg.solves > 0)
+			printf("headless: cloth %d pcg: %.1f its/solve, last residual %.2e\n",
+				   c, (double)pcg.total_iterations / pcg.solves, pcg.residual);
+	}
+	if (frames.frames > 0)
+		printf("headless: frame output %d frames, %.3f ms blocked, %.3f ms writing in the background\n",
+			   frames.frames, frames.blocked_ms, frames.write_ms);
+	if (animcache.frames > 0)
+		printf("headless: cache %d frames, %d epochs, %d chunks, %.1f KB to %s\n",
+			   animcache.frames, animcache.epochs, animcache.chunks,
+			   animcache.bytes / 1024., cache.c_str());
+	if (checkpoints.written > 0)
+		printf("headless: %d checkpoints to %s\n", checkpoints.written,
+			   checkpoint_file.c_str());
+	printf("headless: bvh %d rebuilds, %d refits\n",
+		   sim.m_ClothAccel.rebuilds + sim.m_ObstacleAccel.rebuilds,
+		   sim.m_ClothAccel.refits + sim.m_ObstacleAccel.refits);
+	const ProximityTracker &prox = sim.m_ProximityTracker;
+	if (prox.full_queries + prox.partial_queries + prox.reuses > 0)
+		printf("headless: proximity %d full, %d partial queries, %d reuses\n",
+			   prox.full_queries, prox.partial_queries, prox.reuses);
+	const AugLagContext &sl = sim.m_StrainLimitingContext;
+	if (sl.outer_iterations > 0)
+		printf("headless: strain limiting %d outer, %d inner iterations, %d evaluations\n",
+			   sl.outer_iterations, sl.inner_iterations, sl.evaluations);
+	const StrainLimitingStats &sls = sim.m_StrainLimitingStats;
+	if (sls.calls > 0)
+		printf("headless: local strain limiting %.1f islands, %.1f nodes, %.1f faces per call\n",
+			   (double)sls.islands / sls.calls, (double)sls.nodes / sls.calls,
+			   (double)sls.faces / sls.calls);
+	const CollisionStats &col = sim.m_CollisionStats;
+	if (col.iterations > 0)
+		printf("headless: collision %d calls, %.2f iterations/call, "
+			   "%.1f impacts and %.1f independent per iteration, %.3f ms per iteration\n",
+			   col.calls, (double)col.iterations / col.calls,
+			   (double)col.impacts / col.iterations,
+			   (double)col.independent / col.iterations,
+			   col.ms / col.iterations);
+	return stats;
+}
+
+static void get_cloth_state(const Simulation &sim, vector<Vec3> &x,
+							vector<Vec3> &v)
+{
+	x.clear();
+	v.clear();
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		const Mesh &mesh = sim.m_Cloths[c].mesh;
+		for (int n = 0; n < mesh.nodes.size(); n++)
+		{
+			x.push_back(mesh.nodes[n]->x);
+			v.push_back(mesh.nodes[n]->v);
+		}
+	}
+}
+
+static bool same_bits(const vector<Vec3> &a, const vector<Vec3> &b,
+					  const char *what)
+{
+	if (a.size() != b.size())
+	{
+		printf("headless: resume mismatch, %d vs %d nodes\n", (int)a.size(),
+			   (int)b.size());
+		return false;
+	}
+	for (int n = 0; n < a.size(); n++)
+		if (memcmp(&a[n], &b[n], sizeof(Vec3)) != 0)
+		{
+			printf("headless: resume mismatch, node %d %s (%.17g %.17g %.17g) "
+				   "vs (%.17g %.17g %.17g)\n",
+				   n, what, a[n][0], a[n][1], a[n][2], b[n][0], b[n][1],
+				   b[n][2]);
+			return false;
+		}
+	return true;
+}
+
+bool verify_resume(const string &json_file, int steps)
+{
+	int half = steps / 2;
+	vector<char> checkpoint;
+	vector<Vec3> x, v;
+	{
+		Simulation sim;
+		load_json(json_file, &sim);
+		sim.Prepare();
+		for (int s = 0; s < steps; s++)
+		{
+			if (s == half)
+				checkpoint = save_checkpoint(sim);
+			sim.AdvanceStep();
+		}
+		get_cloth_state(sim, x, v);
+	}
+	vector<Vec3> xr, vr;
+	{
+		Simulation sim;
+		load_json(json_file, &sim);
+		sim.Prepare();
+		load_checkpoint(sim, checkpoint);
+		for (int s = half; s < steps; s++)
+			sim.AdvanceStep();
+		get_cloth_state(sim, xr, vr);
+	}
+	bool same = same_bits(x, xr, "x") && same_bits(v, vr, "v");
+	if (same)
+		printf("headless: resume after %d of %d steps matches bitwise, %d nodes\n",
+			   half, steps, (int)x.size());
+	return same;
+}
@@ -0,0 +1,39 @@
+/*************************************************************************
+*************************    ARCSim_Headless    **************************
+*************************************************************************/
+#pragma once
+
+#include <string>
+
+struct HeadlessStats
+{
+	int steps, frames; // frames counts the frames submitted for writing
+	double seconds; // wall time spent stepping, excluding frame output
+};
+
+// Runs a scene without any window: loads the json, steps the simulation
+// until end_time / end_frame (or max_steps, if positive) and saves the cloth
+// meshes of every frame as <outprefix>/<frame>_<mesh>.obj. An empty
+// outprefix skips writing frames.
+//
+// With checkpoint_steps > 0 the full state is checkpointed to
+// <outprefix>/checkpoint.bin (or ./checkpoint.bin) every that many steps;
+// a non-empty resume file is loaded over the prepared scene first, and the
+// run continues from its step.
+//
+// A non-empty cache file also records every frame into an animation cache
+// (animcache.hpp), quantized to cache_precision or as float32 if that is
+// not positive.
+HeadlessStats run_headless(const std::string &json_file,
+						   const std::string &outprefix, int max_steps = -1,
+						   int checkpoint_steps = 0,
+						   const std::string &resume = "",
+						   const std::string &cache = "",
+						   double cache_precision = 1e-5);
+
+// Checks that a checkpoint resumes bit-exactly: runs the scene for steps
+// steps, checkpointing in memory after steps / 2, then restores that
+// checkpoint into a freshly loaded simulation, runs the remaining steps and
+// compares the cloth node positions and velocities bitwise. Prints the
+// first mismatch and returns whether both runs agree.
+bool verify_resume(const std::string &json_file, int steps);
@@ -0,0 +1,90 @@
+/*************************************************************************
+***********************    ARCSim_HeadlessMain    ************************
+*************************************************************************/
+
+#include "Headless.hpp"
+#include "cxxopts.hpp"
+#include "utils/LogUtil.h"
+#include "utils/Profiler.h"
+
+/*************************************************************************
+*******************************    Main    *******************************
+*************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    std::string conf = "", output = "";
+    std::string resume = "", cache = "";
+    double cache_precision = 1e-5;
+    bool check_resume = false;
+    int steps = -1, checkpoint_steps = 0;
+    try
+    {
+        cxxopts::Options options(argv[0], " - arcsim headless");
+        options.positional_help("[optional args]").show_positional_help();
+
+        options.add_options()("conf", "config path",
+                              cxxopts::value<std::string>())(
+            "o,output", "directory for the per-frame cloth meshes",
+            cxxopts::value<std::string>()->default_value(""))(
+            "n,steps", "stop after this many steps (<= 0: run to the end)",
+            cxxopts::value<int>()->default_value("-1"))(
+            "profile_every",
+            "print profiler zone statistics every this many steps "
+            "(ENABLE_PROFILER builds, <= 0: never)",
+            cxxopts::value<int>()->default_value("100"))(
+            "trace", "write a chrome trace of the profiler zones at exit",
+            cxxopts::value<std::string>()->default_value(""))(
+            "checkpoint_every",
+            "checkpoint the simulation every this many steps (<= 0: never)",
+            cxxopts::value<int>()->default_value("0"))(
+            "resume", "continue from this checkpoint of the same scene",
+            cxxopts::value<std::string>()->default_value(""))(
+            "cache", "also record every frame into this animation cache",
+            cxxopts::value<std::string>()->default_value(""))(
+            "verify_resume",
+            "instead of a normal run, check that resuming from a checkpoint "
+            "taken halfway through --steps reproduces them bitwise")(
+            "cache_precision",
+            "position quantum of the cache in m (<= 0: store float32)",
+            cxxopts::value<double>()->default_value("1e-5"));
+
+        options.parse_positional({"conf"});
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("conf"))
+            conf = result["conf"].as<std::string>();
+        output = result["output"].as<std::string>();
+        steps = result["steps"].as<int>();
+        checkpoint_steps = result["checkpoint_every"].as<int>();
+        resume = result["resume"].as<std::string>();
+        cache = result["cache"].as<std::string>();
+        cache_precision = result["cache_precision"].as<double>();
+        check_resume = result.count("verify_resume") > 0;
+        cProfiler::Configure(result["profile_every"].as<int>(),
+                             result["trace"].as<std::string>());
+    }
+    catch (const cxxopts::OptionException &e)
+    {
+        std::cout << "[error] when parsing, " << e.what() << std::endl;
+        exit(1);
+    }
+    if (conf.size() == 0)
+    {
+        SIM_ERROR("please offer config!");
+        return 1;
+    }
+    if (check_resume)
+    {
+        if (steps < 2)
+        {
+            SIM_ERROR("--verify_resume needs --steps of at least 2");
+            return 1;
+        }
+        return verify_resume(conf, steps) ? 0 : 1;
+    }
+    run_headless(conf, output, steps, checkpoint_steps, resume, cache,
+                 cache_precision);
+    return 0;
+}
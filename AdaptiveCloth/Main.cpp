@@ -3,6 +3,7 @@
 *************************************************************************/
 
 #include "Application.h"
+#include "Headless.hpp"
 #include "cxxopts.hpp"
 #include "utils/LogUtil.h"
 #include "utils/FileUtil.h"
@@ -29,7 +30,10 @@ int main(int argc, char *argv[])
     ParseArg(argc, argv, conf, disable_imgui);
 
     // 2. run simulation
-    g_App.RunSimulate(conf);
+    if (disable_imgui)
+        run_headless(conf, "");
+    else
+        g_App.RunSimulate(conf);
 }
 
 void ParseArg(int argc, char *argv[], std::string &config_path,
@@ -42,7 +46,7 @@ void ParseArg(int argc, char *argv[], std::string &config_path,
 
         options.add_options()("conf", "config path",
                               cxxopts::value<std::string>())(
-            "d,disable_imgui", "enable imgui rendering",
+            "d,disable_imgui", "run headless, without glut/imgui",
             cxxopts::value<bool>()->default_value("false"));
 
         options.parse_positional({"conf"});
@@ -5,6 +5,7 @@
 #include "magic.hpp"
 #include "physics.hpp"
 #include "separate.hpp"
+#include "snapshot.hpp"
 #include "collision.hpp"
 #include "popfilter.hpp"
 #include "proximity.hpp"
@@ -12,8 +13,7 @@
 #include "plasticity.hpp"
 #include "dynamicremesh.hpp"
 #include "strainlimiting.hpp"
-#include "imgui.h"
-#include "utils/TimeUtil.hpp"
+#include "utils/Profiler.h"
 
 using namespace std;
 
@@ -64,6 +64,8 @@ void Simulation::Prepare()
 			m_cloth_initpos[i].push_back(n->node->x);
 		}
 	}
+
+	m_StrainLimitingContext.warm_start = true;
 }
 
 void Simulation::RelaxInitialState()
@@ -128,167 +130,75 @@ void Simulation::ValidateHandles()
 void Simulation::AdvanceStep()
 {
 	printf("------step %d------\n", step);
-	cTimeUtil::Begin("sim_step");
-	time += step_time;
-	step++;
-
-	cTimeUtil::Begin("obstacle_step");
-	this->UpdateObstacles(false);
-	cTimeUtil::End("obstacle_step");
-
-	cTimeUtil::Begin("get_cons_step");
-	vector<Constraint *> cons = this->GetConstraints(true);
-	// vector<Constraint *> cons = this->GetConstraints(false);
-	cTimeUtil::End("get_cons_step");
-
-	cTimeUtil::Begin("physics_step");
-	this->PhysicsStep(cons);
-	cTimeUtil::End("physics_step");
-
-	cTimeUtil::Begin("plasti_strain_limit_step");
-	this->PlasticityStep();
-
-	this->StrainlimitingStep(cons);
-	cTimeUtil::End("plasti_strain_limit_step");
-
-	cTimeUtil::Begin("col_step");
-	this->CollisionStep();
-	cTimeUtil::End("col_step");
-
-	// if (step % frame_steps == 0)
-	// {
-	// 	this->RemeshingStep();
-
-	frame++;
-	// }
-
-	cTimeUtil::Begin("del_cons_step");
-	this->DeleteConstraints(cons);
-	cTimeUtil::End("del_cons_step");
-
-	cTimeUtil::End("sim_step");
-}
-
-extern eBendingMode gCurBendingMode;
-static std::vector<const char *> gBendingModeStrPtr = {
-	"dde",
-	"linear",
-	"nonlinear",
-};
-
-static cTimePoint gPrevTime = cTimeUtil::GetCurrentTime_chrono();
-extern bool gUseQBending;
-void Simulation::UpdateImGUI()
-{
-	cTimePoint cur_time = cTimeUtil::GetCurrentTime_chrono();
-	ImGui::Text("FPS %.1f", 1e3 / cTimeUtil::CalcTimeElaspedms(gPrevTime, cur_time));
-	gPrevTime = cur_time;
-
-	// 1. combo, show bending model selection
-	if (ImGui::BeginCombo("bending mode", BuildBendingModeStr(gCurBendingMode).c_str()))
 	{
-		for (int i = 0; i < eBendingMode::NUM_OF_BENDING_MODE; i++)
+		PROFILE_ZONE("sim_step");
+		time += step_time;
+		step++;
 		{
-			auto cur_str = BuildBendingModeStr(static_cast<eBendingMode>(i));
-			bool is_selected = i == gCurBendingMode;
-			if (ImGui::Selectable(cur_str.c_str(), is_selected))
-			{
-				gCurBendingMode = static_cast<eBendingMode>(i);
-			}
-
-			if (is_selected)
-			{
-				ImGui::SetItemDefaultFocus();
-			}
+			PROFILE_ZONE("obstacle_step");
+			this->UpdateObstacles(false);
+		}
+		{
+			PROFILE_ZONE("get_cons_step");
+			this->GetConstraints(m_Constraints, true);
+			// this->GetConstraints(m_Constraints, false);
+		}
+		{
+			PROFILE_ZONE("physics_step");
+			this->PhysicsStep(m_Constraints);
 		}
-		ImGui::EndCombo();
-	}
-	// 2. show options now
-	switch (gCurBendingMode)
-	{
-	case eBendingMode::LINEAR_ISOMETRIC_BENDING_MODE:
-	case eBendingMode::LINEAR_ANISO_BENDING_MODE:
-	{
-		Vec3f linear_bending = GetLinearBendingModulus();
-		// float val[3] = {linear_bending[0],
-		// 				   linear_bending[1],
-		// 				   linear_bending[2]};
-		ImGui::DragFloat3("Linear Bending",
-						  &linear_bending[0],
-						  50, 0.0f, 1.0e7);
-		SetLinearBendingModulus(linear_bending);
-	}
-	break;
-	case eBendingMode::NONLINEAR_BENDING_MODE:
-	{
-		Vec6f nonlinear_bending = GetNonlinearBendingModulus();
-		// float val[3] = {linear_bending[0],
-		// 				   linear_bending[1],
-		// 				   linear_bending[2]};
-		ImGui::DragFloat3("Linear Bending",
-						  &nonlinear_bending[0],
-						  1.0e5, 1.0e7);
-		ImGui::DragFloat3("Nonlinear Bending",
-						  &nonlinear_bending[3],
-						  1.0e5, 1.0e7);
-		SetNonlinearBendingModulus(nonlinear_bending);
-	}
-	break;
-	}
-
-	// change density
-	{
-		for (int i = 0; i < m_Cloths.size(); i++)
 		{
+			PROFILE_ZONE("plasti_strain_limit_step");
+			this->PlasticityStep();
 
-			for (int j = 0; j < this->m_Cloths[i].materials.size(); j++)
-			{
-				float curDensity = m_Cloths[i].materials[j]->density;
-				ImGui::DragFloat("cloth density", &curDensity, 0.001f, 0.01f, 0.6f);
-				// if (curDensity - m_Cloths[i].materials[j]->density)
-				// {
-				m_Cloths[i].SetDensity(j, curDensity);
-				// }
-				// ImGui::Text("cloth %d material %d density %.4f", i, j, m_Cloths[i].materials[j]->density);
-			}
+			this->StrainlimitingStep(m_Constraints);
 		}
+		{
+			PROFILE_ZONE("col_step");
+			this->CollisionStep();
+		}
+
+		// if (step % frame_steps == 0)
+		// {
+		// 	this->RemeshingStep();
+
+		frame++;
+		// }
 	}
-	if (ImGui::Button("dump cloth mesh"))
-	{
-		DumpClothMesh();
-	}
-	ImGui::Checkbox("use qbending", &gUseQBending);
-	// ImGui::NewFrame();
+	cProfiler::EndStep();
 }
 
-vector<Constraint *> Simulation::GetConstraints(bool include_proximity)
+void Simulation::GetConstraints(Constraints &cons, bool include_proximity)
 {
-	vector<Constraint *> cons;
+	cons.clear();
 
 	for (int h = 0; h < m_pHandles.size(); h++)
 	{
-		append(cons, m_pHandles[h]->get_constraints(time));
+		m_pHandles[h]->get_constraints(time, cons);
 	}
 
-	if (include_proximity && enabled[proximity])
+	if (include_proximity && enabled[proximity] && ::magic.proximity_tracking)
 	{
-		append(cons, proximity_constraints(m_pClothMeshes, m_pObstacleMeshes, friction, obs_friction));
+		proximity_constraints(m_pClothMeshes, m_pObstacleMeshes,
+							  m_ClothAccel.update(m_pClothMeshes, false),
+							  m_ObstacleAccel.update(m_pObstacleMeshes, false),
+							  friction, obs_friction, m_ProximityTracker, cons);
+	}
+	else if (include_proximity && enabled[proximity])
+	{
+		proximity_constraints(m_pClothMeshes, m_pObstacleMeshes,
+							  m_ClothAccel.update(m_pClothMeshes, false),
+							  m_ObstacleAccel.update(m_pObstacleMeshes, false),
+							  friction, obs_friction, cons);
 	}
-
-	return cons;
-}
-
-void Simulation::DeleteConstraints(const vector<Constraint *> &cons)
-{
-	for (int c = 0; c < cons.size(); c++)
-		delete cons[c];
 }
 
 // Steps
 
-void update_velocities(vector<Mesh *> &meshes, vector<Vec3> &xold, double dt);
+void update_velocities(const MeshIndex &index, const vector<Vec3> &xold,
+					   double dt);
 
-void Simulation::PhysicsStep(const vector<Constraint *> &cons)
+void Simulation::PhysicsStep(const Constraints &cons)
 {
 	if (!enabled[physics])
 		return;
@@ -348,21 +258,30 @@ void Simulation::PlasticityStep()
 	}
 }
 
-void Simulation::StrainlimitingStep(const vector<Constraint *> &cons)
+void Simulation::StrainlimitingStep(const Constraints &cons)
 {
 	if (!enabled[strainlimiting])
 		return;
 
-	vector<Vec3> xold = node_positions(m_pClothMeshes);
+	m_ClothIndex.update(m_pClothMeshes);
+	vector<Vec3> xold;
+	m_ClothIndex.get_positions(xold);
 
-	strain_limiting(m_pClothMeshes, get_strain_limits(m_Cloths), cons);
+	if (::magic.local_strain_limiting)
+		local_strain_limiting(m_pClothMeshes, get_strain_limits(m_Cloths),
+							  cons.all, m_StrainLimitingContext,
+							  &m_StrainLimitingStats);
+	else
+		strain_limiting(m_pClothMeshes, get_strain_limits(m_Cloths), cons.all,
+						m_StrainLimitingContext);
 
-	update_velocities(m_pClothMeshes, xold, step_time);
+	update_velocities(m_ClothIndex, xold, step_time);
 }
 
 void Simulation::EquilibrationStep()
 {
-	vector<Constraint *> cons; // = get_constraints(sim, true);
+	Constraints &cons = m_CollisionConstraints; // = get_constraints(sim, true);
+	cons.clear();
 	// double stiff = 1;
 	// swap(stiff, ::magic.handle_stiffness);
 	for (int c = 0; c < m_Cloths.size(); c++)
@@ -370,35 +289,40 @@ void Simulation::EquilibrationStep()
 		Mesh &mesh = m_Cloths[c].mesh;
 		for (int n = 0; n < mesh.nodes.size(); n++)
 			mesh.nodes[n]->acceleration = Vec3(0);
-		apply_pop_filter(m_Cloths[c], cons, 1);
+		apply_pop_filter(m_Cloths[c], cons.all, 1);
 	}
 	// swap(stiff, ::magic.handle_stiffness);
 
-	DeleteConstraints(cons);
-
-	cons = GetConstraints(false);
+	GetConstraints(cons, false);
 
 	if (enabled[collision])
 	{
-		collision_response(m_pClothMeshes, cons, m_pObstacleMeshes);
+		collision_response(m_pClothMeshes, cons.all, m_pObstacleMeshes,
+						   m_ClothAccel.update(m_pClothMeshes, true),
+						   m_ObstacleAccel.update(m_pObstacleMeshes, true),
+						   &m_CollisionStats);
 	}
-
-	DeleteConstraints(cons);
 }
 
 void Simulation::StrainzeroingStep()
 {
 	vector<Vec2> strain_limits(size<Face>(m_pClothMeshes), Vec2(1, 1));
 
-	vector<Constraint *> cons = proximity_constraints(m_pClothMeshes, m_pObstacleMeshes, friction, obs_friction);
-
-	strain_limiting(m_pClothMeshes, strain_limits, cons);
+	Constraints &cons = m_CollisionConstraints;
+	cons.clear();
+	proximity_constraints(m_pClothMeshes, m_pObstacleMeshes,
+						  m_ClothAccel.update(m_pClothMeshes, false),
+						  m_ObstacleAccel.update(m_pObstacleMeshes, false),
+						  friction, obs_friction, cons);
 
-	DeleteConstraints(cons);
+	strain_limiting(m_pClothMeshes, strain_limits, cons.all);
 
 	if (enabled[collision])
 	{
-		collision_response(m_pClothMeshes, vector<Constraint *>(), m_pObstacleMeshes);
+		collision_response(m_pClothMeshes, vector<Constraint *>(), m_pObstacleMeshes,
+						   m_ClothAccel.update(m_pClothMeshes, true),
+						   m_ObstacleAccel.update(m_pObstacleMeshes, true),
+						   &m_CollisionStats);
 	}
 }
 
@@ -408,37 +332,38 @@ void Simulation::CollisionStep()
 	if (!enabled[collision])
 		return;
 
-	vector<Vec3> xold = node_positions(m_pClothMeshes);
-	vector<Constraint *> cons = GetConstraints(false);
-	collision_response(m_pClothMeshes, cons, m_pObstacleMeshes);
-	DeleteConstraints(cons);
-	update_velocities(m_pClothMeshes, xold, step_time);
+	m_ClothIndex.update(m_pClothMeshes);
+	vector<Vec3> xold;
+	m_ClothIndex.get_positions(xold);
+	Constraints &cons = m_CollisionConstraints;
+	GetConstraints(cons, false);
+	collision_response(m_pClothMeshes, cons.all, m_pObstacleMeshes,
+					   m_ClothAccel.update(m_pClothMeshes, true),
+					   m_ObstacleAccel.update(m_pObstacleMeshes, true),
+					   &m_CollisionStats);
+	update_velocities(m_ClothIndex, xold, step_time);
 }
 
 void Simulation::RemeshingStep(bool initializing)
 {
 	if (!enabled[remeshing])
 		return;
+	PROFILE_ZONE("remeshing_step");
 
-	// copy old meshes
-	vector<Mesh> old_meshes(m_Cloths.size());
-	vector<Mesh *> old_meshes_p(m_Cloths.size()); // for symmetry in separate()
+	// snapshot old meshes, with their residuals, where something needs them
+	bool resample = enabled[plasticity] && !initializing;
+	vector<MeshSnapshot> old_meshes;
 
-	for (int c = 0; c < m_Cloths.size(); c++)
+	if (resample || enabled[separation])
 	{
-		old_meshes[c] = deep_copy(m_Cloths[c].mesh);
-		old_meshes_p[c] = &old_meshes[c];
-	}
-	// back up residuals
-	typedef vector<Residual> MeshResidual;
-	vector<MeshResidual> res;
-
-	if (enabled[plasticity] && !initializing)
-	{
-		res.resize(m_Cloths.size());
+		old_meshes.resize(m_Cloths.size());
 
 		for (int c = 0; c < m_Cloths.size(); c++)
-			res[c] = back_up_residuals(m_Cloths[c].mesh);
+		{
+			old_meshes[c] = take_snapshot(m_Cloths[c].mesh);
+			if (resample)
+				old_meshes[c].res = back_up_residuals(m_Cloths[c].mesh);
+		}
 	}
 	// remesh
 
@@ -448,39 +373,38 @@ void Simulation::RemeshingStep(bool initializing)
 			static_remesh(m_Cloths[c]);
 		else
 		{
-			vector<Plane> planes = nearest_obstacle_planes(m_Cloths[c].mesh,
-														   m_pObstacleMeshes);
+			vector<Plane> planes = nearest_obstacle_planes(
+				m_Cloths[c].mesh, m_ObstacleAccel.update(m_pObstacleMeshes, false));
 			dynamic_remesh(m_Cloths[c], planes, enabled[plasticity]);
 		}
 	}
 
 	// restore residuals
-	if (enabled[plasticity] && !initializing)
+	if (resample)
 	{
 		for (int c = 0; c < m_Cloths.size(); c++)
-			restore_residuals(m_Cloths[c].mesh, old_meshes[c], res[c]);
+			restore_residuals(m_Cloths[c].mesh, old_meshes[c]);
 	}
 	// separate
 	if (enabled[separation])
 	{
-		separate(m_pClothMeshes, old_meshes_p, m_pObstacleMeshes);
+		separate(m_pClothMeshes, old_meshes, m_pObstacleMeshes,
+				 m_ClothAccel.update(m_pClothMeshes, false),
+				 m_ObstacleAccel.update(m_pObstacleMeshes, false));
 	}
 	// apply pop filter
 	if (enabled[popfilter] && !initializing)
 	{
-		vector<Constraint *> cons = GetConstraints(true);
+		Constraints &cons = m_CollisionConstraints;
+		GetConstraints(cons, true);
 
 		for (int c = 0; c < m_Cloths.size(); c++)
-			apply_pop_filter(m_Cloths[c], cons);
-
-		DeleteConstraints(cons);
+			apply_pop_filter(m_Cloths[c], cons.all);
 	}
-	// delete old meshes
-	for (int c = 0; c < m_Cloths.size(); c++)
-		delete_mesh(old_meshes[c]);
 }
 
-void update_velocities(vector<Mesh *> &meshes, vector<Vec3> &xold, double dt)
+void update_velocities(const MeshIndex &index, const vector<Vec3> &xold,
+					   double dt)
 {
 	double inv_dt = 1 / dt;
 
@@ -488,7 +412,7 @@ void update_velocities(vector<Mesh *> &meshes, vector<Vec3> &xold, double dt)
 
 	for (int n = 0; n < xold.size(); n++)
 	{
-		Node *node = get<Node>(n, meshes);
+		Node *node = index.nodes[n];
 
 		node->v += (node->x - xold[n]) * inv_dt;
 	}
@@ -580,10 +504,12 @@ template Face *get(int, const vector<Mesh *> &);
 
 vector<Vec3> node_positions(const vector<Mesh *> &meshes)
 {
-	vector<Vec3> xs(size<Node>(meshes));
+	vector<Vec3> xs;
+	xs.reserve(size<Node>(meshes));
 
-	for (int n = 0; n < xs.size(); n++)
-		xs[n] = get<Node>(n, meshes)->x;
+	for (int m = 0; m < meshes.size(); m++)
+		for (int n = 0; n < meshes[m]->nodes.size(); n++)
+			xs.push_back(meshes[m]->nodes[n]->x);
 
 	return xs;
 }
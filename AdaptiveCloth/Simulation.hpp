@@ -7,7 +7,12 @@
 #include "morph.hpp"
 #include "handle.hpp"
 #include "obstacle.hpp"
+#include "collision.hpp"
 #include "constraint.hpp"
+#include "proximity.hpp"
+#include "optimization.hpp"
+#include "strainlimiting.hpp"
+#include "collisionutil.hpp"
 
 /*************************************************************************
 ****************************    Simulation    ****************************
@@ -23,8 +28,8 @@ struct Wind
 struct Simulation
 {
 	// variables
-	double time;
-	int frame, step;
+	double time = 0;
+	int frame = 0, step = 0;
 
 	// constants
 	int frame_steps;
@@ -57,11 +62,28 @@ struct Simulation
 	std::vector<Mesh *> m_pClothMeshes;
 	std::vector<Mesh *> m_pObstacleMeshes;
 	std::vector<std::vector<Vec3>> m_cloth_initpos;
+	// BVHs of the cloth and obstacle meshes, refit across steps
+	AccelCache m_ClothAccel, m_ObstacleAccel;
+	// global numbering of the cloth nodes, rebuilt on topology changes
+	MeshIndex m_ClothIndex;
+	CollisionStats m_CollisionStats;
+	// constraints of the current step, reused across steps
+	Constraints m_Constraints;
+	// constraints of collision response, equilibration and the pop filter,
+	// cleared and refilled by each of them
+	Constraints m_CollisionConstraints;
+	// proximity candidates, used when magic.proximity_tracking is set
+	ProximityTracker m_ProximityTracker;
+	// multipliers of the step's strain limiting, warm-starting the next one
+	AugLagContext m_StrainLimitingContext;
+	StrainLimitingStats m_StrainLimitingStats;
 public:
 	virtual void Prepare();
 	virtual void AdvanceStep();
 	void RelaxInitialState();
-	virtual void UpdateImGUI();
+	// scene-specific ImGui entries, drawn after the common simulation panel
+	// (update_simulation_imgui), which lives with the GUI front end
+	virtual void UpdateImGUI() {}
 	virtual void Reset();
 protected:
 	void ClothResetInitPos();
@@ -74,12 +96,15 @@ private:
 	void StrainzeroingStep();
 	void RemeshingStep(bool initializing = false);
 	void UpdateObstacles(bool update_positions = true);
-	void PhysicsStep(const std::vector<Constraint *> &cons);
-	void DeleteConstraints(const std::vector<Constraint *> &cons);
-	void StrainlimitingStep(const std::vector<Constraint *> &cons);
-	std::vector<Constraint *> GetConstraints(bool include_proximity);
+	void PhysicsStep(const Constraints &cons);
+	void StrainlimitingStep(const Constraints &cons);
+	// replaces the contents of cons with the handle constraints and,
+	// if asked and enabled, the proximity constraints
+	void GetConstraints(Constraints &cons, bool include_proximity);
 
 	void InitImGUI();
+
+public:
 	void DumpClothMesh() const;
 };
 
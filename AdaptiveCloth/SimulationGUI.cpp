@@ -0,0 +1,135 @@
+/*************************************************************************
+***********************    ARCSim_SimulationGUI    ***********************
+*************************************************************************/
+
+#include "dde.hpp"
+#include "display.hpp"
+#include "imgui.h"
+#include "Simulation.hpp"
+#include "utils/TimeUtil.hpp"
+
+using namespace std;
+
+extern eBendingMode gCurBendingMode;
+static std::vector<const char *> gBendingModeStrPtr = {
+	"dde",
+	"linear",
+	"nonlinear",
+};
+
+static cTimePoint gPrevTime = cTimeUtil::GetCurrentTime_chrono();
+extern bool gUseQBending;
+void update_simulation_imgui(Simulation &sim)
+{
+	cTimePoint cur_time = cTimeUtil::GetCurrentTime_chrono();
+	ImGui::Text("FPS %.1f", 1e3 / cTimeUtil::CalcTimeElaspedms(gPrevTime, cur_time));
+	gPrevTime = cur_time;
+
+	// 1. combo, show bending model selection
+	if (ImGui::BeginCombo("bending mode", BuildBendingModeStr(gCurBendingMode).c_str()))
+	{
+		for (int i = 0; i < eBendingMode::NUM_OF_BENDING_MODE; i++)
+		{
+			auto cur_str = BuildBendingModeStr(static_cast<eBendingMode>(i));
+			bool is_selected = i == gCurBendingMode;
+			if (ImGui::Selectable(cur_str.c_str(), is_selected))
+			{
+				gCurBendingMode = static_cast<eBendingMode>(i);
+			}
+
+			if (is_selected)
+			{
+				ImGui::SetItemDefaultFocus();
+			}
+		}
+		ImGui::EndCombo();
+	}
+	// 2. show options now
+	switch (gCurBendingMode)
+	{
+	case eBendingMode::LINEAR_ISOMETRIC_BENDING_MODE:
+	case eBendingMode::LINEAR_ANISO_BENDING_MODE:
+	{
+		Vec3f linear_bending = GetLinearBendingModulus();
+		// float val[3] = {linear_bending[0],
+		// 				   linear_bending[1],
+		// 				   linear_bending[2]};
+		ImGui::DragFloat3("Linear Bending",
+						  &linear_bending[0],
+						  50, 0.0f, 1.0e7);
+		SetLinearBendingModulus(linear_bending);
+	}
+	break;
+	case eBendingMode::NONLINEAR_BENDING_MODE:
+	{
+		Vec6f nonlinear_bending = GetNonlinearBendingModulus();
+		// float val[3] = {linear_bending[0],
+		// 				   linear_bending[1],
+		// 				   linear_bending[2]};
+		ImGui::DragFloat3("Linear Bending",
+						  &nonlinear_bending[0],
+						  1.0e5, 1.0e7);
+		ImGui::DragFloat3("Nonlinear Bending",
+						  &nonlinear_bending[3],
+						  1.0e5, 1.0e7);
+		SetNonlinearBendingModulus(nonlinear_bending);
+	}
+	break;
+	}
+
+	// change density
+	{
+		for (int i = 0; i < sim.m_Cloths.size(); i++)
+		{
+
+			for (int j = 0; j < sim.m_Cloths[i].materials.size(); j++)
+			{
+				float curDensity = sim.m_Cloths[i].materials[j]->density;
+				ImGui::DragFloat("cloth density", &curDensity, 0.001f, 0.01f, 0.6f);
+				// if (curDensity - sim.m_Cloths[i].materials[j]->density)
+				// {
+				sim.m_Cloths[i].SetDensity(j, curDensity);
+				// }
+				// ImGui::Text("cloth %d material %d density %.4f", i, j, sim.m_Cloths[i].materials[j]->density);
+			}
+		}
+	}
+	for (int i = 0; i < sim.m_Cloths.size(); i++)
+	{
+		const TaucsSolver &solver = sim.m_Cloths[i].solver;
+		ImGui::Text("cloth %d factor reuse: %d hits, %d misses", i,
+					solver.hits, solver.misses);
+		const PcgSolver &pcg = sim.m_Cloths[i].pcg;
+		if (pcg.solves > 0)
+			ImGui::Text("cloth %d pcg: %d its, residual %.2e%s", i,
+						pcg.iterations, pcg.residual,
+						pcg.fallback ? " (jacobi fallback)" : "");
+	}
+	ImGui::Text("bvh: %d rebuilds, %d refits",
+				sim.m_ClothAccel.rebuilds + sim.m_ObstacleAccel.rebuilds,
+				sim.m_ClothAccel.refits + sim.m_ObstacleAccel.refits);
+	const ProximityTracker &prox = sim.m_ProximityTracker;
+	if (prox.full_queries + prox.partial_queries + prox.reuses > 0)
+		ImGui::Text("proximity: %d full, %d partial queries, %d reuses",
+					prox.full_queries, prox.partial_queries, prox.reuses);
+	const AugLagContext &sl = sim.m_StrainLimitingContext;
+	if (sl.outer_iterations > 0)
+		ImGui::Text("strain limiting: %d outer, %d inner its, %d evaluations",
+					sl.outer_iterations, sl.inner_iterations, sl.evaluations);
+	const StrainLimitingStats &sls = sim.m_StrainLimitingStats;
+	if (sls.calls > 0)
+		ImGui::Text("local strain limiting: %d islands, %d nodes, %d faces",
+					sls.islands, sls.nodes, sls.faces);
+	for (int i = 0; i < sim.m_CollisionStats.last.size(); i++)
+	{
+		const CollisionIteration &it = sim.m_CollisionStats.last[i];
+		ImGui::Text("collision iter %d: %d impacts, %d independent, %.2f ms",
+					i, it.impacts, it.independent, it.ms);
+	}
+	if (ImGui::Button("dump cloth mesh"))
+	{
+		sim.DumpClothMesh();
+	}
+	ImGui::Checkbox("use qbending", &gUseQBending);
+	// ImGui::NewFrame();
+}
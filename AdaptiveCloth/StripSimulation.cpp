@@ -2,8 +2,6 @@
 #include "imgui.h"
 void StripSimulation::UpdateImGUI()
 {
-    Simulation::UpdateImGUI();
-
     ImGui::Text("free length %.3f", GetFreeLength());
 
     // 1. show cloth AABB
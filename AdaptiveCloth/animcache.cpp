@@ -0,0 +1,628 @@
+/*************************************************************************
+************************    ARCSim_AnimCache    **************************
+*************************************************************************/
+
+#include "animcache.hpp"
+#include "util.hpp"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char header_tag[8] = {'A', 'R', 'C', 'S', 'I', 'M', 'A', 'C'};
+static const char index_tag[8] = {'A', 'R', 'C', 'S', 'I', 'M', 'I', 'X'};
+static const int version = 1;
+static const int header_size = 8 + 4 + 4 + 8 + 4;
+static const int record_header_size = 4 + 8; // type, payload size
+
+enum RecordType
+{
+	EPOCH = 1,
+	CHUNK = 2,
+	INDEX = 3
+};
+
+// ------------------------------------------------------------------ //
+
+template <typename T>
+static void put(vector<char> &b, const T &x)
+{
+	b.insert(b.end(), (const char *)&x, (const char *)&x + sizeof(T));
+}
+
+static void put_varint(vector<char> &b, int64_t x)
+{
+	uint64_t z = ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); // zigzag
+	while (z >= 0x80)
+	{
+		b.push_back((char)(z | 0x80));
+		z >>= 7;
+	}
+	b.push_back((char)z);
+}
+
+struct Cursor
+{
+	const char *p, *end;
+	bool ok;
+	Cursor(const char *p, const char *end) : p(p), end(end), ok(true) {}
+	template <typename T>
+	T get()
+	{
+		T x = T();
+		if (end - p < (ptrdiff_t)sizeof(T))
+		{
+			ok = false;
+			return x;
+		}
+		memcpy(&x, p, sizeof(T));
+		p += sizeof(T);
+		return x;
+	}
+	int64_t varint()
+	{
+		uint64_t z = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (p >= end)
+			{
+				ok = false;
+				return 0;
+			}
+			unsigned char c = *p++;
+			z |= (uint64_t)(c & 0x7f) << shift;
+			if (!(c & 0x80))
+				break;
+		}
+		return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+	}
+};
+
+// ------------------------------------------------------------------ //
+
+AnimCacheWriter::AnimCacheWriter()
+	: frames(0), epochs(0), chunks(0), bytes(0), file(NULL), nodes(0),
+	  chunk_start(0)
+{
+}
+
+AnimCacheWriter::~AnimCacheWriter() { close(); }
+
+bool AnimCacheWriter::open(const string &filename, Encoding encoding,
+						   double precision, int chunk_frames)
+{
+	close();
+	file = fopen(filename.c_str(), "wb");
+	if (!file)
+	{
+		cout << "Error: failed to open file " << filename << endl;
+		return false;
+	}
+	this->encoding = encoding;
+	this->precision = precision;
+	this->chunk_frames = max(chunk_frames, 1);
+	frames = epochs = chunks = 0;
+	meshes.clear();
+	topology.clear();
+	epoch_index.clear();
+	chunk_index.clear();
+	times.clear();
+	xs.clear();
+	vector<char> header;
+	header.insert(header.end(), header_tag, header_tag + 8);
+	put(header, (int32_t)version);
+	put(header, (int32_t)encoding);
+	put(header, precision);
+	put(header, (int32_t)this->chunk_frames);
+	fwrite(header.data(), 1, header.size(), file);
+	bytes = header.size();
+	return true;
+}
+
+void AnimCacheWriter::write_record(int type)
+{
+	vector<char> head;
+	put(head, (int32_t)type);
+	put(head, (int64_t)record.size());
+	fwrite(head.data(), 1, head.size(), file);
+	fwrite(record.data(), 1, record.size(), file);
+	bytes += head.size() + record.size();
+}
+
+void AnimCacheWriter::write_epoch(const vector<Mesh *> &meshes)
+{
+	Entry entry = {bytes, frames, 0, epochs};
+	epoch_index.push_back(entry);
+	record.clear();
+	put(record, (int32_t)epochs);
+	put(record, (int32_t)frames);
+	put(record, (int32_t)meshes.size());
+	nodes = 0;
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		const Mesh &mesh = *meshes[m];
+		put(record, (int32_t)mesh.verts.size());
+		put(record, (int32_t)mesh.nodes.size());
+		put(record, (int32_t)mesh.faces.size());
+		for (int v = 0; v < mesh.verts.size(); v++)
+		{
+			put(record, (float)mesh.verts[v]->u[0]);
+			put(record, (float)mesh.verts[v]->u[1]);
+		}
+		for (int v = 0; v < mesh.verts.size(); v++)
+			put(record, (int32_t)mesh.verts[v]->node->index);
+		for (int f = 0; f < mesh.faces.size(); f++)
+			for (int i = 0; i < 3; i++)
+				put(record, (int32_t)mesh.faces[f]->v[i]->index);
+		nodes += mesh.nodes.size();
+	}
+	write_record(EPOCH);
+	epochs++;
+}
+
+void AnimCacheWriter::write_chunk()
+{
+	int nframes = times.size();
+	if (nframes == 0)
+		return;
+	Entry entry = {bytes, chunk_start, nframes, epochs - 1};
+	chunk_index.push_back(entry);
+	record.clear();
+	put(record, (int32_t)(epochs - 1));
+	put(record, (int32_t)chunk_start);
+	put(record, (int32_t)nframes);
+	put(record, (int32_t)nodes);
+	for (int f = 0; f < nframes; f++)
+		put(record, times[f]);
+	if (encoding == Float32)
+	{
+		for (int i = 0; i < xs.size(); i++)
+			put(record, (float)xs[i]);
+	}
+	else
+	{
+		int n = nodes * 3;
+		for (int f = 0; f < nframes; f++)
+			for (int i = 0; i < n; i++)
+			{
+				int64_t q = llround(xs[f * n + i] / precision);
+				// first frame against the previous node, later frames
+				// against the same node one frame earlier
+				int64_t ref = f > 0 ? llround(xs[(f - 1) * n + i] / precision)
+							  : i >= 3 ? llround(xs[i - 3] / precision)
+									   : 0;
+				put_varint(record, q - ref);
+			}
+	}
+	write_record(CHUNK);
+	chunks++;
+	times.clear();
+	xs.clear();
+}
+
+void AnimCacheWriter::add_frame(const vector<Mesh *> &meshes, double time)
+{
+	if (!file)
+		return;
+	bool changed = meshes.size() != this->meshes.size();
+	for (int m = 0; m < meshes.size() && !changed; m++)
+		changed = meshes[m] != this->meshes[m] ||
+				  meshes[m]->topology != topology[m];
+	if (changed || times.size() == chunk_frames)
+		write_chunk();
+	if (changed)
+	{
+		write_epoch(meshes);
+		this->meshes.assign(meshes.begin(), meshes.end());
+		topology.resize(meshes.size());
+		for (int m = 0; m < meshes.size(); m++)
+			topology[m] = meshes[m]->topology;
+	}
+	if (times.empty())
+		chunk_start = frames;
+	times.push_back(time);
+	for (int m = 0; m < meshes.size(); m++)
+		for (int n = 0; n < meshes[m]->nodes.size(); n++)
+			for (int i = 0; i < 3; i++)
+				xs.push_back(meshes[m]->nodes[n]->x[i]);
+	frames++;
+}
+
+void AnimCacheWriter::close()
+{
+	if (!file)
+		return;
+	write_chunk();
+	int64_t offset = bytes;
+	record.clear();
+	put(record, (int32_t)epoch_index.size());
+	for (int e = 0; e < epoch_index.size(); e++)
+	{
+		put(record, epoch_index[e].offset);
+		put(record, (int32_t)epoch_index[e].first_frame);
+	}
+	put(record, (int32_t)chunk_index.size());
+	for (int c = 0; c < chunk_index.size(); c++)
+	{
+		const Entry &entry = chunk_index[c];
+		put(record, entry.offset);
+		put(record, (int32_t)entry.first_frame);
+		put(record, (int32_t)entry.nframes);
+		put(record, (int32_t)entry.epoch);
+	}
+	write_record(INDEX);
+	vector<char> footer;
+	put(footer, offset);
+	footer.insert(footer.end(), index_tag, index_tag + 8);
+	fwrite(footer.data(), 1, footer.size(), file);
+	bytes += footer.size();
+	fclose(file);
+	file = NULL;
+}
+
+// ------------------------------------------------------------------ //
+
+AnimCacheReader::AnimCacheReader()
+	: data(NULL), size(0), fd(-1), chunk(-1), epoch(-1)
+{
+	handles[0] = handles[1] = NULL;
+}
+
+AnimCacheReader::~AnimCacheReader() { close(); }
+
+void AnimCacheReader::close()
+{
+#ifdef _WIN32
+	if (data)
+		UnmapViewOfFile(data);
+	if (handles[1])
+		CloseHandle(handles[1]);
+	if (handles[0])
+		CloseHandle(handles[0]);
+	handles[0] = handles[1] = NULL;
+#else
+	if (data)
+		munmap((void *)data, size);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	data = NULL;
+	size = 0;
+	epoch_index.clear();
+	chunk_index.clear();
+	chunk = epoch = -1;
+}
+
+bool AnimCacheReader::open(const string &filename)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+							  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		handles[0] = file;
+		LARGE_INTEGER file_size;
+		GetFileSizeEx(file, &file_size);
+		size = file_size.QuadPart;
+		handles[1] = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (handles[1])
+			data = (const char *)MapViewOfFile(handles[1], FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		size = st.st_size;
+		void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = p == MAP_FAILED ? NULL : (const char *)p;
+	}
+#endif
+	if (!data)
+	{
+		cout << "Error: failed to open file " << filename << endl;
+		close();
+		return false;
+	}
+	Cursor c(data, data + size);
+	char tag[8];
+	for (int i = 0; i < 8; i++)
+		tag[i] = c.get<char>();
+	int v = c.get<int32_t>();
+	encoding = c.get<int32_t>();
+	precision = c.get<double>();
+	chunk_frames = c.get<int32_t>();
+	if (!c.ok || memcmp(tag, header_tag, 8) != 0 || v != version)
+	{
+		cout << "Error: " << filename << " is not a version " << version
+			 << " animation cache" << endl;
+		close();
+		return false;
+	}
+	if (!read_index() && !scan_records())
+	{
+		cout << "Error: " << filename << " has no readable frames" << endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+// whether a complete record of the given type starts at offset
+bool AnimCacheReader::has_record(int64_t offset, int type) const
+{
+	if (offset < header_size || offset > (int64_t)size - record_header_size)
+		return false;
+	Cursor c(data + offset, data + size);
+	int t = c.get<int32_t>();
+	int64_t payload = c.get<int64_t>();
+	return t == type && payload >= 0 &&
+		   payload <= (int64_t)size - offset - record_header_size;
+}
+
+// the footer index, if every entry points at a record of its kind and
+// every chunk at an epoch of the index
+bool AnimCacheReader::read_index()
+{
+	if (size < header_size + 16)
+		return false;
+	Cursor footer(data + size - 16, data + size);
+	int64_t offset = footer.get<int64_t>();
+	if (memcmp(data + size - 8, index_tag, 8) != 0 || offset < header_size ||
+		offset > (int64_t)size - 16)
+		return false;
+	Cursor c(data + offset, data + size - 16);
+	if (c.get<int32_t>() != INDEX)
+		return false;
+	c.get<int64_t>();
+	int nepochs = c.get<int32_t>();
+	if (nepochs < 0 || nepochs > (c.end - c.p) / 12)
+		return false;
+	epoch_index.resize(nepochs);
+	for (int e = 0; e < epoch_index.size() && c.ok; e++)
+	{
+		epoch_index[e].offset = c.get<int64_t>();
+		epoch_index[e].first_frame = c.get<int32_t>();
+		epoch_index[e].epoch = e;
+	}
+	int nchunks = c.get<int32_t>();
+	if (nchunks < 0 || nchunks > (c.end - c.p) / 20)
+		c.ok = false;
+	else
+		chunk_index.resize(nchunks);
+	for (int k = 0; k < chunk_index.size() && c.ok; k++)
+	{
+		Entry &entry = chunk_index[k];
+		entry.offset = c.get<int64_t>();
+		entry.first_frame = c.get<int32_t>();
+		entry.nframes = c.get<int32_t>();
+		entry.epoch = c.get<int32_t>();
+	}
+	bool ok = c.ok && !chunk_index.empty();
+	for (int e = 0; e < epoch_index.size() && ok; e++)
+		ok = has_record(epoch_index[e].offset, EPOCH);
+	for (int k = 0; k < chunk_index.size() && ok; k++)
+	{
+		const Entry &entry = chunk_index[k];
+		ok = has_record(entry.offset, CHUNK) && entry.epoch >= 0 &&
+			 entry.epoch < epoch_index.size();
+	}
+	if (!ok)
+	{
+		epoch_index.clear();
+		chunk_index.clear();
+	}
+	return ok;
+}
+
+// rebuilds the index of a file that was never closed, up to its last
+// complete record
+bool AnimCacheReader::scan_records()
+{
+	epoch_index.clear();
+	chunk_index.clear();
+	int64_t offset = header_size;
+	while (offset + record_header_size <= (int64_t)size)
+	{
+		Cursor c(data + offset, data + size);
+		int type = c.get<int32_t>();
+		int64_t payload = c.get<int64_t>();
+		if (payload < 0 || offset + record_header_size + payload > (int64_t)size)
+			break;
+		Entry entry = {offset, 0, 0, 0};
+		if (type == EPOCH || type == CHUNK)
+		{
+			entry.epoch = c.get<int32_t>();
+			entry.first_frame = c.get<int32_t>();
+		}
+		if (type == EPOCH)
+		{
+			if (entry.epoch != epoch_index.size())
+				break;
+			epoch_index.push_back(entry);
+		}
+		else if (type == CHUNK)
+		{
+			if (entry.epoch < 0 || entry.epoch >= epoch_index.size())
+				break;
+			entry.nframes = c.get<int32_t>();
+			chunk_index.push_back(entry);
+		}
+		else if (type != INDEX)
+			break;
+		offset += record_header_size + payload;
+	}
+	return !chunk_index.empty();
+}
+
+int AnimCacheReader::frames() const
+{
+	if (chunk_index.empty())
+		return 0;
+	const Entry &last = chunk_index.back();
+	return last.first_frame + last.nframes;
+}
+
+int AnimCacheReader::find_chunk(int frame) const
+{
+	int lo = 0, hi = chunk_index.size() - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (chunk_index[mid].first_frame <= frame)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+void AnimCacheReader::load_epoch(int e)
+{
+	if (e == epoch)
+		return;
+	Cursor c(data + epoch_index[e].offset + record_header_size, data + size);
+	c.get<int32_t>(); // epoch
+	c.get<int32_t>(); // first frame
+	topo.resize(max(c.get<int32_t>(), 0));
+	for (int m = 0; m < topo.size() && c.ok; m++)
+	{
+		AnimCacheTopology &t = topo[m];
+		int nv = c.get<int32_t>();
+		t.nodes = c.get<int32_t>();
+		int nf = c.get<int32_t>();
+		if (!c.ok || nv < 0 || nf < 0 || t.nodes < 0)
+			break;
+		t.u.resize(nv);
+		for (int v = 0; v < nv; v++)
+		{
+			t.u[v][0] = c.get<float>();
+			t.u[v][1] = c.get<float>();
+		}
+		t.vert_nodes.resize(nv);
+		for (int v = 0; v < nv; v++)
+			t.vert_nodes[v] = c.get<int32_t>();
+		t.faces.resize(nf * 3);
+		for (int i = 0; i < nf * 3; i++)
+			t.faces[i] = c.get<int32_t>();
+	}
+	if (!c.ok)
+	{
+		cout << "Error: animation cache epoch " << e << " is truncated" << endl;
+		topo.clear();
+	}
+	epoch = e;
+}
+
+void AnimCacheReader::load_chunk(int k)
+{
+	if (k == chunk)
+		return;
+	const Entry &entry = chunk_index[k];
+	Cursor c(data + entry.offset + record_header_size, data + size);
+	c.get<int32_t>(); // epoch
+	c.get<int32_t>(); // first frame
+	int nframes = c.get<int32_t>(), nodes = c.get<int32_t>();
+	times.resize(max(nframes, 0));
+	for (int f = 0; f < times.size(); f++)
+		times[f] = c.get<double>();
+	xs.resize(times.size());
+	for (int f = 0; f < xs.size(); f++)
+	{
+		xs[f].resize(max(nodes, 0));
+		if (encoding == AnimCacheWriter::Float32)
+		{
+			for (int n = 0; n < xs[f].size(); n++)
+				for (int i = 0; i < 3; i++)
+					xs[f][n][i] = c.get<float>();
+			continue;
+		}
+		// quantized: integers first, scaled once the chunk is decoded
+		for (int n = 0; n < xs[f].size(); n++)
+			for (int i = 0; i < 3; i++)
+			{
+				double ref = f > 0 ? xs[f - 1][n][i] : n > 0 ? xs[f][n - 1][i]
+															   : 0;
+				xs[f][n][i] = ref + c.varint();
+			}
+	}
+	if (encoding != AnimCacheWriter::Float32)
+		for (int f = 0; f < xs.size(); f++)
+			for (int n = 0; n < xs[f].size(); n++)
+				xs[f][n] *= precision;
+	if (!c.ok)
+		cout << "Error: animation cache chunk " << k << " is truncated" << endl;
+	chunk = k;
+}
+
+double AnimCacheReader::time(int frame)
+{
+	int k = find_chunk(frame);
+	load_chunk(k);
+	return times[frame - chunk_index[k].first_frame];
+}
+
+const vector<AnimCacheTopology> &AnimCacheReader::topology(int frame)
+{
+	load_epoch(chunk_index[find_chunk(frame)].epoch);
+	return topo;
+}
+
+const vector<Vec3> &AnimCacheReader::positions(int frame)
+{
+	int k = find_chunk(frame);
+	load_chunk(k);
+	return xs[frame - chunk_index[k].first_frame];
+}
+
+bool AnimCacheReader::write_obj(int frame, const string &prefix)
+{
+	if (frame < 0 || frame >= frames())
+	{
+		cout << "Error: frame " << frame << " not in [0, " << frames() << ")"
+			 << endl;
+		return false;
+	}
+	const vector<Vec3> &x = positions(frame);
+	const vector<AnimCacheTopology> &meshes = topology(frame);
+	int node0 = 0;
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		const AnimCacheTopology &t = meshes[m];
+		string filename = stringf("%s_%02d.obj", prefix.c_str(), m);
+		FILE *f = fopen(filename.c_str(), "w");
+		if (!f)
+		{
+			cout << "Error: failed to open file " << filename << endl;
+			return false;
+		}
+		for (int v = 0; v < t.u.size(); v++)
+			fprintf(f, "vt %g %g\n", t.u[v][0], t.u[v][1]);
+		for (int n = 0; n < t.nodes && node0 + n < x.size(); n++)
+		{
+			const Vec3 &xn = x[node0 + n];
+			fprintf(f, "v %g %g %g\n", xn[0], xn[1], xn[2]);
+		}
+		for (int i = 0; i + 2 < t.faces.size(); i += 3)
+		{
+			const int *v = &t.faces[i];
+			fprintf(f, "f %d/%d %d/%d %d/%d\n", t.vert_nodes[v[0]] + 1,
+					v[0] + 1, t.vert_nodes[v[1]] + 1, v[1] + 1,
+					t.vert_nodes[v[2]] + 1, v[2] + 1);
+		}
+		fclose(f);
+		node0 += t.nodes;
+	}
+	return true;
+}
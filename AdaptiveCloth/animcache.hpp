@@ -0,0 +1,125 @@
+/*************************************************************************
+************************    ARCSim_AnimCache    **************************
+*************************************************************************/
+#pragma once
+
+#include "mesh.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Binary animation cache of the cloth meshes of a run. The file is a header,
+// a sequence of self-delimiting records and an index:
+//
+//   header  "ARCSIMAC", version, encoding, precision, chunk_frames
+//   epoch   topology of every mesh: material-space verts, their nodes and
+//           the faces; written at the start and after every remesh
+//   chunk   up to chunk_frames consecutive frames of one epoch: their times
+//           and the node positions of all meshes, either as float32 or,
+//           quantized to precision, as zigzag varints of the difference to
+//           the previous node (first frame) or the same node one frame
+//           earlier (later frames)
+//   index   offsets of every epoch and chunk, then its own offset and
+//           "ARCSIMIX"; a reader rebuilds it by scanning the records when
+//           the writer never got to close the file
+//
+// A frame is found through the index and decoded from the start of its
+// chunk, so random access costs at most chunk_frames frames.
+
+struct AnimCacheTopology
+{
+	int nodes;
+	std::vector<Vec2> u;		 // per vert
+	std::vector<int> vert_nodes; // per vert
+	std::vector<int> faces;		 // 3 verts per face
+};
+
+struct AnimCacheWriter
+{
+	enum Encoding
+	{
+		Float32,
+		Quantized
+	};
+	AnimCacheWriter();
+	~AnimCacheWriter(); // closes
+	// precision (in m) is only used by Quantized
+	bool open(const std::string &filename, Encoding encoding = Quantized,
+			  double precision = 1e-5, int chunk_frames = 32);
+	// starts a new epoch whenever a mesh's topology changed
+	void add_frame(const std::vector<Mesh *> &meshes, double time);
+	// writes the pending chunk and the index
+	void close();
+	int frames, epochs, chunks;
+	int64_t bytes; // written so far
+
+private:
+	FILE *file;
+	Encoding encoding;
+	double precision;
+	int chunk_frames;
+	std::vector<const Mesh *> meshes;
+	std::vector<int> topology; // Mesh::topology of the current epoch
+	int nodes;				   // over all meshes of the current epoch
+	// pending chunk
+	int chunk_start;
+	std::vector<double> times;
+	std::vector<double> xs; // 3 per node per frame
+	std::vector<char> record;
+	struct Entry
+	{
+		int64_t offset;
+		int first_frame, nframes, epoch;
+	};
+	std::vector<Entry> epoch_index, chunk_index;
+	void write_record(int type);
+	void write_epoch(const std::vector<Mesh *> &meshes);
+	void write_chunk();
+	AnimCacheWriter(const AnimCacheWriter &);
+	AnimCacheWriter &operator=(const AnimCacheWriter &);
+};
+
+// Memory-mapped reader.
+struct AnimCacheReader
+{
+	AnimCacheReader();
+	~AnimCacheReader();
+	bool open(const std::string &filename);
+	void close();
+	int frames() const;
+	double time(int frame);
+	// topology of every mesh at frame
+	const std::vector<AnimCacheTopology> &topology(int frame);
+	// node positions of every mesh at frame, concatenated in mesh order
+	const std::vector<Vec3> &positions(int frame);
+	// writes frame as <prefix>_<mesh>.obj, like save_objs
+	bool write_obj(int frame, const std::string &prefix);
+
+private:
+	const char *data;
+	size_t size;
+	void *handles[2]; // file and mapping (windows)
+	int fd;			  // (posix)
+	int encoding, chunk_frames;
+	double precision;
+	struct Entry
+	{
+		int64_t offset;
+		int first_frame, nframes, epoch;
+	};
+	std::vector<Entry> epoch_index, chunk_index;
+	// decoded chunk and epoch, reused by neighbouring frames
+	int chunk, epoch;
+	std::vector<double> times;
+	std::vector<std::vector<Vec3> > xs; // per frame of the chunk
+	std::vector<AnimCacheTopology> topo;
+	int find_chunk(int frame) const;
+	bool has_record(int64_t offset, int type) const;
+	bool read_index();
+	bool scan_records();
+	void load_chunk(int c);
+	void load_epoch(int e);
+	AnimCacheReader(const AnimCacheReader &);
+	AnimCacheReader &operator=(const AnimCacheReader &);
+};
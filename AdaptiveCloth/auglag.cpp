@@ -26,58 +26,132 @@
 
 #include <omp.h>
 #include <vector>
+#include "magic.hpp"
 #include "optimization.hpp"
+#include "util.hpp"
 #include "alglib/optimization.h"
 
 using namespace std;
 using namespace alglib;
 
-static const NLConOpt *problem;
-static vector<double> lambda;
-static double mu;
+// all state of one run lives in its AugLagContext, reached from alglib's
+// callback through its user pointer
+struct AugLagRun
+{
+	const NLConOpt *problem;
+	AugLagContext *context;
+};
+
+static double value_and_grad(const AugLagRun &run, const double *x,
+							 double *grad);
 
 static void auglag_value_and_grad(const real_1d_array &x, double &value,
-								  real_1d_array &grad, void *ptr = NULL);
+								  real_1d_array &grad, void *ptr);
+
+// Curvature pairs of the last few steps. They are kept across the inner
+// solves of a run: a multiplier update only shifts the penalty terms, so the
+// curvature they describe mostly stays valid.
+struct LBFGSMemory
+{
+	static const int m = 8;
+	int npairs, last; // pairs held, slot of the newest one
+	vector<double> s[m], y[m];
+	double rho[m];
+	LBFGSMemory(int n) : npairs(0), last(-1)
+	{
+		for (int j = 0; j < m; j++)
+		{
+			s[j].resize(n);
+			y[j].resize(n);
+		}
+	}
+};
 
-static void multiplier_update(const real_1d_array &x);
+static int lbfgs(const AugLagRun &run, vector<double> &x, int max_iter,
+				 OptOptions &opt, LBFGSMemory &memory);
 
-void augmented_lagrangian_method(const NLConOpt & problem, OptOptions opt, bool verbose)
+static void multiplier_update(const AugLagRun &run, const double *x);
+
+void augmented_lagrangian_method(const NLConOpt &problem, OptOptions opt,
+								 bool verbose)
+{
+	AugLagContext context;
+	augmented_lagrangian_method(problem, context, opt, verbose);
+}
+
+void augmented_lagrangian_method(const NLConOpt &problem,
+								 AugLagContext &context, OptOptions opt,
+								 bool verbose)
 {
-	::problem = &problem;
-	::lambda = vector<double>(::problem->ncon, 0);
-	::mu = 1e3;
+	AugLagRun run = { &problem, &context };
+	vector<int> key;
+	int first = problem.warm_constraints(key);
+	int nwarm = problem.ncon - first;
+	if (context.warm_start && nwarm > 0 && key == context.warm_key &&
+		context.lambda.size() - context.warm_first == nwarm)
+	{
+		// only the warm constraints keep their multipliers; the others
+		// may be different constraints at the same position
+		vector<double> lambda(problem.ncon, 0);
+		copy(context.lambda.begin() + context.warm_first,
+			 context.lambda.end(), lambda.begin() + first);
+		context.lambda.swap(lambda);
+	}
+	else
+	{
+		context.lambda.assign(problem.ncon, 0);
+		context.mu = 1e3;
+	}
+	context.warm_key.swap(key);
+	context.warm_first = first;
+	const int max_total_iter = opt.max_iter(),
+		max_sub_iter = sqrt(max_total_iter);
+	int iter = 0;
+	if (::magic.auglag_solver == "lbfgs")
+	{
+		vector<double> x(problem.nvar);
+		problem.initialize(&x[0]);
+		LBFGSMemory memory(problem.nvar);
+		while (iter < max_total_iter)
+		{
+			int max_iter = min(max_sub_iter, max_total_iter - iter);
+			int n = lbfgs(run, x, max_iter, opt, memory);
+			multiplier_update(run, &x[0]);
+			context.outer_iterations++;
+			if (verbose)
+				cout << n << " iterations" << endl;
+			if (n == 0)
+				break;
+			iter += n;
+		}
+		problem.finalize(&x[0]);
+		return;
+	}
 	real_1d_array x;
-	x.setlength(::problem->nvar);
-	::problem->initialize(&x[0]);
+	x.setlength(problem.nvar);
+	problem.initialize(&x[0]);
 	mincgstate state;
 	mincgreport rep;
 	mincgcreate(x, state);
-	const int max_total_iter = opt.max_iter(),
-		max_sub_iter = sqrt(max_total_iter);
-	int iter = 0;
 	while (iter < max_total_iter)
 	{
 		int max_iter = min(max_sub_iter, max_total_iter - iter);
 		mincgsetcond(state, opt.eps_g(), opt.eps_f(), opt.eps_x(), max_iter);
 		if (iter > 0)
 			mincgrestartfrom(state, x);
-		mincgsuggeststep(state, 1e-3*::problem->nvar);
-		mincgoptimize(state, auglag_value_and_grad);
+		mincgsuggeststep(state, 1e-3*problem.nvar);
+		mincgoptimize(state, auglag_value_and_grad, NULL, &run);
 		mincgresults(state, x, rep);
-		multiplier_update(x);
+		multiplier_update(run, &x[0]);
+		context.outer_iterations++;
+		context.inner_iterations += rep.iterationscount;
 		if (verbose)
 			cout << rep.iterationscount << " iterations" << endl;
 		if (rep.iterationscount == 0)
 			break;
 		iter += rep.iterationscount;
 	}
-	::problem->finalize(&x[0]);
-}
-
-static void add(real_1d_array &x, const vector<double> &y)
-{
-	for (int i = 0; i < y.size(); i++)
-		x[i] += y[i];
+	problem.finalize(&x[0]);
 }
 
 inline double clamp_violation(double x, int sign)
@@ -85,49 +159,170 @@ inline double clamp_violation(double x, int sign)
 	return (sign < 0) ? max(x, 0.) : (sign > 0) ? min(x, 0.) : x;
 }
 
-static void auglag_value_and_grad(const real_1d_array &x, double &value,
-								  real_1d_array &grad, void *ptr)
+// value and gradient of the objective plus the penalty terms
+static double value_and_grad(const AugLagRun &run, const double *x,
+							 double *grad)
 {
-	::problem->precompute(&x[0]);
-	value = ::problem->objective(&x[0]);
-	::problem->obj_grad(&x[0], &grad[0]);
-	static const int nthreads = omp_get_max_threads();
-	static double *values = new double[nthreads];
-	static vector<double> *grads = new vector<double>[nthreads];
+	const NLConOpt &problem = *run.problem;
+	AugLagContext &context = *run.context;
+	context.evaluations++;
+	problem.precompute(x);
+	double value = problem.objective(x);
+	problem.obj_grad(x, grad);
+	const int nthreads = omp_get_max_threads();
+	context.values.assign(nthreads, 0);
+	context.grads.resize(nthreads);
 	for (int t = 0; t < nthreads; t++)
-	{
-		values[t] = 0;
-		grads[t].assign(::problem->nvar, 0);
-	}
+		context.grads[t].assign(problem.nvar, 0);
 #pragma omp parallel for
-	for (int j = 0; j < ::problem->ncon; j++)
+	for (int j = 0; j < problem.ncon; j++)
 	{
 		int t = omp_get_thread_num();
 		int sign;
-		double gj = ::problem->constraint(&x[0], j, sign);
-		double cj = clamp_violation(gj + ::lambda[j] / ::mu, sign);
+		double gj = problem.constraint(x, j, sign);
+		double cj = clamp_violation(gj + context.lambda[j] / context.mu, sign);
 		if (cj != 0)
 		{
-			values[t] += ::mu / 2 * sq(cj);
-			::problem->con_grad(&x[0], j, ::mu*cj, &grads[t][0]);
+			context.values[t] += context.mu / 2 * sq(cj);
+			problem.con_grad(x, j, context.mu*cj, &context.grads[t][0]);
 		}
 	}
 	for (int t = 0; t < nthreads; t++)
-		value += values[t];
+		value += context.values[t];
 #pragma omp parallel for
-	for (int i = 0; i < ::problem->nvar; i++)
+	for (int i = 0; i < problem.nvar; i++)
 		for (int t = 0; t < nthreads; t++)
-			grad[i] += grads[t][i];
+			grad[i] += context.grads[t][i];
+	return value;
+}
+
+static void auglag_value_and_grad(const real_1d_array &x, double &value,
+								  real_1d_array &grad, void *ptr)
+{
+	value = value_and_grad(*(const AugLagRun*)ptr, &x[0], &grad[0]);
+}
+
+// L-BFGS
+
+static double dot(const vector<double> &x, const vector<double> &y)
+{
+	double d = 0;
+	for (int i = 0; i < x.size(); i++)
+		d += x[i] * y[i];
+	return d;
+}
+
+// minimizes the penalized objective from x with limited-memory BFGS and a
+// backtracking line search; stops on the same criteria as alglib's mincg
+// and returns the number of iterations taken
+static int lbfgs(const AugLagRun &run, vector<double> &x, int max_iter,
+				 OptOptions &opt, LBFGSMemory &mem)
+{
+	static const int m = LBFGSMemory::m;
+	static const double c = 1e-4; // sufficient decrease parameter
+	static const int max_backtracks = 40;
+	const int n = x.size();
+	vector<double> g(n), p(n), x1(n), g1(n);
+	double alpha[m];
+	double f = value_and_grad(run, &x[0], &g[0]);
+	int iter;
+	for (iter = 0; iter < max_iter; iter++)
+	{
+		double gnorm = sqrt(dot(g, g));
+		if (gnorm <= opt.eps_g())
+			break;
+		// two-loop recursion for p = -H g, newest pair first
+		for (int i = 0; i < n; i++)
+			p[i] = -g[i];
+		for (int k = 0; k < mem.npairs; k++)
+		{
+			int j = (mem.last - k + m) % m;
+			alpha[j] = mem.rho[j] * dot(mem.s[j], p);
+			for (int i = 0; i < n; i++)
+				p[i] -= alpha[j] * mem.y[j][i];
+		}
+		// initial scaling; the first step is as long as mincgsuggeststep's
+		double gamma = mem.npairs > 0
+			? dot(mem.s[mem.last], mem.y[mem.last]) / dot(mem.y[mem.last], mem.y[mem.last])
+			: 1e-3 * n / gnorm;
+		for (int i = 0; i < n; i++)
+			p[i] *= gamma;
+		for (int k = mem.npairs - 1; k >= 0; k--)
+		{
+			int j = (mem.last - k + m) % m;
+			double beta = mem.rho[j] * dot(mem.y[j], p);
+			for (int i = 0; i < n; i++)
+				p[i] += (alpha[j] - beta) * mem.s[j][i];
+		}
+		double g0 = dot(g, p);
+		if (g0 >= 0)
+		{ // not a descent direction, fall back to steepest descent
+			mem.npairs = 0;
+			for (int i = 0; i < n; i++)
+				p[i] = -1e-3 * n / gnorm * g[i];
+			g0 = dot(g, p);
+		}
+		double a = 1, f1;
+		int backtracks = 0;
+		while (true)
+		{
+			for (int i = 0; i < n; i++)
+				x1[i] = x[i] + a * p[i];
+			f1 = value_and_grad(run, &x1[0], &g1[0]);
+			if (f1 <= f + c * a * g0 || a * sqrt(dot(p, p)) <= opt.eps_x())
+				break;
+			if (++backtracks == max_backtracks)
+				break;
+			a /= 2;
+		}
+		if (backtracks == max_backtracks)
+		{ // no decrease along p, e.g. a NaN or a bad quasi-Newton direction
+			if (mem.npairs == 0) // already steepest descent, give up
+				break;
+			mem.npairs = 0; // retry from x with steepest descent
+			iter--;
+			continue;
+		}
+		int j = (mem.last + 1) % m;
+		for (int i = 0; i < n; i++)
+		{
+			mem.s[j][i] = x1[i] - x[i];
+			mem.y[j][i] = g1[i] - g[i];
+		}
+		double ss = dot(mem.s[j], mem.s[j]), sy = dot(mem.s[j], mem.y[j]);
+		if (sy > 1e-12 * sqrt(ss * dot(mem.y[j], mem.y[j])))
+		{
+			mem.rho[j] = 1 / sy;
+			mem.last = j;
+			mem.npairs = min(mem.npairs + 1, m);
+		}
+		else // curvature condition failed, start over
+			mem.npairs = 0;
+		double df = f - f1;
+		swap(x, x1);
+		swap(g, g1);
+		f = f1;
+		run.context->inner_iterations++;
+		if (df <= opt.eps_f() * max(max(abs(f), abs(f + df)), 1.)
+			|| sqrt(ss) <= opt.eps_x())
+		{
+			iter++;
+			break;
+		}
+	}
+	return iter;
 }
 
-static void multiplier_update(const real_1d_array &x)
+static void multiplier_update(const AugLagRun &run, const double *x)
 {
-	::problem->precompute(&x[0]);
+	const NLConOpt &problem = *run.problem;
+	AugLagContext &context = *run.context;
+	problem.precompute(x);
 #pragma omp parallel for
-	for (int j = 0; j < ::problem->ncon; j++)
+	for (int j = 0; j < problem.ncon; j++)
 	{
 		int sign;
-		double gj = ::problem->constraint(&x[0], j, sign);
-		::lambda[j] = clamp_violation(::lambda[j] + ::mu*gj, sign);
+		double gj = problem.constraint(x, j, sign);
+		context.lambda[j] = clamp_violation(context.lambda[j] + context.mu*gj, sign);
 	}
 }
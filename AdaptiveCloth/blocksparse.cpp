@@ -0,0 +1,235 @@
+/*************************************************************************
+************************    ARCSim_BlockSparse    ************************
+*************************************************************************/
+#include "blocksparse.hpp"
+#include "util.hpp"
+#include <algorithm>
+
+using namespace std;
+
+static int pattern_stamp = 0;
+
+int BlockSpMat::find(int i, int j) const
+{
+	vector<int>::const_iterator begin = colind.begin() + rowptr[i],
+								end = colind.begin() + rowptr[i + 1],
+								it = lower_bound(begin, end, j);
+	return (it != end && *it == j) ? (int)(it - colind.begin()) : -1;
+}
+
+static void set_pattern(BlockSpMat &A, vector<vector<int> > &rows)
+{
+	int n = rows.size();
+	A.n = n;
+	A.rowptr.resize(n + 1);
+	A.colind.clear();
+	A.diag.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		vector<int> &row = rows[i];
+		sort(row.begin(), row.end());
+		row.erase(unique(row.begin(), row.end()), row.end());
+		A.rowptr[i] = A.colind.size();
+		A.colind.insert(A.colind.end(), row.begin(), row.end());
+	}
+	A.rowptr[n] = A.colind.size();
+	for (int i = 0; i < n; i++)
+		A.diag[i] = A.find(i, i);
+	A.blocks.assign(A.colind.size(), Mat3x3(0));
+	A.pattern = ++::pattern_stamp;
+}
+
+template <int m>
+static void add_stencil(vector<vector<int> > &rows, const Vec<m, int> &ix)
+{
+	for (int i = 0; i < m; i++)
+		for (int j = 0; j < m; j++)
+			rows[ix[i]].push_back(ix[j]);
+}
+
+template <int m>
+static Vec<m * m, int> stencil_slots(const BlockSpMat &A, const Vec<m, int> &ix)
+{
+	Vec<m * m, int> slots;
+	for (int i = 0; i < m; i++)
+		for (int j = 0; j < m; j++)
+			slots[i * m + j] = A.find(ix[i], ix[j]);
+	return slots;
+}
+
+static Vec<3, int> face_nodes(const Face *face)
+{
+	Vec<3, int> ix;
+	for (int v = 0; v < 3; v++)
+		ix[v] = face->v[v]->node->index;
+	return ix;
+}
+
+static Vec<4, int> edge_nodes(const Edge *edge)
+{
+	Vec<4, int> ix;
+	ix[0] = edge->n[0]->index;
+	ix[1] = edge->n[1]->index;
+	ix[2] = edge_opp_vert(edge, 0)->node->index;
+	ix[3] = edge_opp_vert(edge, 1)->node->index;
+	return ix;
+}
+
+// greedy coloring in element order, so the result is deterministic
+template <int m>
+static void add_to_coloring(vector<vector<int> > &colors,
+							vector<vector<int> > &node_colors,
+							vector<int> &stamp, int elem, const Vec<m, int> &ix)
+{
+	for (int i = 0; i < m; i++)
+		for (int k = 0; k < node_colors[ix[i]].size(); k++)
+			stamp[node_colors[ix[i]][k]] = elem;
+	int c = 0;
+	while (c < colors.size() && stamp[c] == elem)
+		c++;
+	if (c == colors.size())
+	{
+		colors.push_back(vector<int>());
+		stamp.push_back(-1);
+	}
+	colors[c].push_back(elem);
+	for (int i = 0; i < m; i++)
+		node_colors[ix[i]].push_back(c);
+}
+
+static void build_coloring(BlockSpMat &A, const Mesh &mesh)
+{
+	vector<vector<int> > node_colors(mesh.nodes.size());
+	vector<int> stamp;
+	A.face_colors.clear();
+	for (int f = 0; f < mesh.faces.size(); f++)
+		add_to_coloring(A.face_colors, node_colors, stamp, f,
+						face_nodes(mesh.faces[f]));
+	for (int n = 0; n < node_colors.size(); n++)
+		node_colors[n].clear();
+	stamp.assign(stamp.size(), -1);
+	A.edge_colors.clear();
+	for (int e = 0; e < mesh.edges.size(); e++)
+	{
+		const Edge *edge = mesh.edges[e];
+		if (edge->adjf[0] && edge->adjf[1])
+			add_to_coloring(A.edge_colors, node_colors, stamp, e,
+							edge_nodes(edge));
+	}
+}
+
+static void build_pattern(BlockSpMat &A, const Mesh &mesh)
+{
+	int nn = mesh.nodes.size();
+	vector<vector<int> > rows(nn);
+	for (int n = 0; n < nn; n++)
+		rows[n].push_back(n);
+	for (int f = 0; f < mesh.faces.size(); f++)
+		add_stencil(rows, face_nodes(mesh.faces[f]));
+	for (int e = 0; e < mesh.edges.size(); e++)
+	{
+		const Edge *edge = mesh.edges[e];
+		if (edge->adjf[0] && edge->adjf[1])
+			add_stencil(rows, edge_nodes(edge));
+	}
+	set_pattern(A, rows);
+	A.face_slots.resize(mesh.faces.size());
+	for (int f = 0; f < mesh.faces.size(); f++)
+		A.face_slots[f] = stencil_slots(A, face_nodes(mesh.faces[f]));
+	A.edge_slots.resize(mesh.edges.size());
+	for (int e = 0; e < mesh.edges.size(); e++)
+	{
+		const Edge *edge = mesh.edges[e];
+		if (edge->adjf[0] && edge->adjf[1])
+			A.edge_slots[e] = stencil_slots(A, edge_nodes(edge));
+		else
+			A.edge_slots[e] = Vec<16, int>(-1);
+	}
+	build_coloring(A, mesh);
+	A.topology = mesh.topology;
+}
+
+static void save_pattern(BlockSpMat::Pattern &p, const BlockSpMat &A)
+{
+	p.rowptr = A.rowptr;
+	p.colind = A.colind;
+	p.diag = A.diag;
+	p.stamp = A.pattern;
+}
+
+static void use_pattern(BlockSpMat &A, const BlockSpMat::Pattern &p)
+{
+	A.rowptr = p.rowptr;
+	A.colind = p.colind;
+	A.diag = p.diag;
+	A.pattern = p.stamp;
+}
+
+void prepare_system(BlockSpMat &A, const Mesh &mesh)
+{
+	if (A.topology != mesh.topology || A.n != mesh.nodes.size())
+	{
+		build_pattern(A, mesh);
+		save_pattern(A.base, A);
+		A.merged_keys.clear();
+		A.is_merged = false;
+	}
+	else
+	{
+		if (A.is_merged)
+		{
+			use_pattern(A, A.base);
+			A.is_merged = false;
+		}
+		A.blocks.assign(A.colind.size(), Mat3x3(0));
+	}
+	A.overflow.clear();
+}
+
+void finalize_system(BlockSpMat &A)
+{
+	if (A.overflow.empty())
+		return;
+	vector<pair<int, int> > keys;
+	for (int o = 0; o < A.overflow.size(); o++)
+	{
+		int i = A.overflow[o].first.first, j = A.overflow[o].first.second;
+		keys.push_back(make_pair(i, j));
+		keys.push_back(make_pair(j, i)); // keep the pattern symmetric
+	}
+	sort(keys.begin(), keys.end());
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+	// face_slots/edge_slots stay in topology-pattern slots; only the
+	// assembled blocks move
+	vector<Mat3x3> base_blocks;
+	base_blocks.swap(A.blocks);
+	if (keys != A.merged_keys)
+	{
+		vector<vector<int> > rows(A.n);
+		for (int i = 0; i < A.n; i++)
+			rows[i].assign(A.colind.begin() + A.rowptr[i],
+						   A.colind.begin() + A.rowptr[i + 1]);
+		for (int k = 0; k < keys.size(); k++)
+			rows[keys[k].first].push_back(keys[k].second);
+		set_pattern(A, rows);
+		const BlockSpMat::Pattern &base = A.base;
+		A.merged_remap.resize(base.colind.size());
+		for (int i = 0; i < A.n; i++)
+			for (int k = base.rowptr[i]; k < base.rowptr[i + 1]; k++)
+				A.merged_remap[k] = A.find(i, base.colind[k]);
+		save_pattern(A.merged, A);
+		A.merged_keys.swap(keys);
+	}
+	else
+		use_pattern(A, A.merged);
+	A.is_merged = true;
+	A.blocks.assign(A.colind.size(), Mat3x3(0));
+	for (int k = 0; k < base_blocks.size(); k++)
+		A.blocks[A.merged_remap[k]] = base_blocks[k];
+	for (int o = 0; o < A.overflow.size(); o++)
+	{
+		int i = A.overflow[o].first.first, j = A.overflow[o].first.second;
+		A.blocks[A.find(i, j)] += A.overflow[o].second;
+	}
+	A.overflow.clear();
+}
@@ -0,0 +1,65 @@
+/*************************************************************************
+************************    ARCSim_BlockSparse    ************************
+*************************************************************************/
+#pragma once
+
+#include "mesh.hpp"
+#include "vectors.hpp"
+#include <utility>
+#include <vector>
+
+// Block compressed sparse row matrix of 3x3 blocks for the implicit step.
+// The sparsity pattern is derived from the mesh topology (face and bending
+// stencils) and reused across timesteps until the mesh is remeshed, so
+// assembling forces is a stream of writes into precomputed slots.
+// Couplings that fall outside the pattern (contact and friction between
+// non-adjacent nodes) go to an overflow list that finalize_system() merges
+// into a copy of the topology pattern for this step only; the merged
+// pattern (and its stamp) is reused while the overflow couplings stay the
+// same, and prepare_system() goes back to the topology pattern.
+struct BlockSpMat
+{
+	int n;
+	std::vector<int> rowptr; // row i occupies slots [rowptr[i], rowptr[i+1])
+	std::vector<int> colind; // column of each slot, sorted within a row
+	std::vector<int> diag;	 // slot of block (i,i)
+	std::vector<Mat3x3> blocks;
+	// per-element scatter slots, row-major over the element's nodes
+	std::vector<Vec<9, int> > face_slots;
+	std::vector<Vec<16, int> > edge_slots; // -1 for boundary edges
+	// element indices grouped so that no two elements of a color share a
+	// node; colors can be assembled in parallel without write conflicts
+	std::vector<std::vector<int> > face_colors, edge_colors;
+	int topology; // mesh.topology the pattern was built from
+	int pattern;  // changes whenever rowptr/colind change
+	std::vector<std::pair<std::pair<int, int>, Mat3x3> > overflow;
+	// the topology pattern, and the last merged one with the overflow
+	// couplings it holds and where each topology slot went
+	struct Pattern
+	{
+		std::vector<int> rowptr, colind, diag;
+		int stamp;
+	};
+	Pattern base, merged;
+	std::vector<std::pair<int, int> > merged_keys;
+	std::vector<int> merged_remap;
+	bool is_merged; // rowptr/colind/diag currently hold merged
+	BlockSpMat() : n(0), topology(-1), pattern(-1), is_merged(false) {}
+	int find(int i, int j) const; // -1 if (i,j) is not in the pattern
+	void add(int i, int j, const Mat3x3 &a)
+	{
+		int k = find(i, j);
+		if (k >= 0)
+			blocks[k] += a;
+		else
+			overflow.push_back(std::make_pair(std::make_pair(i, j), a));
+	}
+};
+
+// rebuilds the pattern if the mesh topology changed, otherwise returns to
+// the topology pattern; then zeroes all blocks
+void prepare_system(BlockSpMat &A, const Mesh &mesh);
+
+// switches to the topology pattern plus this step's overflow couplings, if
+// any, and adds the overflow blocks in
+void finalize_system(BlockSpMat &A);
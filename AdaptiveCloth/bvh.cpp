@@ -48,6 +48,7 @@
 #include "bvh.hpp"
 #include "collision.hpp"
 #include "mesh.hpp"
+#include <algorithm>
 #include <climits>
 #include <utility>
 
@@ -105,145 +106,129 @@ bool overlap(const BOX &box0, const BOX &box1, float thickness)
 	return box0.overlaps(dilate(box1, thickness));
 }
 
-float
-DeformBVHTree::refit()
-{
-	getRoot()->refit(_ccd);
-
-	return 0.f;
-}
-
-BOX
-DeformBVHTree::box()
+// surface area of the axis-aligned part of a box
+static float box_area(const BOX &box)
 {
-	return getRoot()->_box;
+	float w = box.width(), h = box.height(), d = box.depth();
+	return 2 * (w * h + h * d + d * w);
 }
 
-inline vec3f norm(vec3f &p1, vec3f &p2, vec3f &p3)
+// returns the summed area of the internal boxes relative to the root box;
+// it grows as refitting loosens a tree built for an older configuration
+float
+DeformBVHTree::refit()
 {
-	vec3f s = p2 - p1;
-	vec3f t = p3 - p1;
-	vec3f n = cross(s, t);
-	return n;
-}
+	float area = 0;
 
-void
-DeformBVHNode::refit(bool ccd)
-{
-	if (isLeaf())
+	// children come after their parent, so a reverse sweep is bottom-up
+	for (int i = (int)_box.size() - 1; i >= 0; i--)
 	{
-		_box = face_box(getFace(), ccd);
+		if (isLeaf(i))
+			_box[i] = face_box(_face[i], _ccd);
+		else
+		{
+			_box[i] = _box[getLeftChild(i)] + _box[getRightChild(i)];
+			area += box_area(_box[i]);
+		}
 	}
-	else
-	{
-		getLeftChild()->refit(ccd);
-		getRightChild()->refit(ccd);
 
-		_box = getLeftChild()->_box + getRightChild()->_box;
-	}
+	float root_area = empty() ? 0.f : box_area(_box[0]);
+	return root_area > 0 ? area / root_area : 0.f;
 }
 
-bool
-DeformBVHNode::find(Face *face)
+BOX
+DeformBVHTree::box()
 {
-	if (isLeaf())
-		return getFace() == face;
-
-	if (getLeftChild()->find(face))
-		return true;
-
-	if (getRightChild()->find(face))
-		return true;
-
-	return false;
+	return _box[getRoot()];
 }
 
 inline float middle_xyz(char xyz, const vec3f &p1, const vec3f &p2, const vec3f &p3)
 {
 	float t0, t1;
-
 	t0 = MIN(p1[xyz], p2[xyz]);
 	t0 = MIN(t0, p3[xyz]);
 	t1 = MAX(p1[xyz], p2[xyz]);
 	t1 = MAX(t1, p3[xyz]);
-	return (t0 + t1)*0.5f;
+	return (t0 + t1) * 0.5f;
 }
 
-class aap
+// spreads the low 10 bits of v so that two zero bits follow each one
+static unsigned int expand_bits(unsigned int v)
 {
-public:
-	char _xyz;
-	float _p;
-
-	FORCEINLINE aap(const BOX &total)
-	{
-		vec3f center = total.center();
-		char xyz = 2;
-
-		if (total.width() >= total.height() && total.width() >= total.depth())
-		{
-			xyz = 0;
-		}
-		else
-			if (total.height() >= total.width() && total.height() >= total.depth())
-			{
-				xyz = 1;
-			}
-
-		_xyz = xyz;
-		_p = center[xyz];
-	}
-
-	FORCEINLINE bool inside(const vec3f &mid) const
-	{
-		return mid[_xyz] > _p;
-	}
-};
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
 
-extern float middle_xyz(char xyz, const vec3f &p1, const vec3f &p2, const vec3f &p3);
+// 30-bit Morton code of a point in the unit cube
+static unsigned int morton_code(const vec3f &p)
+{
+	unsigned int q[3];
+	for (int i = 0; i < 3; i++)
+		q[i] = (unsigned int)MIN(MAX(p[i] * 1024, 0.0), 1023.0);
+	return (expand_bits(q[0]) << 2) | (expand_bits(q[1]) << 1) | expand_bits(q[2]);
+}
 
 DeformBVHTree::DeformBVHTree(DeformModel &mdl, bool ccd)
 {
 	_mdl = &mdl;
 	_ccd = ccd;
 
-	if (!mdl.verts.empty())
+	if (!mdl.faces.empty())
 		Construct();
-	else
-		_root = NULL;
 }
 
-void DeformBVHTree::Construct()
+// emits the subtree over the sorted range [lo, hi) in depth-first order
+static int build_node(DeformBVHTree &tree, const vector<pair<unsigned int, int> > &sorted,
+					  int lo, int hi, int parent)
 {
-	BOX total;
-	int count;
-
-	int num_vtx = _mdl->verts.size(),
-		num_tri = _mdl->faces.size();
+	int i = tree._right.size();
+	tree._right.push_back(-1);
+	tree._parent.push_back(parent);
+	tree._face.push_back(NULL);
 
-	for (unsigned int i = 0; i < num_vtx; i++)
+	if (hi - lo == 1)
 	{
-		total += _mdl->verts[i]->node->x;
-
-		if (_ccd)
-			total += _mdl->verts[i]->node->x0;
+		tree._face[i] = tree._mdl->faces[sorted[lo].second];
+		return i;
 	}
 
-	count = num_tri;
-
-	BOX *tri_boxes = new BOX[count];
-	vec3f *tri_centers = new vec3f[count];
+	// first element whose code differs from sorted[lo] in the highest bit
+	// that distinguishes the range; the middle if all codes are equal
+	unsigned int first = sorted[lo].first, last = sorted[hi - 1].first;
+	int mid = (lo + hi) / 2;
+	if (first != last)
+	{
+		unsigned int bit = 1u << 31;
+		while (!((first ^ last) & bit))
+			bit >>= 1;
+		int a = lo, b = hi - 1;
+		while (a + 1 < b)
+		{
+			int m = (a + b) / 2;
+			if (sorted[m].first & bit)
+				b = m;
+			else
+				a = m;
+		}
+		mid = b;
+	}
 
-	aap  pln(total);
+	build_node(tree, sorted, lo, mid, i);
+	tree._right[i] = build_node(tree, sorted, mid, hi, i);
+	return i;
+}
 
-	face_buffer = new Face*[count];
-	unsigned int left_idx = 0, right_idx = count;
-	unsigned int tri_idx = 0;
+void DeformBVHTree::Construct()
+{
+	int num_tri = _mdl->faces.size();
 
-	for (unsigned int i = 0; i < num_tri; i++)
+	vector<vec3f> centers(num_tri);
+	BOX total;
+	for (int i = 0; i < num_tri; i++)
 	{
-		tri_idx++;
-
 		vec3f &p1 = _mdl->faces[i]->v[0]->node->x;
 		vec3f &p2 = _mdl->faces[i]->v[1]->node->x;
 		vec3f &p3 = _mdl->faces[i]->v[2]->node->x;
@@ -251,156 +236,33 @@ void DeformBVHTree::Construct()
 		vec3f &pp2 = _mdl->faces[i]->v[1]->node->x0;
 		vec3f &pp3 = _mdl->faces[i]->v[2]->node->x0;
 
-		if (_ccd)
-		{
-
-			tri_centers[tri_idx - 1] = vec3f(
-				(middle_xyz(0, p1, p2, p3) + middle_xyz(0, pp1, pp2, pp3))*0.5f,
-				(middle_xyz(1, p1, p2, p3) + middle_xyz(1, pp1, pp2, pp3))*0.5f,
-				(middle_xyz(2, p1, p2, p3) + middle_xyz(2, pp1, pp2, pp3))*0.5f);
-		}
-		else
-		{
-			tri_centers[tri_idx - 1] = vec3f(
-				middle_xyz(0, p1, p2, p3),
-				middle_xyz(1, p1, p2, p3),
-				middle_xyz(2, p1, p2, p3));
-		}
-
-		if (pln.inside(tri_centers[tri_idx - 1]))
-			face_buffer[left_idx++] = _mdl->faces[i];
-		else
-			face_buffer[--right_idx] = _mdl->faces[i];
-
-		tri_boxes[tri_idx - 1] += p1;
-		tri_boxes[tri_idx - 1] += p2;
-		tri_boxes[tri_idx - 1] += p3;
-
-		if (_ccd)
-		{
-			tri_boxes[tri_idx - 1] += pp1;
-			tri_boxes[tri_idx - 1] += pp2;
-			tri_boxes[tri_idx - 1] += pp3;
-		}
+		for (int xyz = 0; xyz < 3; xyz++)
+			centers[i][xyz] = _ccd ? (middle_xyz(xyz, p1, p2, p3) + middle_xyz(xyz, pp1, pp2, pp3)) * 0.5f
+								   : middle_xyz(xyz, p1, p2, p3);
+		total += centers[i];
 	}
 
-	_root = new DeformBVHNode();
-	_root->_box = total;
-	//_root->_count = count;
-
-	if (count == 1)
+	// quantize the centroids in their bounding box and sort by code, then
+	// by face index so the tree is deterministic
+	vec3f lo(total._dist[0], total._dist[1], total._dist[2]),
+		extent(total.width(), total.height(), total.depth());
+	vector<pair<unsigned int, int> > sorted(num_tri);
+	for (int i = 0; i < num_tri; i++)
 	{
-		_root->_face = _mdl->faces[0];
-		_root->_left = _root->_right = NULL;
-	}
-	else
-	{
-		if (left_idx == 0 || left_idx == count)
-			left_idx = count / 2;
-
-		_root->_left = new DeformBVHNode(_root, face_buffer, left_idx, tri_boxes, tri_centers);
-		_root->_right = new DeformBVHNode(_root, face_buffer + left_idx, count - left_idx, tri_boxes, tri_centers);
+		vec3f p;
+		for (int xyz = 0; xyz < 3; xyz++)
+			p[xyz] = extent[xyz] > 0 ? (centers[i][xyz] - lo[xyz]) / extent[xyz] : 0;
+		sorted[i] = make_pair(morton_code(p), i);
 	}
+	sort(sorted.begin(), sorted.end());
 
-	delete[] tri_boxes;
-	delete[] tri_centers;
-}
+	int num_nodes = 2 * num_tri - 1;
+	_right.reserve(num_nodes);
+	_parent.reserve(num_nodes);
+	_face.reserve(num_nodes);
+	build_node(*this, sorted, 0, num_tri, -1);
 
-DeformBVHTree::~DeformBVHTree()
-{
-	if (!_root)
-		return;
-	delete _root;
-	delete[] face_buffer;
-}
-
-//#################################################################
-// called by root
-DeformBVHNode::DeformBVHNode()
-{
-	_face = NULL;
-	_left = _right = NULL;
-	_parent = NULL;
-	//_count = 0;
-	_active = true;
-}
-
-DeformBVHNode::~DeformBVHNode()
-{
-	if (_left) delete _left;
-	if (_right) delete _right;
-}
-
-// called by leaf
-DeformBVHNode::DeformBVHNode(DeformBVHNode *parent, Face *face, BOX *tri_boxes, vec3f *tri_centers)
-{
-	_left = _right = NULL;
-	_parent = parent;
-	_face = face;
-	_box = tri_boxes[face->index];
-	//_count = 1;
-	_active = true;
-}
-
-// called by nodes
-DeformBVHNode::DeformBVHNode(DeformBVHNode *parent, Face **lst, unsigned int lst_num, BOX *tri_boxes, vec3f *tri_centers)
-{
-	assert(lst_num > 0);
-	_left = _right = NULL;
-	_parent = parent;
-	_face = NULL;
-	//_count = lst_num;
-	_active = true;
-
-	if (lst_num == 1)
-	{
-		_face = lst[0];
-		_box = tri_boxes[lst[0]->index];
-	}
-	else
-	{ // try to split them
-		for (unsigned int t = 0; t < lst_num; t++)
-		{
-			int i = lst[t]->index;
-			_box += tri_boxes[i];
-		}
-
-		if (lst_num == 2)
-		{ // must split it!
-			_left = new DeformBVHNode(this, lst[0], tri_boxes, tri_centers);
-			_right = new DeformBVHNode(this, lst[1], tri_boxes, tri_centers);
-		}
-		else
-		{
-			aap pln(_box);
-			unsigned int left_idx = 0, right_idx = lst_num - 1;
-
-			for (unsigned int t = 0; t < lst_num; t++)
-			{
-				int i = lst[left_idx]->index;
-				if (pln.inside(tri_centers[i]))
-					left_idx++;
-				else
-				{// swap it
-					Face *tmp = lst[left_idx];
-					lst[left_idx] = lst[right_idx];
-					lst[right_idx--] = tmp;
-				}
-			}
-
-			int hal = lst_num / 2;
-			if (left_idx == 0 || left_idx == lst_num)
-			{
-				_left = new DeformBVHNode(this, lst, hal, tri_boxes, tri_centers);
-				_right = new DeformBVHNode(this, lst + hal, lst_num - hal, tri_boxes, tri_centers);
-
-			}
-			else
-			{
-				_left = new DeformBVHNode(this, lst, left_idx, tri_boxes, tri_centers);
-				_right = new DeformBVHNode(this, lst + left_idx, lst_num - left_idx, tri_boxes, tri_centers);
-			}
-
-		}
-	}
+	_box.resize(num_nodes);
+	_active.assign(num_nodes, true);
+	refit();
 }
@@ -282,62 +282,42 @@ bool overlap(const BOX &box0, const BOX &box1, float thickness);
 
 // ostream &operator<< (ostream &out, const BOX &box) {out << "["<<box._dist[0]<<", "<<box._dist[9]<<"] x ["<<box._dist[1]<<", "<<box._dist[10]<<"] x ["<<box._dist[2]<<", "<<box._dist[11]<<"]"; return out;}
 
-class DeformBVHNode;
 typedef Mesh DeformModel;
 
-class DeformBVHNode
-{
-public:
-	BOX _box;
-
-	Face *_face;
-
-	DeformBVHNode *_parent;
-	DeformBVHNode *_left;
-	DeformBVHNode *_right;
-
-	bool _active;
-
-public:
-	DeformBVHNode();
-	DeformBVHNode(DeformBVHNode *, Face *, BOX *, vec3f *);
-	DeformBVHNode(DeformBVHNode *, Face **, unsigned int, BOX *, vec3f *);
-
-	~DeformBVHNode();
-
-	void refit(bool = false);
-	bool find(Face *);
-
-	FORCEINLINE DeformBVHNode *getLeftChild() { return _left; }
-	FORCEINLINE DeformBVHNode *getRightChild() { return _right; }
-	FORCEINLINE DeformBVHNode *getParent() { return _parent; }
-
-	FORCEINLINE Face *getFace() { return _face; }
-	FORCEINLINE bool isLeaf() { return _left == NULL; }
-	FORCEINLINE bool isRoot() { return _parent == NULL; }
-
-	friend class DeformBVHTree;
-};
-
+// Linear BVH over the faces of a mesh. Nodes live in flat arrays in
+// depth-first order: the left child of internal node i is i + 1 and its
+// right child is _right[i]; leaves have _right[i] == -1 and a face. The
+// hierarchy is built top-down over the Morton-ordered face centroids,
+// splitting each range at the highest differing bit of its codes, and
+// refit bottom-up by a reverse sweep over the arrays.
 class DeformBVHTree
 {
 public:
-	DeformModel		*_mdl;
-	DeformBVHNode	*_root;
-	Face **face_buffer;
-
+	DeformModel *_mdl;
 	bool _ccd;
 
+	std::vector<BOX> _box;
+	std::vector<int> _right;
+	std::vector<int> _parent;
+	std::vector<Face *> _face;
+	std::vector<char> _active;
+
 public:
 	DeformBVHTree(DeformModel &, bool);
-	~DeformBVHTree();
 
 	void Construct();
 
 	float refit();
 
 	BOX box();
-	FORCEINLINE DeformBVHNode *getRoot() { return _root; }
 
-	friend class DeformBVHNode;
-};
\ No newline at end of file
+	FORCEINLINE bool empty() const { return _box.empty(); }
+	FORCEINLINE int getRoot() const { return 0; }
+	FORCEINLINE int getLeftChild(int i) const { return i + 1; }
+	FORCEINLINE int getRightChild(int i) const { return _right[i]; }
+	FORCEINLINE int getParent(int i) const { return _parent[i]; }
+
+	FORCEINLINE Face *getFace(int i) const { return _face[i]; }
+	FORCEINLINE bool isLeaf(int i) const { return _right[i] < 0; }
+	FORCEINLINE bool isRoot(int i) const { return i == 0; }
+};
@@ -0,0 +1,511 @@
+/*************************************************************************
+****************************    ARCSim_CCD    ****************************
+*************************************************************************/
+
+#include "ccd.hpp"
+#include <cmath>
+#include <limits>
+
+// Lanes holds one double per candidate of a group, Mask one condition per
+// candidate. Comparisons are ordered (false on NaN) like their scalar
+// counterparts, and no operation is fused, so every width computes the same
+// bits as plain double arithmetic.
+
+#if defined(_AVX) || defined(__AVX__)
+#include <immintrin.h>
+
+static const int W = 4;
+struct Lanes
+{
+	__m256d v;
+};
+struct Mask
+{
+	__m256d v;
+};
+static inline Lanes load(const double *p) { return {_mm256_loadu_pd(p)}; }
+static inline void store(double *p, Lanes a) { _mm256_storeu_pd(p, a.v); }
+static inline Lanes set1(double x) { return {_mm256_set1_pd(x)}; }
+static inline Lanes operator+(Lanes a, Lanes b) { return {_mm256_add_pd(a.v, b.v)}; }
+static inline Lanes operator-(Lanes a, Lanes b) { return {_mm256_sub_pd(a.v, b.v)}; }
+static inline Lanes operator*(Lanes a, Lanes b) { return {_mm256_mul_pd(a.v, b.v)}; }
+static inline Lanes operator/(Lanes a, Lanes b) { return {_mm256_div_pd(a.v, b.v)}; }
+static inline Lanes operator-(Lanes a) { return {_mm256_xor_pd(a.v, _mm256_set1_pd(-0.0))}; }
+static inline Lanes vsqrt(Lanes a) { return {_mm256_sqrt_pd(a.v)}; }
+static inline Lanes vabs(Lanes a) { return {_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v)}; }
+static inline Mask operator<(Lanes a, Lanes b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)}; }
+static inline Mask operator<=(Lanes a, Lanes b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)}; }
+static inline Mask operator==(Lanes a, Lanes b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ)}; }
+static inline Mask operator&(Mask a, Mask b) { return {_mm256_and_pd(a.v, b.v)}; }
+static inline Mask operator|(Mask a, Mask b) { return {_mm256_or_pd(a.v, b.v)}; }
+static inline Mask andnot(Mask a, Mask b) { return {_mm256_andnot_pd(b.v, a.v)}; } // a & !b
+static inline Lanes select(Mask m, Lanes a, Lanes b) { return {_mm256_blendv_pd(b.v, a.v, m.v)}; }
+static inline int bits(Mask m) { return _mm256_movemask_pd(m.v); }
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+static const int W = 2;
+struct Lanes
+{
+	__m128d v;
+};
+struct Mask
+{
+	__m128d v;
+};
+static inline Lanes load(const double *p) { return {_mm_loadu_pd(p)}; }
+static inline void store(double *p, Lanes a) { _mm_storeu_pd(p, a.v); }
+static inline Lanes set1(double x) { return {_mm_set1_pd(x)}; }
+static inline Lanes operator+(Lanes a, Lanes b) { return {_mm_add_pd(a.v, b.v)}; }
+static inline Lanes operator-(Lanes a, Lanes b) { return {_mm_sub_pd(a.v, b.v)}; }
+static inline Lanes operator*(Lanes a, Lanes b) { return {_mm_mul_pd(a.v, b.v)}; }
+static inline Lanes operator/(Lanes a, Lanes b) { return {_mm_div_pd(a.v, b.v)}; }
+static inline Lanes operator-(Lanes a) { return {_mm_xor_pd(a.v, _mm_set1_pd(-0.0))}; }
+static inline Lanes vsqrt(Lanes a) { return {_mm_sqrt_pd(a.v)}; }
+static inline Lanes vabs(Lanes a) { return {_mm_andnot_pd(_mm_set1_pd(-0.0), a.v)}; }
+static inline Mask operator<(Lanes a, Lanes b) { return {_mm_cmplt_pd(a.v, b.v)}; }
+static inline Mask operator<=(Lanes a, Lanes b) { return {_mm_cmple_pd(a.v, b.v)}; }
+static inline Mask operator==(Lanes a, Lanes b) { return {_mm_cmpeq_pd(a.v, b.v)}; }
+static inline Mask operator&(Mask a, Mask b) { return {_mm_and_pd(a.v, b.v)}; }
+static inline Mask operator|(Mask a, Mask b) { return {_mm_or_pd(a.v, b.v)}; }
+static inline Mask andnot(Mask a, Mask b) { return {_mm_andnot_pd(b.v, a.v)}; } // a & !b
+static inline Lanes select(Mask m, Lanes a, Lanes b)
+{
+	return {_mm_or_pd(_mm_and_pd(m.v, a.v), _mm_andnot_pd(m.v, b.v))};
+}
+static inline int bits(Mask m) { return _mm_movemask_pd(m.v); }
+
+#else
+
+static const int W = 1;
+struct Lanes
+{
+	double v;
+};
+struct Mask
+{
+	bool v;
+};
+static inline Lanes load(const double *p) { return {*p}; }
+static inline void store(double *p, Lanes a) { *p = a.v; }
+static inline Lanes set1(double x) { return {x}; }
+static inline Lanes operator+(Lanes a, Lanes b) { return {a.v + b.v}; }
+static inline Lanes operator-(Lanes a, Lanes b) { return {a.v - b.v}; }
+static inline Lanes operator*(Lanes a, Lanes b) { return {a.v * b.v}; }
+static inline Lanes operator/(Lanes a, Lanes b) { return {a.v / b.v}; }
+static inline Lanes operator-(Lanes a) { return {-a.v}; }
+static inline Lanes vsqrt(Lanes a) { return {std::sqrt(a.v)}; }
+static inline Lanes vabs(Lanes a) { return {std::fabs(a.v)}; }
+static inline Mask operator<(Lanes a, Lanes b) { return {a.v < b.v}; }
+static inline Mask operator<=(Lanes a, Lanes b) { return {a.v <= b.v}; }
+static inline Mask operator==(Lanes a, Lanes b) { return {a.v == b.v}; }
+static inline Mask operator&(Mask a, Mask b) { return {a.v && b.v}; }
+static inline Mask operator|(Mask a, Mask b) { return {a.v || b.v}; }
+static inline Mask andnot(Mask a, Mask b) { return {a.v && !b.v}; }
+static inline Lanes select(Mask m, Lanes a, Lanes b) { return m.v ? a : b; }
+static inline int bits(Mask m) { return m.v; }
+
+#endif
+
+static inline Lanes operator*(double a, Lanes b) { return set1(a) * b; }
+static inline Mask operator>(Lanes a, Lanes b) { return b < a; }
+static inline Mask operator>=(Lanes a, Lanes b) { return b <= a; }
+// std::min(a, b), which keeps a unless b < a
+static inline Lanes vmin(Lanes a, Lanes b) { return select(b < a, b, a); }
+
+// ------------------------------------------------------------------ //
+
+// The Vec3 operations of vectors.hpp, on a group of candidates: dot sums
+// from zero, and division by a scalar multiplies by its reciprocal unless
+// vectors.hpp is built with _AVX.
+
+struct V3
+{
+	Lanes c[3];
+};
+
+static inline V3 operator+(const V3 &u, const V3 &v)
+{
+	V3 w = {{u.c[0] + v.c[0], u.c[1] + v.c[1], u.c[2] + v.c[2]}};
+	return w;
+}
+static inline V3 operator-(const V3 &u, const V3 &v)
+{
+	V3 w = {{u.c[0] - v.c[0], u.c[1] - v.c[1], u.c[2] - v.c[2]}};
+	return w;
+}
+static inline V3 operator*(Lanes a, const V3 &u)
+{
+	V3 w = {{a * u.c[0], a * u.c[1], a * u.c[2]}};
+	return w;
+}
+static inline V3 operator-(const V3 &u)
+{
+	V3 w = {{-u.c[0], -u.c[1], -u.c[2]}};
+	return w;
+}
+static inline V3 select(Mask m, const V3 &u, const V3 &v)
+{
+	V3 w = {{select(m, u.c[0], v.c[0]), select(m, u.c[1], v.c[1]),
+			 select(m, u.c[2], v.c[2])}};
+	return w;
+}
+static inline Lanes dot(const V3 &u, const V3 &v)
+{
+	Lanes d = set1(0) + u.c[0] * v.c[0];
+	d = d + u.c[1] * v.c[1];
+	return d + u.c[2] * v.c[2];
+}
+static inline V3 cross(const V3 &u, const V3 &v)
+{
+	V3 w = {{u.c[1] * v.c[2] - u.c[2] * v.c[1],
+			 u.c[2] * v.c[0] - u.c[0] * v.c[2],
+			 u.c[0] * v.c[1] - u.c[1] * v.c[0]}};
+	return w;
+}
+static inline Lanes stp(const V3 &u, const V3 &v, const V3 &w)
+{
+	return dot(u, cross(v, w));
+}
+static inline V3 normalize(const V3 &u)
+{
+	Lanes m = vsqrt(dot(u, u));
+#if defined(_AVX)
+	V3 v = {{u.c[0] / m, u.c[1] / m, u.c[2] / m}};
+#else
+	V3 v = (set1(1) / m) * u;
+#endif
+	V3 zero = {{set1(0), set1(0), set1(0)}};
+	return select(m == set1(0), zero, v);
+}
+
+// ------------------------------------------------------------------ //
+
+// solve_quadratic of util.cpp: roots lo <= hi, count of them
+struct Quadratic
+{
+	Lanes lo, hi;
+	Mask none, one, two;
+};
+
+static Quadratic solve_quadratic(Lanes a, Lanes b, Lanes c)
+{
+	Quadratic q;
+	Lanes d = b * b - (4 * a) * c;
+	Mask neg = d < set1(0);
+	Lanes sg = select(b < set1(0), set1(-1), set1(1));
+	Lanes qq = -(b + sg * vsqrt(d)) / set1(2);
+	Mask c1 = andnot(vabs(a) > 1e-12 * vabs(qq), neg),
+		 c2 = andnot(vabs(qq) > 1e-12 * vabs(c), neg);
+	Lanes r1 = qq / a, r2 = c / qq;
+	Lanes x0 = select(c1, r1, r2);
+	Mask swap = c1 & c2 & (x0 > r2);
+	// with no real root lo is the extremum, -b / 2a, like x[0] there
+	q.lo = select(neg, -b / (2 * a), select(swap, r2, x0));
+	q.hi = select(swap, x0, r2);
+	q.two = c1 & c2;
+	q.one = andnot(c1 | c2, q.two);
+	q.none = andnot(andnot(set1(0) == set1(0), c1), c2);
+	return q;
+}
+
+static inline Lanes cubic(Lanes a, Lanes b, Lanes c, Lanes d, Lanes x)
+{
+	return d + x * (c + x * (b + x * a));
+}
+
+// newtons_method from x0 on the lanes in active; init_dir is -1, 0 or 1
+static Lanes newtons_method(Lanes a, Lanes b, Lanes c, Lanes d, Lanes x0,
+							Lanes init_dir, Mask active)
+{
+	Lanes y0 = cubic(a, b, c, d, x0), ddy0 = 2 * b + x0 * (6 * a);
+	Lanes x = select(init_dir == set1(0), x0,
+					 x0 + init_dir * vsqrt(vabs(2 * y0 / ddy0)));
+	for (int iter = 0; iter < 100 && bits(active); iter++)
+	{
+		Lanes y = cubic(a, b, c, d, x);
+		Lanes dy = c + x * (2 * b + x * set1(3) * a);
+		Lanes x1 = x - y / dy;
+		Mask done = (dy == set1(0)) | (vabs(x - x1) < set1(1e-6));
+		active = andnot(active, done);
+		x = select(active, x1, x);
+	}
+	return x;
+}
+
+// ------------------------------------------------------------------ //
+
+void CcdBatch::add(const Node *node0, const Node *node1, const Node *node2,
+				   const Node *node3)
+{
+	int c = n++;
+	const Node *ns[4] = {node0, node1, node2, node3};
+	for (int i = 0; i < 4; i++)
+	{
+		nodes[c][i] = ns[i];
+		for (int k = 0; k < 3; k++)
+		{
+			x0[i][k][c] = ns[i]->x0[k];
+			x1[i][k][c] = ns[i]->x[k];
+		}
+	}
+	hit[c] = false;
+}
+
+static inline V3 load3(const double (*x)[16], int c)
+{
+	V3 u = {{load(&x[0][c]), load(&x[1][c]), load(&x[2][c])}};
+	return u;
+}
+
+static inline Mask all_lanes() { return set1(0) == set1(0); }
+
+// copies element n - 1 of x to [n, m)
+static inline void pad(double *x, int n, int m)
+{
+	for (int i = n; i < m; i++)
+		x[i] = x[n - 1];
+}
+
+static inline int whole_lanes(int n) { return (n + W - 1) / W * W; }
+
+// Coplanarity cubic of each candidate and the start of Newton's method for
+// each of its roots, as in solve_cubic; candidates whose cubic is really
+// quadratic get their roots directly.
+struct CcdRoots
+{
+	double a[16], b[16], c[16], d[16];
+	int ndirect[16]; // -1 if the roots come from the Newton starts
+	double direct[2][16];
+	// Newton starts in the order solve_cubic takes them, with their cubic
+	int njobs, cand[48];
+	double ja[48], jb[48], jc[48], jd[48], start[48], dir[48], root[48];
+};
+
+static void find_starts(const CcdBatch &batch, int n, CcdRoots &r)
+{
+	r.njobs = 0;
+	for (int c = 0; c < n; c += W)
+	{
+		V3 p0[4], p1[4], x[4], v[4];
+		for (int i = 0; i < 4; i++)
+		{
+			p0[i] = load3(batch.x0[i], c);
+			p1[i] = load3(batch.x1[i], c);
+		}
+		// the cubic is stp(x1 + t v1, x2 + t v2, x3 + t v3) = 0 with
+		// positions and velocities relative to node 0
+		V3 v0 = p1[0] - p0[0];
+		for (int i = 1; i < 4; i++)
+		{
+			x[i] = p0[i] - p0[0];
+			v[i] = (p1[i] - p0[i]) - v0;
+		}
+		Lanes a = stp(v[1], v[2], v[3]),
+			  b = stp(x[1], v[2], v[3]) + stp(v[1], x[2], v[3]) +
+				  stp(v[1], v[2], x[3]),
+			  cc = stp(v[1], x[2], x[3]) + stp(x[1], v[2], x[3]) +
+				   stp(x[1], x[2], v[3]),
+			  d = stp(x[1], x[2], x[3]);
+		store(&r.a[c], a);
+		store(&r.b[c], b);
+		store(&r.c[c], cc);
+		store(&r.d[c], d);
+		Quadratic crit = solve_quadratic(3 * a, 2 * b, cc);
+		Quadratic quad = solve_quadratic(b, cc, d);
+		store(&r.direct[0][c], quad.lo);
+		store(&r.direct[1][c], quad.hi);
+		Lanes yc0 = cubic(a, b, cc, d, crit.lo),
+			  yc1 = cubic(a, b, cc, d, crit.hi);
+		Mask closer0 = vabs(yc0) < vabs(yc1);
+		Mask use[3] = {crit.none | (crit.two & (yc0 * a >= set1(0))),
+					   crit.two & (yc0 * yc1 <= set1(0)),
+					   crit.two & (yc1 * a <= set1(0))};
+		double start[3][W], dir[3][W];
+		store(start[0], crit.lo);
+		store(start[1], select(closer0, crit.lo, crit.hi));
+		store(start[2], crit.hi);
+		store(dir[0], select(crit.none, set1(0), set1(-1)));
+		store(dir[1], select(closer0, set1(1), set1(-1)));
+		store(dir[2], set1(1));
+		int use_bits[3] = {bits(use[0]), bits(use[1]), bits(use[2])},
+			one = bits(crit.one), quad_one = bits(quad.one),
+			quad_two = bits(quad.two);
+		for (int l = 0; l < W && c + l < batch.n; l++)
+		{
+			int k = c + l;
+			r.ndirect[k] = -1;
+			if (one >> l & 1)
+			{
+				r.ndirect[k] = (quad_two >> l & 1) ? 2 : (quad_one >> l & 1);
+				continue;
+			}
+			for (int j = 0; j < 3; j++)
+				if (use_bits[j] >> l & 1)
+				{
+					int job = r.njobs++;
+					r.cand[job] = k;
+					r.ja[job] = r.a[k];
+					r.jb[job] = r.b[k];
+					r.jc[job] = r.c[k];
+					r.jd[job] = r.d[k];
+					r.start[job] = start[j][l];
+					r.dir[job] = dir[j][l];
+				}
+		}
+	}
+}
+
+// solve_cubic's Newton runs, over all starts of the batch together
+static void refine_roots(CcdRoots &r)
+{
+	if (r.njobs == 0)
+		return;
+	int n = whole_lanes(r.njobs);
+	double *cols[6] = {r.ja, r.jb, r.jc, r.jd, r.start, r.dir};
+	for (int k = 0; k < 6; k++)
+		pad(cols[k], r.njobs, n);
+	for (int j = 0; j < n; j += W)
+		store(&r.root[j],
+			  newtons_method(load(&r.ja[j]), load(&r.jb[j]), load(&r.jc[j]),
+							 load(&r.jd[j]), load(&r.start[j]),
+							 load(&r.dir[j]), all_lanes()));
+}
+
+// signed_vf_distance or signed_ee_distance at time t with the inside test
+// and orientation of collision_test; returns where the candidates collide
+static Mask impact_test(CcdBatch::Type type, const V3 p0[4], const V3 p1[4],
+						Lanes t, V3 &n, Lanes w[4])
+{
+	V3 p[4], v[4];
+	for (int j = 0; j < 4; j++)
+		p[j] = p0[j] + t * (p1[j] - p0[j]);
+	V3 v0 = p1[0] - p0[0];
+	for (int j = 1; j < 4; j++)
+		v[j] = (p1[j] - p0[j]) - v0;
+	Lanes h;
+	Mask ok, inside;
+	if (type == CcdBatch::VF)
+	{
+		// p[0] against the face p[1], p[2], p[3]
+		n = cross(normalize(p[2] - p[1]), normalize(p[3] - p[1]));
+		ok = set1(1e-6) <= dot(n, n);
+		n = normalize(n);
+		h = dot(p[0] - p[1], n);
+		Lanes b0 = stp(p[2] - p[0], p[3] - p[0], n),
+			  b1 = stp(p[3] - p[0], p[1] - p[0], n),
+			  b2 = stp(p[1] - p[0], p[2] - p[0], n);
+		Lanes sum = b0 + b1 + b2;
+		w[0] = set1(1);
+		w[1] = -b0 / sum;
+		w[2] = -b1 / sum;
+		w[3] = -b2 / sum;
+		inside = vmin(-w[1], vmin(-w[2], -w[3])) >= set1(-1e-6);
+	}
+	else
+	{
+		// edge p[0], p[1] against edge p[2], p[3]
+		n = cross(normalize(p[1] - p[0]), normalize(p[3] - p[2]));
+		ok = set1(1e-6) <= dot(n, n);
+		n = normalize(n);
+		h = dot(p[0] - p[2], n);
+		Lanes a0 = stp(p[3] - p[1], p[2] - p[1], n),
+			  a1 = stp(p[2] - p[0], p[3] - p[0], n),
+			  b0 = stp(p[0] - p[3], p[1] - p[3], n),
+			  b1 = stp(p[1] - p[2], p[0] - p[2], n);
+		w[0] = a0 / (a0 + a1);
+		w[1] = a1 / (a0 + a1);
+		w[2] = -b0 / (b0 + b1);
+		w[3] = -b1 / (b0 + b1);
+		inside = vmin(vmin(w[0], w[1]), vmin(-w[2], -w[3])) >= set1(-1e-6);
+	}
+	Lanes away = dot(n, w[1] * v[1] + w[2] * v[2] + w[3] * v[3]);
+	n = select(away > set1(0), -n, n);
+	return ok & inside & (vabs(h) < set1(1e-6));
+}
+
+void ccd_test(CcdBatch &batch)
+{
+	if (batch.n == 0)
+		return;
+	int n = whole_lanes(batch.n);
+	for (int i = 0; i < 4; i++)
+		for (int k = 0; k < 3; k++)
+		{
+			pad(batch.x0[i][k], batch.n, n);
+			pad(batch.x1[i][k], batch.n, n);
+		}
+	CcdRoots r;
+	find_starts(batch, n, r);
+	refine_roots(r);
+	// roots of each candidate in solve_cubic's order
+	double t[3][16];
+	int nsol[16] = {0};
+	for (int c = 0; c < batch.n; c++)
+		for (int i = 0; i < r.ndirect[c]; i++)
+			t[nsol[c]++][c] = r.direct[i][c];
+	for (int j = 0; j < r.njobs; j++)
+	{
+		int c = r.cand[j];
+		t[nsol[c]++][c] = r.root[j];
+	}
+	// the earliest root in [0, 1] where the nodes are close and inside;
+	// each pass only gathers the candidates that still have one to test
+	double q0[4][3][16], q1[4][3][16], qt[16];
+	int cand[16];
+	for (int i = 0; i < 3; i++)
+	{
+		int m = 0;
+		for (int c = 0; c < batch.n; c++)
+			if (!batch.hit[c] && i < nsol[c] && t[i][c] >= 0 && t[i][c] <= 1)
+			{
+				for (int j = 0; j < 4; j++)
+					for (int k = 0; k < 3; k++)
+					{
+						q0[j][k][m] = batch.x0[j][k][c];
+						q1[j][k][m] = batch.x1[j][k][c];
+					}
+				qt[m] = t[i][c];
+				cand[m++] = c;
+			}
+		if (m == 0)
+			continue;
+		int mw = whole_lanes(m);
+		for (int j = 0; j < 4; j++)
+			for (int k = 0; k < 3; k++)
+			{
+				pad(q0[j][k], m, mw);
+				pad(q1[j][k], m, mw);
+			}
+		pad(qt, m, mw);
+		for (int g = 0; g < mw; g += W)
+		{
+			V3 p0[4], p1[4], nv;
+			Lanes w[4];
+			for (int j = 0; j < 4; j++)
+			{
+				p0[j] = load3(q0[j], g);
+				p1[j] = load3(q1[j], g);
+			}
+			int hit = bits(impact_test(batch.type, p0, p1, load(&qt[g]), nv, w));
+			if (!hit)
+				continue;
+			double nk[3][W], wk[4][W];
+			for (int k = 0; k < 3; k++)
+				store(nk[k], nv.c[k]);
+			for (int k = 0; k < 4; k++)
+				store(wk[k], w[k]);
+			for (int l = 0; l < W && g + l < m; l++)
+				if (hit >> l & 1)
+				{
+					int c = cand[g + l];
+					batch.hit[c] = true;
+					batch.t[c] = qt[g + l];
+					batch.normal[c] = Vec3(nk[0][l], nk[1][l], nk[2][l]);
+					for (int k = 0; k < 4; k++)
+						batch.w[c][k] = wk[k][l];
+				}
+		}
+	}
+}
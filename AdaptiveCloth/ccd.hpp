@@ -0,0 +1,36 @@
+/*************************************************************************
+****************************    ARCSim_CCD    ****************************
+*************************************************************************/
+#pragma once
+
+#include "mesh.hpp"
+
+// Continuous collision tests of the vertex-face or edge-edge candidates of
+// one face pair. add() gathers each candidate's start and end positions into
+// structure-of-arrays form once; ccd_test() then sets up the coplanarity
+// cubics, refines all Newton starts of the batch together, and runs the
+// distance and inside tests on the candidates that still have a root in
+// [0, 1], several per instruction (4 with AVX, 2 with SSE2, otherwise 1). Every lane performs the scalar code's floating-point
+// operations in the same order, so the results agree bit for bit.
+struct CcdBatch
+{
+	enum Type
+	{
+		VF, // nodes[0] against the face of nodes[1..3]
+		EE	// edge nodes[0..1] against edge nodes[2..3]
+	} type;
+	int n;
+	const Node *nodes[16][4];
+	// [node][component][candidate]; start (x0) and end (x) of the step
+	double x0[4][3][16], x1[4][3][16];
+	// per candidate after ccd_test: whether it collides, and if so the
+	// earliest time, the barycentric weights and the normal
+	bool hit[16];
+	double t[16], w[16][4];
+	Vec3 normal[16];
+	explicit CcdBatch(Type type) : type(type), n(0) {}
+	void add(const Node *node0, const Node *node1, const Node *node2,
+			 const Node *node3);
+};
+
+void ccd_test(CcdBatch &batch);
@@ -0,0 +1,496 @@
+/*************************************************************************
+************************    ARCSim_Checkpoint    *************************
+*************************************************************************/
+
+#include "checkpoint.hpp"
+#include "Simulation.hpp"
+#include "strainlimiting.hpp"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+static const char magic_tag[8] = {'A', 'R', 'C', 'S', 'I', 'M', 'C', 'K'};
+static const int version = 3;
+
+// ------------------------------------------------------------------ //
+
+static void put_raw(vector<char> &b, const void *p, size_t size)
+{
+	b.insert(b.end(), (const char *)p, (const char *)p + size);
+}
+static void put(vector<char> &b, int i) { put_raw(b, &i, sizeof(i)); }
+static void put(vector<char> &b, double d) { put_raw(b, &d, sizeof(d)); }
+static void put(vector<char> &b, bool x) { put(b, (int)x); }
+template <int n>
+static void put(vector<char> &b, const Vec<n> &v)
+{
+	for (int i = 0; i < n; i++)
+		put(b, v[i]);
+}
+static void put(vector<char> &b, const Mat2x2 &m)
+{
+	for (int j = 0; j < 2; j++)
+		put(b, m.col(j));
+}
+template <typename T>
+static void put(vector<char> &b, const vector<T> &v)
+{
+	put(b, (int)v.size());
+	for (int i = 0; i < v.size(); i++)
+		put(b, v[i]);
+}
+template <typename Prim>
+static void put_indices(vector<char> &b, const vector<Prim *> &prims)
+{
+	put(b, (int)prims.size());
+	for (int i = 0; i < prims.size(); i++)
+		put(b, prims[i]->index);
+}
+
+struct Reader
+{
+	const vector<char> &b;
+	size_t pos;
+	Reader(const vector<char> &b) : b(b), pos(0) {}
+	void raw(void *p, size_t size)
+	{
+		if (pos + size > b.size())
+		{
+			cout << "Error: checkpoint is truncated" << endl;
+			abort();
+		}
+		memcpy(p, &b[pos], size);
+		pos += size;
+	}
+	int i()
+	{
+		int x;
+		raw(&x, sizeof(x));
+		return x;
+	}
+	double d()
+	{
+		double x;
+		raw(&x, sizeof(x));
+		return x;
+	}
+	template <int n>
+	Vec<n> vec()
+	{
+		Vec<n> v;
+		for (int k = 0; k < n; k++)
+			v[k] = d();
+		return v;
+	}
+	Mat2x2 mat()
+	{
+		Vec2 c0 = vec<2>(), c1 = vec<2>();
+		return Mat2x2(c0, c1);
+	}
+	// a count or index in [0, n)
+	int index(int n)
+	{
+		int x = i();
+		if (x < 0 || x >= n)
+		{
+			cout << "Error: checkpoint index " << x << " out of range [0, "
+				 << n << ")" << endl;
+			abort();
+		}
+		return x;
+	}
+	template <typename Prim>
+	vector<Prim *> prims(const vector<Prim *> &all)
+	{
+		vector<Prim *> ps(i());
+		for (int k = 0; k < ps.size(); k++)
+			ps[k] = all[index(all.size())];
+		return ps;
+	}
+};
+
+static void check_count(int saved, int scene, const char *what)
+{
+	if (saved == scene)
+		return;
+	cout << "Error: checkpoint has " << saved << " " << what << ", the scene "
+		 << scene << endl;
+	abort();
+}
+
+// ------------------------------------------------------------------ //
+
+// normals and dihedral angles are stored rather than recomputed: they were
+// last computed before StepMesh moved x, and the next step reads them as is
+static void save_ws_data(vector<char> &b, const Mesh &mesh)
+{
+	for (int n = 0; n < mesh.nodes.size(); n++)
+		put(b, mesh.nodes[n]->n);
+	for (int e = 0; e < mesh.edges.size(); e++)
+		put(b, mesh.edges[e]->theta);
+	for (int f = 0; f < mesh.faces.size(); f++)
+		put(b, mesh.faces[f]->n);
+}
+
+static void load_ws_data(Reader &r, Mesh &mesh)
+{
+	for (int n = 0; n < mesh.nodes.size(); n++)
+		mesh.nodes[n]->n = r.vec<3>();
+	for (int e = 0; e < mesh.edges.size(); e++)
+		mesh.edges[e]->theta = r.d();
+	for (int f = 0; f < mesh.faces.size(); f++)
+		mesh.faces[f]->n = r.vec<3>();
+}
+
+static void save_mesh(vector<char> &b, const Mesh &mesh)
+{
+	put(b, (int)mesh.verts.size());
+	put(b, (int)mesh.nodes.size());
+	put(b, (int)mesh.edges.size());
+	put(b, (int)mesh.faces.size());
+	for (int v = 0; v < mesh.verts.size(); v++)
+	{
+		const Vert *vert = mesh.verts[v];
+		put(b, vert->label);
+		put(b, vert->u);
+		put(b, vert->m);
+	}
+	for (int n = 0; n < mesh.nodes.size(); n++)
+	{
+		const Node *node = mesh.nodes[n];
+		put(b, node->label);
+		put(b, node->y);
+		put(b, node->x);
+		put(b, node->x0);
+		put(b, node->v);
+		put(b, node->acceleration);
+		put(b, node->m);
+		put(b, node->preserve);
+		put_indices(b, node->verts);
+	}
+	for (int e = 0; e < mesh.edges.size(); e++)
+	{
+		const Edge *edge = mesh.edges[e];
+		put(b, edge->n[0]->index);
+		put(b, edge->n[1]->index);
+		put(b, edge->label);
+		put(b, edge->theta_ideal);
+		put(b, edge->damage);
+		put(b, edge->reference_angle);
+	}
+	for (int f = 0; f < mesh.faces.size(); f++)
+	{
+		const Face *face = mesh.faces[f];
+		for (int i = 0; i < 3; i++)
+			put(b, face->v[i]->index);
+		put(b, face->label);
+		put(b, face->S_plastic);
+		put(b, face->damage);
+		put(b, face->m);
+	}
+	// adjacency lists keep the order they were built in, which fixes the
+	// order of later sums over them
+	for (int v = 0; v < mesh.verts.size(); v++)
+		put_indices(b, mesh.verts[v]->adjf);
+	for (int n = 0; n < mesh.nodes.size(); n++)
+		put_indices(b, mesh.nodes[n]->adje);
+	save_ws_data(b, mesh);
+}
+
+static void load_mesh(Reader &r, Mesh &mesh)
+{
+	delete_mesh(mesh);
+	int nv = r.i(), nn = r.i(), ne = r.i(), nf = r.i();
+	for (int v = 0; v < nv; v++)
+	{
+		int label = r.i();
+		Vert *vert = new Vert(r.vec<2>(), label);
+		vert->m = r.d();
+		mesh.add(vert);
+	}
+	vector<bool> preserve(nn);
+	for (int n = 0; n < nn; n++)
+	{
+		int label = r.i();
+		Vec3 y = r.vec<3>(), x = r.vec<3>(), x0 = r.vec<3>(), v = r.vec<3>();
+		Node *node = new Node(y, x, v, label);
+		node->x0 = x0;
+		node->acceleration = r.vec<3>();
+		node->m = r.d();
+		preserve[n] = r.i();
+		node->verts = r.prims(mesh.verts);
+		mesh.add(node);
+	}
+	for (int n = 0; n < nn; n++)
+		mesh.nodes[n]->preserve = preserve[n];
+	for (int e = 0; e < ne; e++)
+	{
+		Node *n0 = mesh.nodes[r.index(nn)], *n1 = mesh.nodes[r.index(nn)];
+		int label = r.i();
+		Edge *edge = new Edge(n0, n1, r.d(), label);
+		edge->damage = r.d();
+		edge->reference_angle = r.d();
+		mesh.add(edge);
+	}
+	for (int f = 0; f < nf; f++)
+	{
+		Vert *v0 = mesh.verts[r.index(nv)], *v1 = mesh.verts[r.index(nv)],
+			 *v2 = mesh.verts[r.index(nv)];
+		Face *face = new Face(v0, v1, v2, r.i());
+		face->S_plastic = r.mat();
+		face->damage = r.d();
+		face->m = r.d();
+		mesh.add(face);
+	}
+	for (int v = 0; v < nv; v++)
+		mesh.verts[v]->adjf = r.prims(mesh.faces);
+	for (int n = 0; n < nn; n++)
+		mesh.nodes[n]->adje = r.prims(mesh.edges);
+	compute_ms_data(mesh);
+	load_ws_data(r, mesh);
+}
+
+// (cloth, node index) of a handle node
+static void put_node(vector<char> &b, const Simulation &sim, const Node *node)
+{
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		const Mesh &mesh = sim.m_Cloths[c].mesh;
+		if (node->index < mesh.nodes.size() && mesh.nodes[node->index] == node)
+		{
+			put(b, c);
+			put(b, node->index);
+			return;
+		}
+	}
+	cout << "Error: handle node " << node << " is in no cloth" << endl;
+	abort();
+}
+
+static Node *get_node(Reader &r, Simulation &sim)
+{
+	int c = r.index(sim.m_Cloths.size());
+	const Mesh &mesh = sim.m_Cloths[c].mesh;
+	return mesh.nodes[r.index(mesh.nodes.size())];
+}
+
+enum HandleType
+{
+	NODE_HANDLE,
+	CIRCLE_HANDLE,
+	GLUE_HANDLE
+};
+
+// ------------------------------------------------------------------ //
+
+vector<char> save_checkpoint(const Simulation &sim)
+{
+	vector<char> b;
+	put_raw(b, magic_tag, sizeof(magic_tag));
+	put(b, version);
+	put(b, sim.time);
+	put(b, sim.frame);
+	put(b, sim.step);
+	put(b, (int)sim.m_Cloths.size());
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		const Cloth &cloth = sim.m_Cloths[c];
+		save_mesh(b, cloth.mesh);
+		// the warm start only carries over if it matches the current mesh
+		bool warm = cloth.pcg.topology == cloth.mesh.topology;
+		put(b, warm);
+		put(b, warm ? cloth.pcg.x : vector<Vec3>());
+	}
+	put(b, (int)sim.m_Obstacles.size());
+	for (int o = 0; o < sim.m_Obstacles.size(); o++)
+	{
+		const Obstacle &obs = sim.m_Obstacles[o];
+		const Mesh &mesh = obs.get_mesh();
+		put(b, obs.activated);
+		put(b, (int)mesh.nodes.size());
+		for (int n = 0; n < mesh.nodes.size(); n++)
+		{
+			put(b, mesh.nodes[n]->x);
+			put(b, mesh.nodes[n]->x0);
+			put(b, mesh.nodes[n]->v);
+		}
+		save_ws_data(b, mesh);
+	}
+	put(b, (int)sim.m_pHandles.size());
+	for (int h = 0; h < sim.m_pHandles.size(); h++)
+	{
+		const Handle *han = sim.m_pHandles[h];
+		if (const NodeHandle *nh = dynamic_cast<const NodeHandle *>(han))
+		{
+			put(b, (int)NODE_HANDLE);
+			put_node(b, sim, nh->node);
+			put(b, nh->activated);
+			put(b, nh->x0);
+		}
+		else if (const GlueHandle *gh = dynamic_cast<const GlueHandle *>(han))
+		{
+			put(b, (int)GLUE_HANDLE);
+			put_node(b, sim, gh->nodes[0]);
+			put_node(b, sim, gh->nodes[1]);
+		}
+		else // circle handles find their nodes by label every step
+			put(b, (int)CIRCLE_HANDLE);
+	}
+	const AugLagContext &sl = sim.m_StrainLimitingContext;
+	put(b, sl.warm_start);
+	// like the pcg warm start, the key is rebuilt from the restored meshes
+	put(b, sl.warm_key == strain_limiting_key(sim.m_pClothMeshes));
+	put(b, sl.warm_first);
+	put(b, sl.mu);
+	put(b, sl.lambda);
+	return b;
+}
+
+void load_checkpoint(Simulation &sim, const vector<char> &data)
+{
+	Reader r(data);
+	char tag[sizeof(magic_tag)];
+	r.raw(tag, sizeof(tag));
+	if (memcmp(tag, magic_tag, sizeof(tag)) != 0)
+	{
+		cout << "Error: not a checkpoint" << endl;
+		abort();
+	}
+	int v = r.i();
+	if (v != version)
+	{
+		cout << "Error: checkpoint version " << v << ", expected " << version
+			 << endl;
+		abort();
+	}
+	sim.time = r.d();
+	sim.frame = r.i();
+	sim.step = r.i();
+	check_count(r.i(), sim.m_Cloths.size(), "cloths");
+	for (int c = 0; c < sim.m_Cloths.size(); c++)
+	{
+		Cloth &cloth = sim.m_Cloths[c];
+		load_mesh(r, cloth.mesh);
+		bool warm = r.i();
+		int n = r.i();
+		cloth.pcg.x.resize(n);
+		for (int i = 0; i < n; i++)
+			cloth.pcg.x[i] = r.vec<3>();
+		cloth.pcg.topology = warm ? cloth.mesh.topology : -1;
+	}
+	check_count(r.i(), sim.m_Obstacles.size(), "obstacles");
+	for (int o = 0; o < sim.m_Obstacles.size(); o++)
+	{
+		Obstacle &obs = sim.m_Obstacles[o];
+		obs.activated = r.i();
+		int nn = r.i();
+		Mesh &mesh = obs.get_mesh();
+		if (nn == 0)
+			delete_mesh(mesh);
+		else if (mesh.nodes.empty())
+			mesh = deep_copy(obs.base_mesh);
+		check_count(nn, mesh.nodes.size(), "obstacle nodes");
+		for (int n = 0; n < nn; n++)
+		{
+			mesh.nodes[n]->x = r.vec<3>();
+			mesh.nodes[n]->x0 = r.vec<3>();
+			mesh.nodes[n]->v = r.vec<3>();
+		}
+		load_ws_data(r, mesh);
+	}
+	check_count(r.i(), sim.m_pHandles.size(), "handles");
+	for (int h = 0; h < sim.m_pHandles.size(); h++)
+	{
+		Handle *han = sim.m_pHandles[h];
+		int type = r.i();
+		NodeHandle *nh = dynamic_cast<NodeHandle *>(han);
+		GlueHandle *gh = dynamic_cast<GlueHandle *>(han);
+		if (type != (nh ? NODE_HANDLE : gh ? GLUE_HANDLE : CIRCLE_HANDLE))
+		{
+			cout << "Error: checkpoint handle " << h
+				 << " doesn't match the scene" << endl;
+			abort();
+		}
+		if (nh)
+		{
+			nh->node = get_node(r, sim);
+			nh->activated = r.i();
+			nh->x0 = r.vec<3>();
+		}
+		else if (gh)
+		{
+			gh->nodes[0] = get_node(r, sim);
+			gh->nodes[1] = get_node(r, sim);
+		}
+	}
+	AugLagContext &sl = sim.m_StrainLimitingContext;
+	sl.warm_start = r.i();
+	bool warm = r.i();
+	sl.warm_key = warm ? strain_limiting_key(sim.m_pClothMeshes) : vector<int>();
+	sl.warm_first = r.i();
+	sl.mu = r.d();
+	sl.lambda.resize(r.i());
+	for (int i = 0; i < sl.lambda.size(); i++)
+		sl.lambda[i] = r.d();
+	// caches keyed by mesh topology or node pointers are rebuilt
+	sim.m_ClothIndex.clear();
+	sim.m_ProximityTracker.clear();
+	sim.m_ClothAccel.clear();
+	sim.m_ObstacleAccel.clear();
+}
+
+// ------------------------------------------------------------------ //
+
+static bool write_file(const vector<char> &data, const string &filename)
+{
+	string tmp = filename + ".tmp";
+	{
+		ofstream file(tmp.c_str(), ios::binary);
+		file.write(data.data(), data.size());
+		if (!file)
+			return false;
+	}
+	error_code err;
+	filesystem::rename(tmp, filename, err);
+	return !err;
+}
+
+void save_checkpoint(const Simulation &sim, const string &filename)
+{
+	if (!write_file(save_checkpoint(sim), filename))
+		cout << "Error: failed to write checkpoint " << filename << endl;
+}
+
+void load_checkpoint(Simulation &sim, const string &filename)
+{
+	ifstream file(filename.c_str(), ios::binary);
+	if (!file)
+	{
+		cout << "Error: failed to open file " << filename << endl;
+		abort();
+	}
+	vector<char> data((istreambuf_iterator<char>(file)),
+					  istreambuf_iterator<char>());
+	load_checkpoint(sim, data);
+}
+
+void CheckpointWriter::write(const Simulation &sim, const string &filename)
+{
+	vector<char> data = save_checkpoint(sim);
+	wait();
+	thread = std::thread([data = std::move(data), filename]() {
+		if (!write_file(data, filename))
+			cout << "Error: failed to write checkpoint " << filename << endl;
+	});
+	written++;
+}
+
+void CheckpointWriter::wait()
+{
+	if (thread.joinable())
+		thread.join();
+}
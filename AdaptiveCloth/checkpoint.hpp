@@ -0,0 +1,35 @@
+/*************************************************************************
+************************    ARCSim_Checkpoint    *************************
+*************************************************************************/
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Simulation;
+
+// Versioned binary checkpoint of the evolving state of a Simulation: the
+// complete cloth meshes (including plastic state, masses, adjacency order
+// and world-space normals), time/step/frame, obstacle and handle state,
+// the strain limiting multipliers and the pcg warm start. Constants come
+// from the scene json, so a checkpoint is restored into a simulation that
+// was loaded from the same scene and prepared.
+std::vector<char> save_checkpoint(const Simulation &sim);
+void save_checkpoint(const Simulation &sim, const std::string &filename);
+// aborts on a version or scene mismatch
+void load_checkpoint(Simulation &sim, const std::vector<char> &data);
+void load_checkpoint(Simulation &sim, const std::string &filename);
+
+// Serializes on the calling thread, then writes the file in the background
+// through <filename>.tmp and a rename, so a crash never leaves a truncated
+// checkpoint behind. A new write first waits for the previous one.
+struct CheckpointWriter
+{
+	std::thread thread;
+	int written;
+	CheckpointWriter() : written(0) {}
+	~CheckpointWriter() { wait(); }
+	void write(const Simulation &sim, const std::string &filename);
+	void wait();
+};
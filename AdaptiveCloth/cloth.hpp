@@ -26,8 +26,11 @@
 
 #pragma once
 
+#include "blocksparse.hpp"
 #include "dde.hpp"
 #include "mesh.hpp"
+#include "pcg.hpp"
+#include "taucs.hpp"
 
 struct Cloth
 {
@@ -52,6 +55,10 @@ struct Cloth
     double aspect_min;         // aspect ratio control
   } remeshing;
 
+  BlockSpMat system;  // implicit system, pattern reused until remeshing
+  TaucsSolver solver; // caches the symbolic factorization of system
+  PcgSolver pcg;      // iterative alternative, see magic.linear_solver
+
   void ComputeMasses();
   void SetDensity(int material_idx, float newDensity);
 };
\ No newline at end of file
@@ -28,12 +28,15 @@
 #include "magic.hpp"
 #include "geometry.hpp"
 #include "collision.hpp"
+#include "ccd.hpp"
 #include "constraint.hpp"
 #include "collisionutil.hpp"
 #include "optimization.hpp"
 #include "simulation.hpp"
+#include "utils/TimeUtil.hpp"
 #include <algorithm>
 #include <fstream>
+#include <unordered_set>
 #include <omp.h>
 
 using namespace std;
@@ -53,11 +56,11 @@ double get_mass(const Node *node) { return is_free(node) ? node->m : obs_mass; }
 // (ii) index of mesh in ::meshes or ::obs_meshes that contains vert
 pair<bool, int> find_in_meshes(const Node *node)
 {
-	int m = find_mesh(node, *::meshes);
+	int m = ::mesh_index.mesh(node);
 	if (m != -1)
 		return make_pair(true, m);
 	else
-		return make_pair(false, find_mesh(node, *::obs_meshes));
+		return make_pair(false, ::obs_mesh_index.mesh(node));
 }
 
 struct Impact
@@ -83,6 +86,18 @@ struct ImpactZone
 	vector<Node*> nodes;
 	vector<Impact> impacts;
 	bool active;
+	int index; // position in zones
+};
+
+// The zones partition the nodes they touch. The partition is kept as a
+// union-find forest over global node slots (cloth nodes, then obstacle
+// nodes), and the root of each set owns its zone.
+struct ZoneForest
+{
+	int nfree;				  // number of cloth nodes
+	vector<int> parent;		  // -1 if the node is in no zone yet
+	vector<ImpactZone*> zone; // zone of each root
+	void reset(); // for the nodes of ::meshes and ::obs_meshes
 };
 
 void update_active(const vector<AccelStruct*> &accs,
@@ -93,37 +108,82 @@ vector<Impact> find_impacts(const vector<AccelStruct*> &acc,
 							const vector<AccelStruct*> &obs_accs);
 vector<Impact> independent_impacts(const vector<Impact> &impacts);
 
-void add_impacts(const vector<Impact> &impacts, vector<ImpactZone*> &zones);
+void add_impacts(const vector<Impact> &impacts, ZoneForest &forest,
+				 vector<ImpactZone*> &zones);
 
 void apply_inelastic_projection(ImpactZone *zone,
 								const vector<Constraint*> &cons);
 
 
+void record_iteration(CollisionStats &stats, CollisionIteration it,
+					  const cTimePoint &start)
+{
+	it.ms = cTimeUtil::CalcTimeElaspedms(start,
+										 cTimeUtil::GetCurrentTime_chrono());
+	stats.last.push_back(it);
+	stats.iterations++;
+	stats.impacts += it.impacts;
+	stats.independent += it.independent;
+	stats.ms += it.ms;
+}
+
 void collision_response(vector<Mesh*> &meshes, const vector<Constraint*> &cons,
 						const vector<Mesh*> &obs_meshes)
 {
-	::meshes = &meshes;
-	::obs_meshes = &obs_meshes;
-	::xold = node_positions(meshes);
-	::xold_obs = node_positions(obs_meshes);
 	vector<AccelStruct*> accs = create_accel_structs(meshes, true),
 		obs_accs = create_accel_structs(obs_meshes, true);
+	collision_response(meshes, cons, obs_meshes, accs, obs_accs, NULL);
+	destroy_accel_structs(accs);
+	destroy_accel_structs(obs_accs);
+}
+
+void collision_response(vector<Mesh*> &meshes, const vector<Constraint*> &cons,
+						const vector<Mesh*> &obs_meshes,
+						const vector<AccelStruct*> &accs,
+						const vector<AccelStruct*> &obs_accs,
+						CollisionStats *stats)
+{
+	set_meshes(meshes, obs_meshes);
+	::mesh_index.get_positions(::xold);
+	::obs_mesh_index.get_positions(::xold_obs);
 	vector<ImpactZone*> zones;
+	ZoneForest forest;
 	::obs_mass = 1e3;
+	if (stats)
+	{
+		stats->calls++;
+		stats->last.clear();
+	}
 	int iter;
 	for (int deform = 0; deform <= 1; deform++)
 	{
 		::deform_obstacles = deform;
+		for (int z = 0; z < zones.size(); z++)
+			delete zones[z];
 		zones.clear();
+		forest.reset();
 		for (iter = 0; iter < max_iter; iter++)
 		{
+			cTimePoint start = cTimeUtil::GetCurrentTime_chrono();
 			if (!zones.empty())
 				update_active(accs, obs_accs, zones);
 			vector<Impact> impacts = find_impacts(accs, obs_accs);
+			CollisionIteration it = { (int)impacts.size(), 0, 0 };
 			impacts = independent_impacts(impacts);
+			it.independent = impacts.size();
 			if (impacts.empty())
+			{
+				if (stats)
+					record_iteration(*stats, it, start);
 				break;
-			add_impacts(impacts, zones);
+			}
+			add_impacts(impacts, forest, zones);
+			// zones share no free nodes, so they are resolved concurrently;
+			// a lone zone keeps the threads for its own solve instead
+			int nactive = 0;
+			for (int z = 0; z < zones.size(); z++)
+				nactive += zones[z]->active;
+#pragma omp parallel for schedule(dynamic) if (nactive > 1)
 			for (int z = 0; z < zones.size(); z++)
 			{
 				ImpactZone *zone = zones[z];
@@ -135,6 +195,8 @@ void collision_response(vector<Mesh*> &meshes, const vector<Constraint*> &cons,
 				update_accel_struct(*obs_accs[a]);
 			if (deform_obstacles)
 				::obs_mass /= 2;
+			if (stats)
+				record_iteration(*stats, it, start);
 		}
 		if (iter < max_iter) // success!
 			break;
@@ -157,8 +219,6 @@ void collision_response(vector<Mesh*> &meshes, const vector<Constraint*> &cons,
 	}
 	for (int z = 0; z < zones.size(); z++)
 		delete zones[z];
-	destroy_accel_structs(accs);
-	destroy_accel_structs(obs_accs);
 }
 
 void update_active(const vector<AccelStruct*> &accs,
@@ -210,168 +270,82 @@ vector<Impact> find_impacts(const vector<AccelStruct*> &accs,
 	return impacts;
 }
 
-bool vf_collision_test(const Vert *vert, const Face *face, Impact &impact);
-bool ee_collision_test(const Edge *edge0, const Edge *edge1, Impact &impact);
+// The vertex-face and edge-edge candidates of a pair of faces are first
+// rejected by topology and by their ccd boxes, which are computed once per
+// face pair. The survivors are gathered into one batch per type and tested
+// together by ccd_test (ccd.hpp).
 
-void find_face_impacts(const Face *face0, const Face *face1)
-{
-	int t = omp_get_thread_num();
-	Impact impact;
-	for (int v = 0; v < 3; v++)
-		if (vf_collision_test(face0->v[v], face1, impact))
-			::impacts[t].push_back(impact);
-	for (int v = 0; v < 3; v++)
-		if (vf_collision_test(face1->v[v], face0, impact))
-			::impacts[t].push_back(impact);
-	for (int e0 = 0; e0 < 3; e0++)
-		for (int e1 = 0; e1 < 3; e1++)
-			if (ee_collision_test(face0->adje[e0], face1->adje[e1], impact))
-				::impacts[t].push_back(impact);
-}
-
-bool collision_test(Impact::Type type, const Node *node0, const Node *node1,
-					const Node *node2, const Node *node3, Impact &impact);
-
-bool vf_collision_test(const Vert *vert, const Face *face, Impact &impact)
+static void add_vf_candidate(CcdBatch &batch, const Node *node,
+							 const BOX &node_box, const Face *face,
+							 const BOX &face_box)
 {
-	const Node *node = vert->node;
 	if (node == face->v[0]->node
 		|| node == face->v[1]->node
 		|| node == face->v[2]->node)
-		return false;
-	if (!overlap(node_box(node, true), face_box(face, true), ::thickness))
-		return false;
-	return collision_test(Impact::VF, node, face->v[0]->node, face->v[1]->node,
-						  face->v[2]->node, impact);
+		return;
+	if (!overlap(node_box, face_box, ::thickness))
+		return;
+	batch.add(node, face->v[0]->node, face->v[1]->node, face->v[2]->node);
 }
 
-bool ee_collision_test(const Edge *edge0, const Edge *edge1, Impact &impact)
+static void add_ee_candidate(CcdBatch &batch, const Edge *edge0,
+							 const BOX &edge_box0, const Edge *edge1,
+							 const BOX &edge_box1)
 {
 	if (edge0->n[0] == edge1->n[0] || edge0->n[0] == edge1->n[1]
 		|| edge0->n[1] == edge1->n[0] || edge0->n[1] == edge1->n[1])
-		return false;
-	if (!overlap(edge_box(edge0, true), edge_box(edge1, true), ::thickness))
-		return false;
-	return collision_test(Impact::EE, edge0->n[0], edge0->n[1],
-						  edge1->n[0], edge1->n[1], impact);
+		return;
+	if (!overlap(edge_box0, edge_box1, ::thickness))
+		return;
+	batch.add(edge0->n[0], edge0->n[1], edge1->n[0], edge1->n[1]);
 }
 
-int solve_cubic(double a3, double a2, double a1, double a0, double t[3]);
-
-Vec3 pos(const Node *node, double t);
-
-bool collision_test(Impact::Type type, const Node *node0, const Node *node1,
-					const Node *node2, const Node *node3, Impact &impact)
-{
-	impact.type = type;
-	impact.nodes[0] = (Node*)node0;
-	impact.nodes[1] = (Node*)node1;
-	impact.nodes[2] = (Node*)node2;
-	impact.nodes[3] = (Node*)node3;
-	const Vec3 &x0 = node0->x0, v0 = node0->x - x0;
-	Vec3 x1 = node1->x0 - x0, x2 = node2->x0 - x0, x3 = node3->x0 - x0;
-	Vec3 v1 = (node1->x - node1->x0) - v0, v2 = (node2->x - node2->x0) - v0,
-		v3 = (node3->x - node3->x0) - v0;
-	double a0 = stp(x1, x2, x3),
-		a1 = stp(v1, x2, x3) + stp(x1, v2, x3) + stp(x1, x2, v3),
-		a2 = stp(x1, v2, v3) + stp(v1, x2, v3) + stp(v1, v2, x3),
-		a3 = stp(v1, v2, v3);
-	double t[4];
-	int nsol = solve_cubic(a3, a2, a1, a0, t);
-	t[nsol] = 1; // also check at end of timestep
-	for (int i = 0; i < nsol; i++)
+static void append_hits(const CcdBatch &batch, vector<Impact> &impacts)
+{
+	for (int c = 0; c < batch.n; c++)
 	{
-		if (t[i] < 0 || t[i] > 1)
+		if (!batch.hit[c])
 			continue;
-		impact.t = t[i];
-		Vec3 x0 = pos(node0, t[i]), x1 = pos(node1, t[i]),
-			x2 = pos(node2, t[i]), x3 = pos(node3, t[i]);
-		Vec3 &n = impact.n;
-		double *w = impact.w;
-		double d;
-		bool inside;
-		if (type == Impact::VF)
-		{
-			d = signed_vf_distance(x0, x1, x2, x3, &n, w);
-			inside = (min(-w[1], -w[2], -w[3]) >= -1e-6);
-		}
-		else
-		{// Impact::EE
-			d = signed_ee_distance(x0, x1, x2, x3, &n, w);
-			inside = (min(w[0], w[1], -w[2], -w[3]) >= -1e-6);
-		}
-		if (dot(n, w[1] * v1 + w[2] * v2 + w[3] * v3) > 0)
-			n = -n;
-		if (abs(d) < 1e-6 && inside)
-			return true;
+		Impact impact(batch.type == CcdBatch::VF ? Impact::VF : Impact::EE,
+					  batch.nodes[c][0], batch.nodes[c][1], batch.nodes[c][2],
+					  batch.nodes[c][3]);
+		impact.t = batch.t[c];
+		impact.n = batch.normal[c];
+		for (int k = 0; k < 4; k++)
+			impact.w[k] = batch.w[c][k];
+		impacts.push_back(impact);
 	}
-	return false;
 }
 
-Vec3 pos(const Node *node, double t)
-{
-	return node->x0 + t * (node->x - node->x0);
-}
-
-// Solving cubic equations
-
-double newtons_method(double a, double b, double c, double d, double x0,
-					  int init_dir);
-
-// solves a x^3 + b x^2 + c x + d == 0
-int solve_cubic(double a, double b, double c, double d, double x[3])
+void find_face_impacts(const Face *face0, const Face *face1)
 {
-	double xc[2];
-	int ncrit = solve_quadratic(3 * a, 2 * b, c, xc);
-	if (ncrit == 0)
-	{
-		x[0] = newtons_method(a, b, c, d, xc[0], 0);
-		return 1;
-	}
-	else if (ncrit == 1)
-	{// cubic is actually quadratic
-		return solve_quadratic(b, c, d, x);
-	}
-	else
+	int t = omp_get_thread_num();
+	const Face *faces[2] = { face0, face1 };
+	BOX node_boxes[2][3], face_boxes[2], edge_boxes[2][3];
+	for (int f = 0; f < 2; f++)
 	{
-		double yc[2] = { d + xc[0] * (c + xc[0] * (b + xc[0] * a)),
-						d + xc[1] * (c + xc[1] * (b + xc[1] * a)) };
-		int i = 0;
-		if (yc[0] * a >= 0)
-			x[i++] = newtons_method(a, b, c, d, xc[0], -1);
-		if (yc[0] * yc[1] <= 0)
+		for (int v = 0; v < 3; v++)
 		{
-			int closer = abs(yc[0]) < abs(yc[1]) ? 0 : 1;
-			x[i++] = newtons_method(a, b, c, d, xc[closer], closer == 0 ? 1 : -1);
+			node_boxes[f][v] = node_box(faces[f]->v[v]->node, true);
+			edge_boxes[f][v] = edge_box(faces[f]->adje[v], true);
 		}
-		if (yc[1] * a <= 0)
-			x[i++] = newtons_method(a, b, c, d, xc[1], 1);
-		return i;
-	}
-}
-
-double newtons_method(double a, double b, double c, double d, double x0,
-					  int init_dir)
-{
-	if (init_dir != 0)
-	{
-		// quadratic approximation around x0, assuming y' = 0
-		double y0 = d + x0 * (c + x0 * (b + x0 * a)),
-			ddy0 = 2 * b + x0 * (6 * a);
-		x0 += init_dir * sqrt(abs(2 * y0 / ddy0));
-	}
-	for (int iter = 0; iter < 100; iter++)
-	{
-		double y = d + x0 * (c + x0 * (b + x0 * a));
-		double dy = c + x0 * (2 * b + x0 * 3 * a);
-		if (dy == 0)
-			return x0;
-		double x1 = x0 - y / dy;
-		if (abs(x0 - x1) < 1e-6)
-			return x0;
-		x0 = x1;
+		face_boxes[f] = face_box(faces[f], true);
 	}
-	return x0;
+	CcdBatch vf(CcdBatch::VF), ee(CcdBatch::EE);
+	for (int v = 0; v < 3; v++)
+		add_vf_candidate(vf, face0->v[v]->node, node_boxes[0][v], face1,
+						 face_boxes[1]);
+	for (int v = 0; v < 3; v++)
+		add_vf_candidate(vf, face1->v[v]->node, node_boxes[1][v], face0,
+						 face_boxes[0]);
+	for (int e0 = 0; e0 < 3; e0++)
+		for (int e1 = 0; e1 < 3; e1++)
+			add_ee_candidate(ee, face0->adje[e0], edge_boxes[0][e0],
+							 face1->adje[e1], edge_boxes[1][e1]);
+	ccd_test(vf);
+	ccd_test(ee);
+	append_hits(vf, ::impacts[t]);
+	append_hits(ee, ::impacts[t]);
 }
 
 // Independent impacts
@@ -383,20 +357,28 @@ bool operator< (const Impact &impact0, const Impact &impact1)
 
 bool conflict(const Impact &impact0, const Impact &impact1);
 
+// Greedy in order of time: an impact is taken unless one of its free nodes
+// belongs to an impact taken before it, which is exactly when conflict()
+// holds against one of them. The nodes of taken impacts are kept in a hash
+// set, so the selection costs no more than the sort.
 vector<Impact> independent_impacts(const vector<Impact> &impacts)
 {
 	vector<Impact> sorted = impacts;
 	sort(sorted.begin(), sorted.end());
 	vector<Impact> indep;
+	unordered_set<const Node*> taken;
 	for (int e = 0; e < sorted.size(); e++)
 	{
 		const Impact &impact = sorted[e];
 		bool con = false;
-		for (int e1 = 0; e1 < indep.size(); e1++)
-			if (conflict(impact, indep[e1]))
+		for (int n = 0; n < 4; n++)
+			if (is_free(impact.nodes[n]) && taken.count(impact.nodes[n]))
 				con = true;
-		if (!con)
-			indep.push_back(impact);
+		if (con)
+			continue;
+		indep.push_back(impact);
+		for (int n = 0; n < 4; n++)
+			taken.insert(impact.nodes[n]);
 	}
 	return indep;
 }
@@ -411,11 +393,21 @@ bool conflict(const Impact &i0, const Impact &i1)
 
 // Impact zones
 
-ImpactZone *find_or_create_zone(const Node *node, vector<ImpactZone*> &zones);
-void merge_zones(ImpactZone* zone0, ImpactZone *zone1,
-				 vector<ImpactZone*> &zones);
+void ZoneForest::reset()
+{
+	nfree = ::mesh_index.size<Node>();
+	int nnodes = nfree + ::obs_mesh_index.size<Node>();
+	parent.assign(nnodes, -1);
+	zone.assign(nnodes, NULL);
+}
+
+int find_or_create_zone(const Node *node, ZoneForest &forest,
+						vector<ImpactZone*> &zones);
+int merge_zones(int root0, int root1, ZoneForest &forest,
+				vector<ImpactZone*> &zones);
 
-void add_impacts(const vector<Impact> &impacts, vector<ImpactZone*> &zones)
+void add_impacts(const vector<Impact> &impacts, ZoneForest &forest,
+				 vector<ImpactZone*> &zones)
 {
 	for (int z = 0; z < zones.size(); z++)
 		zones[z]->active = false;
@@ -423,36 +415,69 @@ void add_impacts(const vector<Impact> &impacts, vector<ImpactZone*> &zones)
 	{
 		const Impact &impact = impacts[i];
 		Node *node = impact.nodes[is_free(impact.nodes[0]) ? 0 : 3];
-		ImpactZone *zone = find_or_create_zone(node, zones);
+		int root = find_or_create_zone(node, forest, zones);
 		for (int n = 0; n < 4; n++)
 			if (is_free(impact.nodes[n]) || ::deform_obstacles)
-				merge_zones(zone, find_or_create_zone(impact.nodes[n], zones),
-							zones);
+				root = merge_zones(root, find_or_create_zone(impact.nodes[n],
+															 forest, zones),
+								   forest, zones);
+		ImpactZone *zone = forest.zone[root];
 		zone->impacts.push_back(impact);
 		zone->active = true;
 	}
 }
 
-ImpactZone *find_or_create_zone(const Node *node, vector<ImpactZone*> &zones)
+int node_slot(const Node *node, const ZoneForest &forest)
 {
-	for (int z = 0; z < zones.size(); z++)
-		if (is_in((Node*)node, zones[z]->nodes))
-			return zones[z];
+	int i = ::mesh_index.index(node);
+	return i != -1 ? i : forest.nfree + ::obs_mesh_index.index(node);
+}
+
+int find_root(ZoneForest &forest, int s)
+{
+	while (forest.parent[s] != s)
+	{
+		forest.parent[s] = forest.parent[forest.parent[s]]; // path halving
+		s = forest.parent[s];
+	}
+	return s;
+}
+
+int find_or_create_zone(const Node *node, ZoneForest &forest,
+						vector<ImpactZone*> &zones)
+{
+	int s = node_slot(node, forest);
+	if (forest.parent[s] != -1)
+		return find_root(forest, s);
 	ImpactZone *zone = new ImpactZone;
 	zone->nodes.push_back((Node*)node);
+	zone->active = false;
+	zone->index = zones.size();
 	zones.push_back(zone);
-	return zone;
+	forest.parent[s] = s;
+	forest.zone[s] = zone;
+	return s;
 }
 
-void merge_zones(ImpactZone* zone0, ImpactZone *zone1,
-				 vector<ImpactZone*> &zones)
+// the larger zone absorbs the smaller one; returns the root of the union
+int merge_zones(int root0, int root1, ZoneForest &forest,
+				vector<ImpactZone*> &zones)
 {
-	if (zone0 == zone1)
-		return;
+	if (root0 == root1)
+		return root0;
+	if (forest.zone[root0]->nodes.size() < forest.zone[root1]->nodes.size())
+		swap(root0, root1);
+	ImpactZone *zone0 = forest.zone[root0], *zone1 = forest.zone[root1];
 	append(zone0->nodes, zone1->nodes);
 	append(zone0->impacts, zone1->impacts);
-	exclude(zone1, zones);
+	zone0->active = zone0->active || zone1->active;
+	forest.parent[root1] = root0;
+	forest.zone[root1] = NULL;
+	zones[zone1->index] = zones.back();
+	zones[zone1->index]->index = zone1->index;
+	zones.pop_back();
 	delete zone1;
+	return root0;
 }
 
 // Response
@@ -552,7 +577,8 @@ void NormalOpt::finalize(const double *x) const
 
 const Vec3 &get_xold(const Node *node)
 {
-	pair<bool, int> mi = find_in_meshes(node);
-	int ni = get_index(node, mi.first ? *::meshes : *::obs_meshes);
-	return (mi.first ? ::xold : ::xold_obs)[ni];
+	int ni = ::mesh_index.index(node);
+	if (ni != -1)
+		return ::xold[ni];
+	return ::xold_obs[::obs_mesh_index.index(node)];
 }
@@ -30,7 +30,34 @@
 
 struct Mesh;
 struct Constraint;
+struct AccelStruct;
 
+struct CollisionIteration
+{
+	int impacts;	 // impacts found
+	int independent; // impacts selected by independent_impacts
+	double ms;		 // wall time of the iteration
+};
+
+// Counters of collision_response, accumulated over all calls
+struct CollisionStats
+{
+	int calls, iterations;
+	long long impacts, independent;
+	double ms;
+	std::vector<CollisionIteration> last; // iterations of the latest call
+	CollisionStats() : calls(0), iterations(0), impacts(0), independent(0),
+					   ms(0) {}
+};
+
+void collision_response (std::vector<Mesh*> & meshes,
+                         const std::vector<Constraint*> & cons,
+                         const std::vector<Mesh*> & obs_meshes);
+
+// same, using ccd accel structs kept by the caller (see AccelCache)
 void collision_response (std::vector<Mesh*> & meshes,
                          const std::vector<Constraint*> & cons,
-                         const std::vector<Mesh*> & obs_meshes);
\ No newline at end of file
+                         const std::vector<Mesh*> & obs_meshes,
+                         const std::vector<AccelStruct*> & accs,
+                         const std::vector<AccelStruct*> & obs_accs,
+                         CollisionStats * stats = NULL);
\ No newline at end of file
@@ -30,105 +30,103 @@
 #include <omp.h>
 using namespace std;
 
-void collect_leaves(BVHNode *node, vector<BVHNode*> &leaves);
-
-AccelStruct::AccelStruct(const Mesh &mesh, bool ccd) : tree((Mesh&)mesh, ccd), root(tree._root), leaves(mesh.faces.size())
-{
-	if (root)
-		collect_leaves(root, leaves);
-}
-
-void collect_leaves(BVHNode *node, vector<BVHNode*> &leaves)
+AccelStruct::AccelStruct(const Mesh &mesh, bool ccd) : tree((Mesh&)mesh, ccd), leaves(mesh.faces.size())
 {
-	if (node->isLeaf())
-	{
-		int f = node->getFace()->index;
-		if (f >= leaves.size())
-			leaves.resize(f + 1);
-		leaves[f] = node;
-	}
-	else
-	{
-		collect_leaves(node->getLeftChild(), leaves);
-		collect_leaves(node->getRightChild(), leaves);
-	}
+	for (int n = 0; n < tree._face.size(); n++)
+		if (tree.isLeaf(n))
+			leaves[tree.getFace(n)->index] = n;
 }
 
 void update_accel_struct(AccelStruct &acc)
 {
-	if (acc.root)
+	if (!acc.tree.empty())
 		acc.tree.refit();
 }
 
-void mark_descendants(BVHNode *node, bool active);
-void mark_ancestors(BVHNode *node, bool active);
-
 void mark_all_inactive(AccelStruct &acc)
 {
-	if (acc.root)
-		mark_descendants(acc.root, false);
+	acc.tree._active.assign(acc.tree._active.size(), false);
 }
 
-void mark_active(AccelStruct &acc, const Face *face)
+void mark_all_active(AccelStruct &acc)
 {
-	if (acc.root)
-		mark_ancestors(acc.leaves[face->index], true);
+	acc.tree._active.assign(acc.tree._active.size(), true);
 }
 
-void mark_descendants(BVHNode *node, bool active)
+void mark_active(AccelStruct &acc, const Face *face)
 {
-	node->_active = active;
-	if (!node->isLeaf())
-	{
-		mark_descendants(node->_left, active);
-		mark_descendants(node->_right, active);
-	}
+	if (acc.tree.empty())
+		return;
+	for (int n = acc.leaves[face->index]; n >= 0; n = acc.tree.getParent(n))
+		acc.tree._active[n] = true;
 }
 
-void mark_ancestors(BVHNode *node, bool active)
+// Traversal keeps an explicit stack of node pairs. A pair with node1 < 0
+// stands for node0 against itself. Children are pushed in reverse so that
+// callbacks come in the same order as a recursive descent.
+struct BVHPair
 {
-	node->_active = active;
-	if (!node->isRoot())
-		mark_ancestors(node->_parent, active);
+	int node0, node1;
+	BVHPair(int node0, int node1) : node0(node0), node1(node1) {}
+};
+
+static void for_overlapping_pairs(const BVHTree &tree0, const BVHTree &tree1,
+								  vector<BVHPair> &stack, float thickness,
+								  BVHCallback callback)
+{
+	while (!stack.empty())
+	{
+		int n0 = stack.back().node0, n1 = stack.back().node1;
+		stack.pop_back();
+		if (n1 < 0)
+		{
+			if (tree0.isLeaf(n0) || !tree0._active[n0])
+				continue;
+			int left = tree0.getLeftChild(n0), right = tree0.getRightChild(n0);
+			stack.push_back(BVHPair(left, right));
+			stack.push_back(BVHPair(right, -1));
+			stack.push_back(BVHPair(left, -1));
+			continue;
+		}
+		if (!tree0._active[n0] && !tree1._active[n1])
+			continue;
+		if (!overlap(tree0._box[n0], tree1._box[n1], thickness))
+			continue;
+		if (tree0.isLeaf(n0) && tree1.isLeaf(n1))
+			callback(tree0.getFace(n0), tree1.getFace(n1));
+		else if (tree0.isLeaf(n0))
+		{
+			stack.push_back(BVHPair(n0, tree1.getRightChild(n1)));
+			stack.push_back(BVHPair(n0, tree1.getLeftChild(n1)));
+		}
+		else
+		{
+			stack.push_back(BVHPair(tree0.getRightChild(n0), n1));
+			stack.push_back(BVHPair(tree0.getLeftChild(n0), n1));
+		}
+	}
 }
 
-void for_overlapping_faces(BVHNode *node, float thickness,
+void for_overlapping_faces(const BVHTree &tree, int node, float thickness,
 						   BVHCallback callback)
 {
-	if (node->isLeaf() || !node->_active)
-		return;
-	for_overlapping_faces(node->getLeftChild(), thickness, callback);
-	for_overlapping_faces(node->getRightChild(), thickness, callback);
-	for_overlapping_faces(node->getLeftChild(), node->getRightChild(),
-						  thickness, callback);
+	vector<BVHPair> stack(1, BVHPair(node, -1));
+	stack.reserve(64);
+	for_overlapping_pairs(tree, tree, stack, thickness, callback);
 }
 
-void for_overlapping_faces(BVHNode *node0, BVHNode *node1, float thickness,
+void for_overlapping_faces(const BVHTree &tree0, int node0,
+						   const BVHTree &tree1, int node1, float thickness,
 						   BVHCallback callback)
 {
-	if (!node0->_active && !node1->_active)
-		return;
-	if (!overlap(node0->_box, node1->_box, thickness))
-		return;
-	if (node0->isLeaf() && node1->isLeaf())
-	{
-		Face *face0 = node0->getFace(),
-			*face1 = node1->getFace();
-		callback(face0, face1);
-	}
-	else if (node0->isLeaf())
-	{
-		for_overlapping_faces(node0, node1->getLeftChild(), thickness, callback);
-		for_overlapping_faces(node0, node1->getRightChild(), thickness, callback);
-	}
-	else
-	{
-		for_overlapping_faces(node0->getLeftChild(), node1, thickness, callback);
-		for_overlapping_faces(node0->getRightChild(), node1, thickness, callback);
-	}
+	vector<BVHPair> stack(1, BVHPair(node0, node1));
+	stack.reserve(64);
+	for_overlapping_pairs(tree0, tree1, stack, thickness, callback);
 }
 
-vector<BVHNode*> collect_upper_nodes(const vector<AccelStruct*> &accs, int n);
+typedef pair<const BVHTree*, int> BVHNodeRef;
+
+vector<BVHNodeRef> collect_upper_nodes(const vector<AccelStruct*> &accs, int n);
 
 void for_overlapping_faces(const vector<AccelStruct*> &accs,
 						   const vector<AccelStruct*> &obs_accs,
@@ -136,18 +134,21 @@ void for_overlapping_faces(const vector<AccelStruct*> &accs,
 						   bool parallel)
 {
 	int nnodes = (int)ceil(sqrt(2 * omp_get_max_threads()));
-	vector<BVHNode*> nodes = collect_upper_nodes(accs, nnodes);
+	vector<BVHNodeRef> nodes = collect_upper_nodes(accs, nnodes);
 	int nthreads = omp_get_max_threads();
 	omp_set_num_threads(parallel ? omp_get_max_threads() : 1);
 #pragma omp parallel for
 	for (int n = 0; n < nodes.size(); n++)
 	{
-		for_overlapping_faces(nodes[n], thickness, callback);
+		const BVHTree &tree = *nodes[n].first;
+		for_overlapping_faces(tree, nodes[n].second, thickness, callback);
 		for (int m = 0; m < n; m++)
-			for_overlapping_faces(nodes[n], nodes[m], thickness, callback);
+			for_overlapping_faces(tree, nodes[n].second, *nodes[m].first,
+								  nodes[m].second, thickness, callback);
 		for (int o = 0; o < obs_accs.size(); o++)
-			if (obs_accs[o]->root)
-				for_overlapping_faces(nodes[n], obs_accs[o]->root, thickness,
+			if (!obs_accs[o]->tree.empty())
+				for_overlapping_faces(tree, nodes[n].second, obs_accs[o]->tree,
+									  obs_accs[o]->tree.getRoot(), thickness,
 									  callback);
 	}
 	omp_set_num_threads(nthreads);
@@ -159,36 +160,42 @@ void for_faces_overlapping_obstacles(const vector<AccelStruct*> &accs,
 									 bool parallel)
 {
 	int nnodes = omp_get_max_threads();
-	vector<BVHNode*> nodes = collect_upper_nodes(accs, nnodes);
+	vector<BVHNodeRef> nodes = collect_upper_nodes(accs, nnodes);
 	int nthreads = omp_get_max_threads();
 	omp_set_num_threads(parallel ? omp_get_max_threads() : 1);
 #pragma omp parallel for
 	for (int n = 0; n < nodes.size(); n++)
 		for (int o = 0; o < obs_accs.size(); o++)
-			if (obs_accs[o]->root)
-				for_overlapping_faces(nodes[n], obs_accs[o]->root, thickness,
+			if (!obs_accs[o]->tree.empty())
+				for_overlapping_faces(*nodes[n].first, nodes[n].second,
+									  obs_accs[o]->tree,
+									  obs_accs[o]->tree.getRoot(), thickness,
 									  callback);
 	omp_set_num_threads(nthreads);
 }
 
-vector<BVHNode*> collect_upper_nodes(const vector<AccelStruct*> &accs,
-									 int nnodes)
+vector<BVHNodeRef> collect_upper_nodes(const vector<AccelStruct*> &accs,
+									   int nnodes)
 {
-	vector<BVHNode*> nodes;
+	vector<BVHNodeRef> nodes;
 	for (int a = 0; a < accs.size(); a++)
-		if (accs[a]->root)
-			nodes.push_back(accs[a]->root);
+		if (!accs[a]->tree.empty())
+			nodes.push_back(BVHNodeRef(&accs[a]->tree, accs[a]->tree.getRoot()));
 	while (nodes.size() < nnodes)
 	{
-		vector<BVHNode*> children;
+		vector<BVHNodeRef> children;
 		for (int n = 0; n < nodes.size(); n++)
-			if (nodes[n]->isLeaf())
+		{
+			const BVHTree &tree = *nodes[n].first;
+			int node = nodes[n].second;
+			if (tree.isLeaf(node))
 				children.push_back(nodes[n]);
 			else
 			{
-				children.push_back(nodes[n]->_left);
-				children.push_back(nodes[n]->_right);
+				children.push_back(BVHNodeRef(&tree, tree.getLeftChild(node)));
+				children.push_back(BVHNodeRef(&tree, tree.getRightChild(node)));
 			}
+		}
 		if (children.size() == nodes.size())
 			break;
 		nodes = children;
@@ -211,6 +218,70 @@ void destroy_accel_structs(vector<AccelStruct*> &accs)
 		delete accs[a];
 }
 
+AccelCache::AccelCache(const AccelCache &) : rebuild_ratio(2), rebuilds(0),
+											 refits(0)
+{
+}
+
+AccelCache &AccelCache::operator=(const AccelCache &)
+{
+	clear();
+	return *this;
+}
+
+AccelCache::~AccelCache()
+{
+	clear();
+}
+
+void AccelCache::clear()
+{
+	for (int ccd = 0; ccd < 2; ccd++)
+	{
+		destroy_accel_structs(accs[ccd]);
+		accs[ccd].clear();
+		meshes[ccd].clear();
+		topology[ccd].clear();
+		quality[ccd].clear();
+	}
+}
+
+const vector<AccelStruct*> &AccelCache::update(const vector<Mesh*> &meshes,
+											   bool ccd)
+{
+	vector<AccelStruct*> &accs = this->accs[ccd];
+	for (int a = meshes.size(); a < accs.size(); a++)
+		delete accs[a];
+	accs.resize(meshes.size(), NULL);
+	this->meshes[ccd].resize(meshes.size(), NULL);
+	topology[ccd].resize(meshes.size(), -1);
+	quality[ccd].resize(meshes.size(), 0);
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		const Mesh *mesh = meshes[m];
+		bool rebuild = !accs[m] || this->meshes[ccd][m] != mesh ||
+					   topology[ccd][m] != mesh->topology;
+		if (!rebuild && !accs[m]->tree.empty())
+		{
+			double q = accs[m]->tree.refit();
+			refits++;
+			rebuild = q > rebuild_ratio * quality[ccd][m];
+		}
+		if (rebuild)
+		{
+			delete accs[m];
+			accs[m] = new AccelStruct(*mesh, ccd);
+			this->meshes[ccd][m] = mesh;
+			topology[ccd][m] = mesh->topology;
+			quality[ccd][m] = accs[m]->tree.refit();
+			rebuilds++;
+		}
+		else
+			mark_all_active(*accs[m]);
+	}
+	return accs;
+}
+
 template <typename Prim>
 int find_mesh(const Prim *p, const vector<Mesh*> &meshes)
 {
@@ -228,3 +299,12 @@ template int find_mesh(const Edge*, const vector<Mesh*>&);
 template int find_mesh(const Face*, const vector<Mesh*>&);
 
 const vector<Mesh*> *meshes, *obs_meshes;
+MeshIndex mesh_index, obs_mesh_index;
+
+void set_meshes(const vector<Mesh*> &meshes, const vector<Mesh*> &obs_meshes)
+{
+	::meshes = &meshes;
+	::obs_meshes = &obs_meshes;
+	::mesh_index.update(meshes);
+	::obs_mesh_index.update(obs_meshes);
+}
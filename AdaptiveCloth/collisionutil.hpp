@@ -29,28 +29,28 @@
 
 #include "bvh.hpp"
 
-typedef DeformBVHNode BVHNode;
 typedef DeformBVHTree BVHTree;
 
 struct AccelStruct
 {
 	BVHTree tree;
-	BVHNode *root;
-	std::vector<BVHNode*> leaves;
+	std::vector<int> leaves; // leaf node of each face
 	AccelStruct(const Mesh &mesh, bool ccd);
 };
 
 void update_accel_struct(AccelStruct &acc);
 
 void mark_all_inactive(AccelStruct &acc);
+void mark_all_active(AccelStruct &acc);
 void mark_active(AccelStruct &acc, const Face *face);
 
 // callback must be safe to parallelize via OpenMP
 typedef void(*BVHCallback) (const Face *face0, const Face *face1);
 
-void for_overlapping_faces(BVHNode *node, float thickness,
+void for_overlapping_faces(const BVHTree &tree, int node, float thickness,
 						   BVHCallback callback);
-void for_overlapping_faces(BVHNode *node0, BVHNode *node1, float thickness,
+void for_overlapping_faces(const BVHTree &tree0, int node0,
+						   const BVHTree &tree1, int node1, float thickness,
 						   BVHCallback callback);
 void for_overlapping_faces(const std::vector<AccelStruct*> &accs,
 						   const std::vector<AccelStruct*> &obs_accs,
@@ -65,15 +65,45 @@ std::vector<AccelStruct*> create_accel_structs
 (const std::vector<Mesh*> &meshes, bool ccd);
 void destroy_accel_structs(std::vector<AccelStruct*> &accs);
 
+// Accel structs kept alive across calls for a list of meshes, one set per
+// ccd mode. update() refits the trees in place and rebuilds one only when
+// its mesh was remeshed or replaced, or when refitting has loosened it so
+// that its relative box area (see DeformBVHTree::refit) exceeds
+// rebuild_ratio times the value it had when built. Copies start empty.
+struct AccelCache
+{
+	std::vector<AccelStruct*> accs[2];	// indexed by ccd
+	std::vector<const Mesh*> meshes[2]; // mesh each tree was built for
+	std::vector<int> topology[2];		// Mesh::topology at build time
+	std::vector<double> quality[2];		// relative box area at build time
+	double rebuild_ratio;
+	int rebuilds, refits;
+	AccelCache() : rebuild_ratio(2), rebuilds(0), refits(0) {}
+	AccelCache(const AccelCache &);
+	AccelCache &operator=(const AccelCache &);
+	~AccelCache();
+	void clear();
+	// refitted (or rebuilt) structs for meshes, with all nodes active
+	const std::vector<AccelStruct*> &update(const std::vector<Mesh*> &meshes,
+											bool ccd);
+};
+
 // find index of mesh containing specified element
 template <typename Prim>
 int find_mesh(const Prim *p, const std::vector<Mesh*> &meshes);
 
 extern const std::vector<Mesh*> *meshes; // to check if element is cloth or obs
 extern const std::vector<Mesh*> *obs_meshes;
+extern MeshIndex mesh_index, obs_mesh_index; // of *::meshes and *::obs_meshes
+
+// points ::meshes and ::obs_meshes at the given lists and brings their
+// indices up to date
+void set_meshes(const std::vector<Mesh*> &meshes,
+				const std::vector<Mesh*> &obs_meshes);
+
 template <typename Primitive> bool is_free(const Primitive *p)
 {
-	return find_mesh(p, *::meshes) != -1;
+	return ::mesh_index.mesh(p) != -1;
 }
 
 #endif
\ No newline at end of file
@@ -109,6 +109,7 @@ void load_json(const std::string &configFilename, Simulation *sim)
 		sim->end_frame = infinity;
 	}
 	sim->time = 0;
+	sim->frame = sim->step = 0;
 	parse(sim->m_Cloths, json["cloths"]);
 	parse_motions(sim->m_Motions, json["motions"]);
 	parse_handles(sim->m_pHandles, json["handles"], sim->m_Cloths, sim->m_Motions);
@@ -627,6 +628,30 @@ void parse(Magic &magic, const Json::Value &json)
 	PARSE_MAGIC(rib_stiffening);
 	PARSE_MAGIC(combine_tensors);
 	PARSE_MAGIC(preserve_creases);
+	PARSE_MAGIC(linear_solver);
+	PARSE_MAGIC(pcg_preconditioner);
+	PARSE_MAGIC(pcg_tolerance);
+	PARSE_MAGIC(pcg_max_iterations);
+	PARSE_MAGIC(auglag_solver);
+	PARSE_MAGIC(local_strain_limiting);
+	PARSE_MAGIC(proximity_tracking);
+	parse(magic.proximity_slack, json["proximity_slack"],
+		  magic.repulsion_thickness);
+	if (magic.linear_solver != "taucs" && magic.linear_solver != "pcg")
+	{
+		cout << "Unknown linear solver " << magic.linear_solver << endl;
+		abort();
+	}
+	if (magic.pcg_preconditioner != "jacobi" && magic.pcg_preconditioner != "ic0")
+	{
+		cout << "Unknown pcg preconditioner " << magic.pcg_preconditioner << endl;
+		abort();
+	}
+	if (magic.auglag_solver != "lbfgs" && magic.auglag_solver != "cg")
+	{
+		cout << "Unknown auglag solver " << magic.auglag_solver << endl;
+		abort();
+	}
 #undef PARSE_MAGIC
 }
 
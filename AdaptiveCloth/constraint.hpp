@@ -27,7 +27,7 @@
 #ifndef CONSTRAINT_HPP
 #define CONSTRAINT_HPP
 
-#include <map>
+#include <utility>
 #include <vector>
 #include "mesh.hpp"
 #include "util.hpp"
@@ -35,8 +35,29 @@
 #include "spline.hpp"
 #include "vectors.hpp"
 
-typedef std::map<Node*, Vec3> MeshGrad;
-typedef std::map<std::pair<Node*, Node*>, Mat3x3> MeshHess;
+// Small maps from the nodes of one constraint (at most 4) or pairs of them
+// to their vectors / blocks, held inline so that evaluating a constraint
+// never allocates. Entries keep insertion order; as with std::map,
+// operator[] inserts a zero entry for a new key.
+template <typename Key, typename Value, int capacity> struct NodeMap
+{
+	int n;
+	Key keys[capacity];
+	Value values[capacity];
+	NodeMap() : n(0) {}
+	Value &operator[](const Key &key)
+	{
+		for (int i = 0; i < n; i++)
+			if (keys[i] == key)
+				return values[i];
+		keys[n] = key;
+		values[n] = Value(0);
+		return values[n++];
+	}
+};
+
+typedef NodeMap<Node*, Vec3, 4> MeshGrad;
+typedef NodeMap<std::pair<Node*, Node*>, Mat3x3, 16> MeshHess;
 
 struct Constraint
 {
@@ -52,7 +73,7 @@ struct Constraint
 	virtual MeshGrad friction(double dt, MeshHess &jac) = 0;
 };
 
-struct EqCon : public Constraint
+struct EqCon final : public Constraint
 {
 	// n . (node->x - x) = 0
 	Node *node;
@@ -67,7 +88,7 @@ struct EqCon : public Constraint
 	MeshGrad friction(double dt, MeshHess &jac);
 };
 
-struct GlueCon : public Constraint
+struct GlueCon final : public Constraint
 {
 	Node *nodes[2];
 	Vec3 n;
@@ -81,7 +102,7 @@ struct GlueCon : public Constraint
 	MeshGrad friction(double dt, MeshHess &jac);
 };
 
-struct IneqCon : public Constraint
+struct IneqCon final : public Constraint
 {
 	// n . sum(w[i] verts[i]->x) >= 0
 	Node *nodes[4];
@@ -100,4 +121,61 @@ struct IneqCon : public Constraint
 	MeshGrad friction(double dt, MeshHess &jac);
 };
 
+// Storage for objects of type T that grows in fixed-size blocks, so that
+// pointers to elements stay valid. clear() keeps the blocks for reuse.
+// Not copyable.
+template <typename T> struct Pool
+{
+	static const int block_size = 256;
+	std::vector<T*> blocks;
+	int n;
+	Pool() : n(0) {}
+	~Pool()
+	{
+		for (int b = 0; b < blocks.size(); b++)
+			delete[] blocks[b];
+	}
+	int size() const { return n; }
+	T &operator[](int i) const { return blocks[i / block_size][i % block_size]; }
+	// a default-initialized element appended to the pool
+	T *alloc()
+	{
+		if (n == blocks.size() * block_size)
+			blocks.push_back(new T[block_size]);
+		T *t = &(*this)[n++];
+		*t = T();
+		return t;
+	}
+	void clear() { n = 0; }
+private:
+	Pool(const Pool &);
+	Pool &operator=(const Pool &);
+};
+
+// The constraints of a step, kept by type so that hot loops can run over
+// each type without virtual calls. all lists every constraint in the order
+// it was added, for the code that treats them generically. Meant to be
+// kept and cleared rather than rebuilt, so it is not copyable.
+struct Constraints
+{
+	Pool<EqCon> eqs;
+	Pool<GlueCon> glues;
+	Pool<IneqCon> ineqs;
+	std::vector<Constraint*> all;
+	Constraints() {}
+	EqCon *add_eq() { EqCon *con = eqs.alloc(); all.push_back(con); return con; }
+	GlueCon *add_glue() { GlueCon *con = glues.alloc(); all.push_back(con); return con; }
+	IneqCon *add_ineq() { IneqCon *con = ineqs.alloc(); all.push_back(con); return con; }
+	void clear()
+	{
+		eqs.clear();
+		glues.clear();
+		ineqs.clear();
+		all.clear();
+	}
+private:
+	Constraints(const Constraints &);
+	Constraints &operator=(const Constraints &);
+};
+
 #endif
\ No newline at end of file
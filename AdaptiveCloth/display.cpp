@@ -256,6 +256,7 @@ void glut_display_func()
         bool *p_open = &open;
         ImGui::Begin("ARCSim", p_open, window_flags);
 
+        update_simulation_imgui(*g_App.m_Sim);
         g_App.m_Sim->UpdateImGUI();
 
         ImGui::End();
@@ -47,4 +47,7 @@ void run_glut(const GlutCallbacks&);
 
 void redisplay();
 
+// common simulation panel: fps, bending model, densities, solver stats
+void update_simulation_imgui(Simulation &sim);
+
 #endif
\ No newline at end of file
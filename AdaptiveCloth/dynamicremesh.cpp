@@ -33,6 +33,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <map>
+#include <unordered_map>
 
 using namespace std;
 
@@ -94,11 +95,51 @@ Mat2x2 mean(const Sizing &s)
 
 // The algorithm
 
-bool fix_up_mesh(vector<Face*> &active, Mesh &mesh, vector<Edge*>* edges = 0);
+struct BadEdgeQueue;
 
-bool split_worst_edge(Mesh &mesh);
+// Faces left to examine. include and exclude behave like their vector
+// versions in util.hpp (append, swap with the last), but find the face
+// through an index instead of scanning the list.
+struct ActiveFaces
+{
+	vector<Face*> faces;
+	unordered_map<const Face*, int> index;
+	ActiveFaces() {}
+	explicit ActiveFaces(const vector<Face*> &faces)
+	{
+		for (int f = 0; f < faces.size(); f++)
+			include(faces[f]);
+	}
+	int size() const { return faces.size(); }
+	Face *operator[](int i) const { return faces[i]; }
+	void include(Face *face)
+	{
+		if (index.insert(make_pair(face, (int)faces.size())).second)
+			faces.push_back(face);
+	}
+	void exclude(const Face *face)
+	{
+		unordered_map<const Face*, int>::iterator it = index.find(face);
+		if (it != index.end())
+			remove(it->second);
+	}
+	void remove(int i)
+	{
+		index.erase(faces[i]);
+		if (i + 1 < faces.size())
+		{
+			faces[i] = faces.back();
+			index[faces[i]] = i;
+		}
+		faces.pop_back();
+	}
+};
 
-bool improve_some_face(vector<Face*> &active, Mesh &mesh);
+bool fix_up_mesh(ActiveFaces &active, Mesh &mesh, BadEdgeQueue *queue = 0);
+
+void split_bad_edges(Mesh &mesh);
+
+bool improve_some_face(ActiveFaces &active, Mesh &mesh);
 
 void static_remesh(Cloth &cloth)
 {
@@ -110,8 +151,8 @@ void static_remesh(Cloth &cloth)
 		sizing->M = Mat2x2(1.f / sq(remeshing->size_min));
 		mesh.verts[v]->sizing = sizing;
 	}
-	while (split_worst_edge(mesh));
-	vector<Face*> active = mesh.faces;
+	split_bad_edges(mesh);
+	ActiveFaces active(mesh.faces);
 	while (improve_some_face(active, mesh));
 	for (int v = 0; v < mesh.verts.size(); v++)
 		delete mesh.verts[v]->sizing;
@@ -127,10 +168,10 @@ void dynamic_remesh(Cloth &cloth, const vector<Plane> &planes,
 	::plasticity = plasticity;
 	Mesh &mesh = cloth.mesh;
 	create_vert_sizing(mesh, planes);
-	vector<Face*> active = mesh.faces;
+	ActiveFaces active(mesh.faces);
 	fix_up_mesh(active, mesh);
-	while (split_worst_edge(mesh));
-	active = mesh.faces;
+	split_bad_edges(mesh);
+	active = ActiveFaces(mesh.faces);
 	while (improve_some_face(active, mesh));
 	destroy_vert_sizing(mesh);
 	update_indices(mesh);
@@ -309,43 +350,37 @@ double edge_metric(const Edge *edge)
 
 // Helpers
 
-template <typename T> void include_all(const vector<T> &u, vector<T> &v) { for (int i = 0; i < u.size(); i++) include(u[i], v); }
-template <typename T> void exclude_all(const vector<T> &u, vector<T> &v) { for (int i = 0; i < u.size(); i++) exclude(u[i], v); }
-template <typename T> void set_null_all(const vector<T> &u, vector<T> &v) { for (int i = 0; i < u.size(); i++) exclude(u[i], v); }
-
-void update_active(const RemeshOp &op, vector<Face*> &active)
-{
-	exclude_all(op.removed_faces, active);
-	include_all(op.added_faces, active);
-}
-
-void update_active(const vector<RemeshOp> &ops, vector<Face*> &active)
+void update_active(const RemeshOp &op, ActiveFaces &active)
 {
-	for (int i = 0; i < ops.size(); i++)
-		update_active(ops[i], active);
+	for (int f = 0; f < op.removed_faces.size(); f++)
+		active.exclude(op.removed_faces[f]);
+	for (int f = 0; f < op.added_faces.size(); f++)
+		active.include(op.added_faces[f]);
 }
 
 // Fixing-upping
 
-RemeshOp flip_edges(vector<Face*> &active, Mesh &mesh);
+RemeshOp flip_edges(ActiveFaces &active, Mesh &mesh);
 
 Vert *most_valent_vert(const vector<Face*> &faces);
 
 // Vert *farthest_neighbor (const Vert *vert);
 
-bool fix_up_mesh(vector<Face*> &active, Mesh &mesh, vector<Edge*> *edges)
+void update_queue(const RemeshOp &op, BadEdgeQueue &queue);
+
+bool fix_up_mesh(ActiveFaces &active, Mesh &mesh, BadEdgeQueue *queue)
 {
 	RemeshOp flip_ops = flip_edges(active, mesh);
 	update_active(flip_ops, active);
-	if (edges)
-		set_null_all(flip_ops.removed_edges, *edges);
+	if (queue)
+		update_queue(flip_ops, *queue);
 	flip_ops.done();
 	return !flip_ops.empty();
 }
 
-RemeshOp flip_some_edges(vector<Face*> &active, Mesh &mesh);
+RemeshOp flip_some_edges(ActiveFaces &active, Mesh &mesh);
 
-RemeshOp flip_edges(vector<Face*> &active, Mesh &mesh)
+RemeshOp flip_edges(ActiveFaces &active, Mesh &mesh)
 {
 	RemeshOp ops;
 	for (int i = 0; i < 3 * mesh.verts.size(); i++)
@@ -358,7 +393,7 @@ RemeshOp flip_edges(vector<Face*> &active, Mesh &mesh)
 	return ops;
 }
 
-vector<Edge*> find_edges_to_flip(const vector<Face*> &active);
+vector<Edge*> find_edges_to_flip(const ActiveFaces &active);
 vector<Edge*> independent_edges(const vector<Edge*> &edges);
 
 bool inverted(const Face *face) { return area(face) < 1e-12; }
@@ -377,7 +412,7 @@ bool any_degenerate(const vector<Face*> faces)
 	return false;
 }
 
-RemeshOp flip_some_edges(vector<Face*> &active, Mesh &mesh)
+RemeshOp flip_some_edges(ActiveFaces &active, Mesh &mesh)
 {
 	RemeshOp ops;
 	static int n_edges_prev = 0;
@@ -404,24 +439,20 @@ RemeshOp flip_some_edges(vector<Face*> &active, Mesh &mesh)
 
 bool should_flip(const Edge *edge);
 
-vector<Edge*> find_edges_to_flip(const vector<Face*> &active)
+vector<Edge*> find_edges_to_flip(const ActiveFaces &active)
 {
-	vector<Edge*> edges;
-	for (int f = 0; f < active.size(); f++)
-	{
-		include(active[f]->adje[0], edges);
-		include(active[f]->adje[1], edges);
-		include(active[f]->adje[2], edges);
-	}
+	unordered_map<const Edge*, bool> seen;
 	vector<Edge*> fedges;
-	for (int e = 0; e < edges.size(); e++)
-	{
-		Edge *edge = edges[e];
-		if (is_seam_or_boundary(edge) || edge->label != 0
-			|| !should_flip(edge))
-			continue;
-		fedges.push_back(edge);
-	}
+	for (int f = 0; f < active.size(); f++)
+		for (int e = 0; e < 3; e++)
+		{
+			Edge *edge = active[f]->adje[e];
+			if (!seen.insert(make_pair(edge, true)).second
+				|| is_seam_or_boundary(edge) || edge->label != 0
+				|| !should_flip(edge))
+				continue;
+			fedges.push_back(edge);
+		}
 	return fedges;
 }
 
@@ -462,19 +493,79 @@ bool should_flip(const Edge *edge)
 
 // Splitting
 
-vector<Edge*> find_bad_edges(const Mesh &mesh);
+// Edges whose metric exceeds 1, worst first. Splits and flips only change
+// the metric of the edges they add, so the queue is filled once and then
+// updated with each op's added and removed edges. Entries of removed edges
+// are skipped when they come up. Ties go to the edge queued first (mesh
+// order, then creation order), never to the pointer, so that the result
+// is reproducible.
+struct BadEdgeQueue
+{
+	struct Entry
+	{
+		double m;
+		int seq;
+		Edge *edge;
+		bool operator<(const Entry &e) const
+		{
+			return m < e.m || (m == e.m && seq > e.seq);
+		}
+	};
+	vector<Entry> heap;
+	unordered_map<const Edge*, int> queued; // seq of each live queued edge
+	int nseq;
+	BadEdgeQueue() : nseq(0) {}
+	void push(Edge *edge);
+	void remove(const Edge *edge) { queued.erase(edge); }
+	Edge *pop(); // NULL once no bad edge is left
+};
+
+void BadEdgeQueue::push(Edge *edge)
+{
+	double m = edge_metric(edge);
+	if (m <= 1)
+		return;
+	Entry entry = {m, nseq++, edge};
+	queued[edge] = entry.seq;
+	heap.push_back(entry);
+	push_heap(heap.begin(), heap.end());
+}
+
+Edge *BadEdgeQueue::pop()
+{
+	while (!heap.empty())
+	{
+		Entry entry = heap.front();
+		pop_heap(heap.begin(), heap.end());
+		heap.pop_back();
+		unordered_map<const Edge*, int>::iterator it = queued.find(entry.edge);
+		if (it == queued.end() || it->second != entry.seq)
+			continue;
+		queued.erase(it);
+		return entry.edge;
+	}
+	return NULL;
+}
+
+void update_queue(const RemeshOp &op, BadEdgeQueue &queue)
+{
+	for (int e = 0; e < op.removed_edges.size(); e++)
+		queue.remove(op.removed_edges[e]);
+	for (int e = 0; e < op.added_edges.size(); e++)
+		queue.push(op.added_edges[e]);
+}
 
 Sizing mean_vert_sizing(const Vert *vert0, const Vert *vert1);
 
 Vert *adjacent_vert(const Node *node, const Vert *vert);
 
-bool split_worst_edge(Mesh &mesh)
+void split_bad_edges(Mesh &mesh)
 {
-	vector<Edge*> edges = find_bad_edges(mesh);
-	for (int e = 0; e < edges.size(); e++)
+	BadEdgeQueue queue;
+	for (int e = 0; e < mesh.edges.size(); e++)
+		queue.push(mesh.edges[e]);
+	while (Edge *edge = queue.pop())
 	{
-		Edge *edge = edges[e];
-		if (!edge) continue;
 		Node *node0 = edge->n[0], *node1 = edge->n[1];
 		RemeshOp op = split_edge(edge);
 		op.apply(mesh);
@@ -485,40 +576,13 @@ bool split_worst_edge(Mesh &mesh)
 				*v1 = adjacent_vert(node1, vertnew);
 			vertnew->sizing = new Sizing(mean_vert_sizing(v0, v1));
 		}
-		set_null_all(op.removed_edges, edges);
+		update_queue(op, queue);
 		op.done();
 		if (verbose)
 			cout << "Split " << node0 << " and " << node1 << endl;
-		vector<Face*> active = op.added_faces;
-		fix_up_mesh(active, mesh, &edges);
-	}
-	return !edges.empty();
-}
-
-// don't use edge pointer as secondary sort key, otherwise not reproducible
-struct Deterministic_sort
-{
-	inline bool operator()(const std::pair<double, Edge*> &left, const std::pair<double, Edge*> &right)
-	{
-		return left.first < right.first;
-	}
-} deterministic_sort;
-
-vector<Edge*> find_bad_edges(const Mesh &mesh)
-{
-	vector< pair<double, Edge*> > edgems;
-	for (int e = 0; e < mesh.edges.size(); e++)
-	{
-		Edge *edge = mesh.edges[e];
-		double m = edge_metric(edge);
-		if (m > 1)
-			edgems.push_back(make_pair(m, edge));
+		ActiveFaces active(op.added_faces);
+		fix_up_mesh(active, mesh, &queue);
 	}
-	sort(edgems.begin(), edgems.end(), deterministic_sort);
-	vector<Edge*> edges(edgems.size());
-	for (int e = 0; e < edgems.size(); e++)
-		edges[e] = edgems[edgems.size() - e - 1].second;
-	return edges;
 }
 
 Sizing mean_vert_sizing(const Vert *vert0, const Vert *vert1)
@@ -544,7 +608,7 @@ vector<int> sort_edges_by_length(const Face *face);
 
 RemeshOp try_edge_collapse(Edge *edge, int which, Mesh &mesh);
 
-bool improve_some_face(vector<Face*> &active, Mesh &mesh)
+bool improve_some_face(ActiveFaces &active, Mesh &mesh)
 {
 	for (int f = 0; f < active.size(); f++)
 	{
@@ -558,13 +622,13 @@ bool improve_some_face(vector<Face*> &active, Mesh &mesh)
 			if (op.empty()) continue;
 			op.done();
 			update_active(op, active);
-			vector<Face*> fix_active = op.added_faces;
+			ActiveFaces fix_active(op.added_faces);
 			RemeshOp flip_ops = flip_edges(fix_active, mesh);
 			update_active(flip_ops, active);
 			flip_ops.done();
 			return true;
 		}
-		remove(f--, active);
+		active.remove(f--);
 	}
 	return false;
 }
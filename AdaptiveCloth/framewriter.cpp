@@ -0,0 +1,105 @@
+/*************************************************************************
+***********************    ARCSim_FrameWriter    *************************
+*************************************************************************/
+
+#include "framewriter.hpp"
+#include "util.hpp"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+static double ms_since(const chrono::steady_clock::time_point &start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+		.count();
+}
+
+FrameWriter::FrameWriter(int nslots)
+	: frames(0), blocked_ms(0), write_ms(0), slots(max(nslots, 1)),
+	  writing(-1), stop(false)
+{
+	for (int s = 0; s < slots.size(); s++)
+		idle.push_back(s);
+	thread = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stop = true;
+	}
+	changed.notify_all();
+	thread.join();
+}
+
+void FrameWriter::submit(const vector<Mesh *> &meshes, const string &prefix)
+{
+	int s;
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		unique_lock<mutex> guard(lock);
+		changed.wait(guard, [this]() { return !idle.empty(); });
+		blocked_ms += ms_since(start);
+		s = idle.front();
+		idle.pop_front();
+	}
+	Slot &slot = slots[s];
+	slot.meshes.resize(meshes.size());
+	for (int m = 0; m < meshes.size(); m++)
+		capture_obj(slot.meshes[m], *meshes[m]);
+	slot.prefix = prefix;
+	{
+		lock_guard<mutex> guard(lock);
+		queued.push_back(s);
+		frames++;
+	}
+	changed.notify_all();
+}
+
+void FrameWriter::flush()
+{
+	unique_lock<mutex> guard(lock);
+	changed.wait(guard, [this]() { return queued.empty() && writing < 0; });
+}
+
+void FrameWriter::run()
+{
+	string text;
+	for (;;)
+	{
+		{
+			unique_lock<mutex> guard(lock);
+			changed.wait(guard, [this]() { return stop || !queued.empty(); });
+			if (queued.empty())
+				return; // stopping, and everything is written
+			writing = queued.front();
+			queued.pop_front();
+		}
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		const Slot &slot = slots[writing];
+		for (int m = 0; m < slot.meshes.size(); m++)
+		{
+			text.clear();
+			encode_obj(slot.meshes[m], text);
+			string filename = stringf("%s_%02d.obj", slot.prefix.c_str(), m);
+			FILE *f = fopen(filename.c_str(), "w");
+			if (!f)
+			{
+				cout << "Error: failed to open file " << filename << endl;
+				continue;
+			}
+			fwrite(text.data(), 1, text.size(), f);
+			fclose(f);
+		}
+		{
+			lock_guard<mutex> guard(lock);
+			write_ms += ms_since(start);
+			idle.push_back(writing);
+			writing = -1;
+		}
+		changed.notify_all();
+	}
+}
@@ -0,0 +1,46 @@
+/*************************************************************************
+***********************    ARCSim_FrameWriter    *************************
+*************************************************************************/
+#pragma once
+
+#include "io.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Background frame output. submit copies the meshes into one of a ring of
+// slots, whose storage is reused from frame to frame, and returns; a writer
+// thread formats the slot as obj text (same files as save_objs) and writes
+// it. The stepping thread only waits when every slot is still queued.
+struct FrameWriter
+{
+	int frames;		   // submitted
+	double blocked_ms; // submit waiting for a free slot
+	double write_ms;   // writer thread encoding and writing
+	explicit FrameWriter(int nslots = 3);
+	~FrameWriter(); // writes out everything submitted
+	// written as <prefix>_<mesh>.obj, like save_objs
+	void submit(const std::vector<Mesh *> &meshes, const std::string &prefix);
+	// waits until everything submitted is written
+	void flush();
+
+private:
+	struct Slot
+	{
+		std::vector<ObjFrame> meshes;
+		std::string prefix;
+	};
+	std::vector<Slot> slots;
+	std::deque<int> idle, queued;
+	int writing; // slot being written, or -1
+	bool stop;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread thread;
+	void run();
+	FrameWriter(const FrameWriter &);
+	FrameWriter &operator=(const FrameWriter &);
+};
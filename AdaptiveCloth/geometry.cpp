@@ -205,11 +205,17 @@ double unsigned_ee_distance(const Vec3 &x0, const Vec3 &x1,
 }
 
 Vec3 get_barycentric_coords(const Vec2& point, const Face* f)
+{
+	return get_barycentric_coords(point, f->v[0]->u, f->v[1]->u, f->v[2]->u);
+}
+
+Vec3 get_barycentric_coords(const Vec2& point, const Vec2& u0, const Vec2& u1,
+							const Vec2& u2)
 {
 	// Compute vectors        
-	Vec2 v0 = f->v[0]->u - f->v[2]->u;
-	Vec2 v1 = f->v[1]->u - f->v[2]->u;
-	Vec2 v2 = point - f->v[2]->u;
+	Vec2 v0 = u0 - u2;
+	Vec2 v1 = u1 - u2;
+	Vec2 v2 = point - u2;
 	// Compute dot products
 	double dot00 = dot(v0, v0);
 	double dot01 = dot(v0, v1);
@@ -229,6 +235,11 @@ bool is_inside(const Vec2& point, const Face* f)
 {
 	Vec3 bary = get_barycentric_coords(point, f);
 	//printf("UV: %f, %f\n", u, v);
+	return is_inside(bary);
+}
+
+bool is_inside(const Vec3& bary)
+{
 	// Check if point is in triangle
 	// 10*epsilon: want to be robust for borders
 	return ((bary[0] >= -10 * EPSILON) && (bary[1] >= -10 * EPSILON) && (bary[2] >= -100 * EPSILON));
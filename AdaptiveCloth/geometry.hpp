@@ -47,6 +47,11 @@ double unsigned_ee_distance(const Vec3 &x0, const Vec3 &x1,
 							Vec3 *n, double *w);
 
 Vec3 get_barycentric_coords (const Vec2 &point, const Face *face);
+Vec3 get_barycentric_coords (const Vec2 &point, const Vec2 &u0,
+                              const Vec2 &u1, const Vec2 &u2);
+// whether barycentric coordinates lie in the triangle, up to the
+// tolerance get_enclosing_face uses
+bool is_inside (const Vec3 &bary);
 
 Face* get_enclosing_face (const Mesh& mesh, const Vec2& u,
                           Face *starting_face_hint = NULL);
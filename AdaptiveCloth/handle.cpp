@@ -32,7 +32,7 @@ using namespace std;
 static Vec3 directions[3] = { Vec3(1,0,0), Vec3(0,1,0), Vec3(0,0,1) };
 
 void add_position_constraints(const Node *node, const Vec3 &x, double stiff,
-							  vector<Constraint*> &cons);
+							  Constraints &cons);
 
 Transformation normalize(const Transformation &T)
 {
@@ -41,11 +41,11 @@ Transformation normalize(const Transformation &T)
 	return T1;
 }
 
-vector<Constraint*> NodeHandle::get_constraints(double t)
+void NodeHandle::get_constraints(double t, Constraints &cons)
 {
 	double s = strength(t);
 	if (!s)
-		return vector<Constraint*>();
+		return;
 	if (!activated)
 	{
 		// handle just got started, fill in its original position
@@ -53,17 +53,14 @@ vector<Constraint*> NodeHandle::get_constraints(double t)
 		activated = true;
 	}
 	Vec3 x = motion ? normalize(motion->pos(t)).apply(x0) : x0;
-	vector<Constraint*> cons;
 	add_position_constraints(node, x, s*::magic.handle_stiffness, cons);
-	return cons;
 }
 
-vector<Constraint*> CircleHandle::get_constraints(double t)
+void CircleHandle::get_constraints(double t, Constraints &cons)
 {
 	double s = strength(t);
 	if (!s)
-		return vector<Constraint*>();
-	vector<Constraint*> cons;
+		return;
 	for (int n = 0; n < mesh->nodes.size(); n++)
 	{
 		Node *node = mesh->nodes[n];
@@ -83,37 +80,32 @@ vector<Constraint*> CircleHandle::get_constraints(double t)
 		}
 		add_position_constraints(node, x, s*::magic.handle_stiffness*l, cons);
 	}
-	return cons;
 }
 
-vector<Constraint*> GlueHandle::get_constraints(double t)
+void GlueHandle::get_constraints(double t, Constraints &cons)
 {
 	double s = strength(t);
 	if (!s)
-		return vector<Constraint*>();
-	vector<Constraint*> cons;
+		return;
 	for (int i = 0; i < 3; i++)
 	{
-		GlueCon *con = new GlueCon;
+		GlueCon *con = cons.add_glue();
 		con->nodes[0] = nodes[0];
 		con->nodes[1] = nodes[1];
 		con->n = directions[i];
 		con->stiff = s * ::magic.handle_stiffness;
-		cons.push_back(con);
 	}
-	return cons;
 }
 
 void add_position_constraints(const Node *node, const Vec3 &x, double stiff,
-							  vector<Constraint*> &cons)
+							  Constraints &cons)
 {
 	for (int i = 0; i < 3; i++)
 	{
-		EqCon *con = new EqCon;
+		EqCon *con = cons.add_eq();
 		con->node = (Node*)node;
 		con->x = x;
 		con->n = directions[i];
 		con->stiff = stiff;
-		cons.push_back(con);
 	}
 }
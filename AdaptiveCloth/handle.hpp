@@ -35,7 +35,8 @@ struct Handle
 {
 	double start_time, end_time, fade_time;
 	virtual ~Handle() {};
-	virtual std::vector<Constraint*> get_constraints(double t) = 0;
+	// adds the constraints active at time t to cons
+	virtual void get_constraints(double t, Constraints &cons) = 0;
 	virtual std::vector<Node*> get_nodes() = 0;
 	bool active(double t) { return t >= start_time && t <= end_time; }
 	double strength(double t)
@@ -54,7 +55,7 @@ struct NodeHandle : public Handle
 	bool activated;
 	Vec3 x0;
 	NodeHandle() : activated(false) {}
-	std::vector<Constraint*> get_constraints(double t);
+	void get_constraints(double t, Constraints &cons);
 	std::vector<Node*> get_nodes() { return std::vector<Node*>(1, node); }
 };
 
@@ -66,14 +67,14 @@ struct CircleHandle : public Handle
 	double c; // circumference
 	Vec2 u;
 	Vec3 xc, dx0, dx1;
-	std::vector<Constraint*> get_constraints(double t);
+	void get_constraints(double t, Constraints &cons);
 	std::vector<Node*> get_nodes() { return std::vector<Node*>(); }
 };
 
 struct GlueHandle : public Handle
 {
 	Node* nodes[2];
-	std::vector<Constraint*> get_constraints(double t);
+	void get_constraints(double t, Constraints &cons);
 	std::vector<Node*> get_nodes()
 	{
 		std::vector<Node*> ns;
@@ -26,17 +26,13 @@
 
 #include "io.hpp"
 
-#include "display.hpp"
 #include "util.hpp"
 #include <cassert>
 #include <cfloat>
+#include <cstdarg>
+#include <cstdio>
 #include <json/json.h>
 #include <fstream>
-#include <png.h>
-#include <Windows.h>
-#include <GL/gl.h>
-#include <GL/glu.h>
-#include <GL/freeglut.h>
 
 #include <sstream>
 using namespace std;
@@ -253,63 +249,128 @@ vector<Face*> triangulate(const vector<Vert*> &verts)
 	return tris;
 }
 
-void save_obj(const Mesh &mesh, const string &filename)
+void capture_obj(ObjFrame &frame, const Mesh &mesh)
 {
-	fstream file(filename.c_str(), ios::out);
-	for (int v = 0; v < mesh.verts.size(); v++)
+	int nv = mesh.verts.size(), nn = mesh.nodes.size(),
+		ne = mesh.edges.size(), nf = mesh.faces.size();
+	frame.u.resize(nv);
+	frame.vert_labels.resize(nv);
+	for (int v = 0; v < nv; v++)
 	{
-		const Vert *vert = mesh.verts[v];
-		file << "vt " << vert->u[0] << " " << vert->u[1] << endl;
-		if (vert->label)
-			file << "vl " << vert->label << endl;
+		frame.u[v] = mesh.verts[v]->u;
+		frame.vert_labels[v] = mesh.verts[v]->label;
 	}
-	for (int n = 0; n < mesh.nodes.size(); n++)
+	frame.x.resize(nn);
+	frame.y.resize(nn);
+	frame.v.resize(nn);
+	frame.node_labels.resize(nn);
+	for (int n = 0; n < nn; n++)
 	{
 		const Node *node = mesh.nodes[n];
-		file << "v " << node->x[0] << " " << node->x[1] << " "
-			<< node->x[2] << endl;
-		if (norm2(node->x - node->y))
-			file << "ny " << node->y[0] << " " << node->y[1] << " "
-			<< node->y[2] << endl;
-		if (norm2(node->v))
-			file << "nv " << node->v[0] << " " << node->v[1] << " "
-			<< node->v[2] << endl;
-		if (node->label)
-			file << "nl " << node->label << endl;
+		frame.x[n] = node->x;
+		frame.y[n] = node->y;
+		frame.v[n] = node->v;
+		frame.node_labels[n] = node->label;
 	}
-	for (int e = 0; e < mesh.edges.size(); e++)
+	frame.edge_nodes.resize(ne * 2);
+	frame.edge_angles.resize(ne);
+	frame.edge_damage.resize(ne);
+	frame.edge_labels.resize(ne);
+	for (int e = 0; e < ne; e++)
 	{
 		const Edge *edge = mesh.edges[e];
-		if (edge->theta_ideal || edge->label)
-		{
-			file << "e " << edge->n[0]->index + 1 << " " << edge->n[1]->index + 1
-				<< endl;
-			if (edge->theta_ideal)
-				file << "ea " << edge->theta_ideal << endl;
-			if (edge->damage)
-				file << "ed " << edge->damage << endl;
-			if (edge->label)
-				file << "el " << edge->label << endl;
-		}
+		frame.edge_nodes[e * 2] = edge->n[0]->index;
+		frame.edge_nodes[e * 2 + 1] = edge->n[1]->index;
+		frame.edge_angles[e] = edge->theta_ideal;
+		frame.edge_damage[e] = edge->damage;
+		frame.edge_labels[e] = edge->label;
 	}
-	for (int f = 0; f < mesh.faces.size(); f++)
+	frame.face_nodes.resize(nf * 3);
+	frame.face_verts.resize(nf * 3);
+	frame.face_labels.resize(nf);
+	frame.face_S.resize(nf);
+	frame.face_damage.resize(nf);
+	for (int f = 0; f < nf; f++)
 	{
 		const Face *face = mesh.faces[f];
-		file << "f " << face->v[0]->node->index + 1 << "/" << face->v[0]->index + 1
-			<< " " << face->v[1]->node->index + 1 << "/" << face->v[1]->index + 1
-			<< " " << face->v[2]->node->index + 1 << "/" << face->v[2]->index + 1
-			<< endl;
-		if (face->label)
-			file << "tl " << face->label << endl;
-		if (norm2_F(face->S_plastic))
+		for (int i = 0; i < 3; i++)
 		{
-			const Mat2x2 &S = face->S_plastic;
-			file << "ts " << S(0, 0) << " " << S(0, 1) << " " << S(1, 0) << " "
-				<< S(1, 1) << endl;
+			frame.face_nodes[f * 3 + i] = face->v[i]->node->index;
+			frame.face_verts[f * 3 + i] = face->v[i]->index;
 		}
-		if (face->damage)
-			file << "td " << face->damage << endl;
+		frame.face_labels[f] = face->label;
+		frame.face_S[f] = face->S_plastic;
+		frame.face_damage[f] = face->damage;
+	}
+}
+
+// printf into the end of out
+static void append(string &out, const char *format, ...)
+{
+	char line[256];
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	out.append(line, min(n, (int)sizeof(line) - 1));
+}
+
+void encode_obj(const ObjFrame &frame, string &out)
+{
+	// %g matches what the ostream operators write by default
+	for (int v = 0; v < frame.u.size(); v++)
+	{
+		append(out, "vt %g %g\n", frame.u[v][0], frame.u[v][1]);
+		if (frame.vert_labels[v])
+			append(out, "vl %d\n", frame.vert_labels[v]);
 	}
+	for (int n = 0; n < frame.x.size(); n++)
+	{
+		const Vec3 &x = frame.x[n], &y = frame.y[n], &v = frame.v[n];
+		append(out, "v %g %g %g\n", x[0], x[1], x[2]);
+		if (norm2(x - y))
+			append(out, "ny %g %g %g\n", y[0], y[1], y[2]);
+		if (norm2(v))
+			append(out, "nv %g %g %g\n", v[0], v[1], v[2]);
+		if (frame.node_labels[n])
+			append(out, "nl %d\n", frame.node_labels[n]);
+	}
+	for (int e = 0; e < frame.edge_labels.size(); e++)
+	{
+		if (!frame.edge_angles[e] && !frame.edge_labels[e])
+			continue;
+		append(out, "e %d %d\n", frame.edge_nodes[e * 2] + 1,
+			   frame.edge_nodes[e * 2 + 1] + 1);
+		if (frame.edge_angles[e])
+			append(out, "ea %g\n", frame.edge_angles[e]);
+		if (frame.edge_damage[e])
+			append(out, "ed %g\n", frame.edge_damage[e]);
+		if (frame.edge_labels[e])
+			append(out, "el %d\n", frame.edge_labels[e]);
+	}
+	for (int f = 0; f < frame.face_labels.size(); f++)
+	{
+		const int *n = &frame.face_nodes[f * 3], *v = &frame.face_verts[f * 3];
+		append(out, "f %d/%d %d/%d %d/%d\n", n[0] + 1, v[0] + 1, n[1] + 1,
+			   v[1] + 1, n[2] + 1, v[2] + 1);
+		if (frame.face_labels[f])
+			append(out, "tl %d\n", frame.face_labels[f]);
+		const Mat2x2 &S = frame.face_S[f];
+		if (norm2_F(S))
+			append(out, "ts %g %g %g %g\n", S(0, 0), S(0, 1), S(1, 0), S(1, 1));
+		if (frame.face_damage[f])
+			append(out, "td %g\n", frame.face_damage[f]);
+	}
+}
+
+void save_obj(const Mesh &mesh, const string &filename)
+{
+	ObjFrame frame;
+	capture_obj(frame, mesh);
+	string text;
+	encode_obj(frame, text);
+	fstream file(filename.c_str(), ios::out);
+	file.write(text.data(), text.size());
 }
 
 void save_objs(const vector<Mesh*> &meshes, const string &prefix)
@@ -37,4 +37,24 @@ void load_objs (std::vector<Mesh*> &meshes, const std::string &prefix);
 void save_obj (const Mesh &mesh, const std::string &filename);
 void save_objs (const std::vector<Mesh*> &meshes, const std::string &prefix);
 
+// Everything save_obj writes of a mesh, copied out of it so that it can be
+// formatted away from the mesh; capture_obj reuses the vectors' storage.
+struct ObjFrame
+{
+	std::vector<Vec2> u;
+	std::vector<int> vert_labels;
+	std::vector<Vec3> x, y, v;
+	std::vector<int> node_labels;
+	std::vector<int> edge_nodes; // 2 per edge
+	std::vector<double> edge_angles, edge_damage;
+	std::vector<int> edge_labels;
+	std::vector<int> face_nodes, face_verts; // 3 per face
+	std::vector<int> face_labels;
+	std::vector<Mat2x2> face_S;
+	std::vector<double> face_damage;
+};
+void capture_obj (ObjFrame &frame, const Mesh &mesh);
+// appends the obj text of frame to out
+void encode_obj (const ObjFrame &frame, std::string &out);
+
 #endif
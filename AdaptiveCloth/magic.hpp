@@ -26,6 +26,8 @@
 
 #pragma once
 
+#include <string>
+
 // Magic numbers and other hacks
 
 struct Magic
@@ -38,6 +40,18 @@ struct Magic
 	bool combine_tensors;
 	bool preserve_creases;
 	bool enable_remeshing;
+	// implicit step linear solver
+	std::string linear_solver;		// "taucs" (direct) or "pcg"
+	std::string pcg_preconditioner; // "jacobi" or "ic0"
+	double pcg_tolerance;			// relative residual
+	int pcg_max_iterations;
+	// inner solver of augmented_lagrangian_method
+	std::string auglag_solver; // "lbfgs" or "cg"
+	// strain limit only around violating faces, see local_strain_limiting
+	bool local_strain_limiting;
+	// reuse proximity candidates across steps, see ProximityTracker
+	bool proximity_tracking;
+	double proximity_slack; // node motion allowed before a region is requeried
 
 	Magic() :
 		enable_remeshing(false),
@@ -49,7 +63,15 @@ struct Magic
 		edge_flip_threshold(1e-2),
 		rib_stiffening(1),
 		combine_tensors(true),
-		preserve_creases(false)
+		preserve_creases(false),
+		linear_solver("taucs"),
+		pcg_preconditioner("ic0"),
+		pcg_tolerance(1e-6),
+		pcg_max_iterations(1000),
+		auglag_solver("lbfgs"),
+		local_strain_limiting(false),
+		proximity_tracking(false),
+		proximity_slack(1e-3)
 	{
 	}
 };
@@ -271,6 +271,87 @@ const vector<Edge *> &get(const Mesh &mesh) { return mesh.edges; }
 template <>
 const vector<Face *> &get(const Mesh &mesh) { return mesh.faces; }
 
+// Global indexing
+
+template <typename Prim>
+static void index_prims(const vector<Mesh *> &meshes, vector<Prim *> &all,
+						vector<int> &offsets,
+						unordered_map<const void *, MeshIndex::Slot> &slots)
+{
+	all.clear();
+	offsets.resize(meshes.size() + 1);
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		const vector<Prim *> &ps = get<Prim>(*meshes[m]);
+		offsets[m] = all.size();
+		for (int p = 0; p < ps.size(); p++)
+		{
+			MeshIndex::Slot slot = {m, (int)all.size()};
+			slots[ps[p]] = slot;
+			all.push_back(ps[p]);
+		}
+	}
+	offsets[meshes.size()] = all.size();
+}
+
+bool MeshIndex::update(const vector<Mesh *> &meshes)
+{
+	bool same = this->meshes.size() == meshes.size();
+	for (int m = 0; m < meshes.size() && same; m++)
+		same = this->meshes[m] == meshes[m] && topology[m] == meshes[m]->topology;
+	if (same)
+		return false;
+	this->meshes.assign(meshes.begin(), meshes.end());
+	topology.resize(meshes.size());
+	for (int m = 0; m < meshes.size(); m++)
+		topology[m] = meshes[m]->topology;
+	slots.clear();
+	index_prims(meshes, verts, offsets[0], slots);
+	index_prims(meshes, nodes, offsets[1], slots);
+	index_prims(meshes, edges, offsets[2], slots);
+	index_prims(meshes, faces, offsets[3], slots);
+	return true;
+}
+
+void MeshIndex::clear()
+{
+	meshes.clear();
+	topology.clear();
+	verts.clear();
+	nodes.clear();
+	edges.clear();
+	faces.clear();
+	for (int i = 0; i < 4; i++)
+		offsets[i].clear();
+	slots.clear();
+}
+
+void MeshIndex::get_positions(vector<Vec3> &xs) const
+{
+	xs.resize(nodes.size());
+	for (int n = 0; n < nodes.size(); n++)
+		xs[n] = nodes[n]->x;
+}
+
+void MeshIndex::set_positions(const vector<Vec3> &xs) const
+{
+	for (int n = 0; n < nodes.size(); n++)
+		nodes[n]->x = xs[n];
+}
+
+void MeshIndex::get_velocities(vector<Vec3> &vs) const
+{
+	vs.resize(nodes.size());
+	for (int n = 0; n < nodes.size(); n++)
+		vs[n] = nodes[n]->v;
+}
+
+void MeshIndex::set_velocities(const vector<Vec3> &vs) const
+{
+	for (int n = 0; n < nodes.size(); n++)
+		nodes[n]->v = vs[n];
+}
+
 Edge *get_edge(const Node *n0, const Node *n1)
 {
 	for (int e = 0; e < n0->adje.size(); e++)
@@ -310,8 +391,11 @@ void connect(Vert *vert, Node *node)
 	include(vert, node->verts);
 }
 
+static int topology_stamp = 0;
+
 void Mesh::add(Vert *vert)
 {
+	topology = ++::topology_stamp;
 	verts.push_back(vert);
 	vert->node = NULL;
 	vert->adjf.clear();
@@ -320,6 +404,7 @@ void Mesh::add(Vert *vert)
 
 void Mesh::remove(Vert *vert)
 {
+	topology = ++::topology_stamp;
 	if (!vert->adjf.empty())
 	{
 		cout << "Error: can't delete vert " << vert << " as it still has "
@@ -331,6 +416,7 @@ void Mesh::remove(Vert *vert)
 
 void Mesh::add(Node *node)
 {
+	topology = ++::topology_stamp;
 	nodes.push_back(node);
 	node->preserve = false;
 	node->index = nodes.size() - 1;
@@ -341,6 +427,7 @@ void Mesh::add(Node *node)
 
 void Mesh::remove(Node *node)
 {
+	topology = ++::topology_stamp;
 	if (!node->adje.empty())
 	{
 		cout << "Error: can't delete node " << node << " as it still has "
@@ -352,6 +439,7 @@ void Mesh::remove(Node *node)
 
 void Mesh::add(Edge *edge)
 {
+	topology = ++::topology_stamp;
 	edges.push_back(edge);
 	edge->adjf[0] = edge->adjf[1] = NULL;
 	edge->index = edges.size() - 1;
@@ -361,6 +449,7 @@ void Mesh::add(Edge *edge)
 
 void Mesh::remove(Edge *edge)
 {
+	topology = ++::topology_stamp;
 	if (edge->adjf[0] || edge->adjf[1])
 	{
 		cout << "Error: can't delete edge " << edge
@@ -384,6 +473,7 @@ void add_edges_if_needed(Mesh &mesh, const Face *face)
 
 void Mesh::add(Face *face)
 {
+	topology = ++::topology_stamp;
 	faces.push_back(face);
 	face->index = faces.size() - 1;
 	// adjacency
@@ -401,6 +491,7 @@ void Mesh::add(Face *face)
 
 void Mesh::remove(Face *face)
 {
+	topology = ++::topology_stamp;
 	exclude(face, faces);
 	// adjacency
 	for (int i = 0; i < 3; i++)
@@ -29,6 +29,7 @@
 
 #include "transformation.hpp"
 #include "vectors.hpp"
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -151,6 +152,7 @@ struct Mesh
 	std::vector<Node *> nodes;
 	std::vector<Edge *> edges;
 	std::vector<Face *> faces;
+	int topology = 0; // restamped by every add/remove, keys cached sparsity
 	// These do *not* assume ownership, so no deletion on removal
 	void add(Vert *vert);
 	void add(Node *node);
@@ -165,6 +167,60 @@ struct Mesh
 template <typename Prim>
 const std::vector<Prim *> &get(const Mesh &mesh);
 
+// Global numbering of the primitives of a list of meshes, those of mesh m
+// following those of meshes 0..m-1. update() rebuilds the tables only when
+// the list or a mesh's topology stamp has changed; lookups either way are
+// then constant-time.
+struct MeshIndex
+{
+	std::vector<const Mesh *> meshes;
+	std::vector<int> topology; // Mesh::topology when built
+	// all primitives in global order, and each mesh's offset into them
+	std::vector<Vert *> verts;
+	std::vector<Node *> nodes;
+	std::vector<Edge *> edges;
+	std::vector<Face *> faces;
+	std::vector<int> offsets[4]; // verts, nodes, edges, faces
+	struct Slot
+	{
+		int mesh, index;
+	};
+	std::unordered_map<const void *, Slot> slots; // of every primitive
+	// returns whether the tables were rebuilt
+	bool update(const std::vector<Mesh *> &meshes);
+	void clear();
+	template <typename Prim> const std::vector<Prim *> &all() const;
+	template <typename Prim> int size() const { return all<Prim>().size(); }
+	template <typename Prim> Prim *get(int i) const { return all<Prim>()[i]; }
+	template <typename Prim> int offset(int m) const;
+	// global index of p, or -1 if none of the meshes holds it
+	template <typename Prim> int index(const Prim *p) const
+	{
+		std::unordered_map<const void *, Slot>::const_iterator it = slots.find(p);
+		return it == slots.end() ? -1 : it->second.index;
+	}
+	// position of the mesh holding p in the list, or -1
+	template <typename Prim> int mesh(const Prim *p) const
+	{
+		std::unordered_map<const void *, Slot>::const_iterator it = slots.find(p);
+		return it == slots.end() ? -1 : it->second.mesh;
+	}
+	// node positions and velocities as flat arrays in global order
+	void get_positions(std::vector<Vec3> &xs) const;
+	void set_positions(const std::vector<Vec3> &xs) const;
+	void get_velocities(std::vector<Vec3> &vs) const;
+	void set_velocities(const std::vector<Vec3> &vs) const;
+};
+
+template <> inline const std::vector<Vert *> &MeshIndex::all() const { return verts; }
+template <> inline const std::vector<Node *> &MeshIndex::all() const { return nodes; }
+template <> inline const std::vector<Edge *> &MeshIndex::all() const { return edges; }
+template <> inline const std::vector<Face *> &MeshIndex::all() const { return faces; }
+template <> inline int MeshIndex::offset<Vert>(int m) const { return offsets[0][m]; }
+template <> inline int MeshIndex::offset<Node>(int m) const { return offsets[1][m]; }
+template <> inline int MeshIndex::offset<Edge>(int m) const { return offsets[2][m]; }
+template <> inline int MeshIndex::offset<Face>(int m) const { return offsets[3][m]; }
+
 void connect(Vert *vert, Node *node); // assign vertex to node
 
 bool check_that_pointers_are_sane(const Mesh &mesh);
@@ -54,8 +54,16 @@ Vec3 nearest_point(const Vec3 &x, const vector<AccelStruct*> &accs,
 vector<Plane> nearest_obstacle_planes(const Mesh &mesh,
 									  const vector<Mesh*> &obs_meshes)
 {
-	const double dmin = 10 * ::magic.repulsion_thickness;
 	vector<AccelStruct*> obs_accs = create_accel_structs(obs_meshes, false);
+	vector<Plane> planes = nearest_obstacle_planes(mesh, obs_accs);
+	destroy_accel_structs(obs_accs);
+	return planes;
+}
+
+vector<Plane> nearest_obstacle_planes(const Mesh &mesh,
+									  const vector<AccelStruct*> &obs_accs)
+{
+	const double dmin = 10 * ::magic.repulsion_thickness;
 	vector<Plane> planes(mesh.nodes.size(), make_pair(Vec3(0), Vec3(0)));
 #pragma omp parallel for
 	for (int n = 0; n < mesh.nodes.size(); n++)
@@ -65,7 +73,6 @@ vector<Plane> nearest_obstacle_planes(const Mesh &mesh,
 		if (p != x)
 			planes[n] = make_pair(p, normalize(x - p));
 	}
-	destroy_accel_structs(obs_accs);
 	return planes;
 }
 
@@ -76,15 +83,15 @@ struct NearPoint
 	NearPoint(double d, const Vec3 &x) : d(d), x(x) {}
 };
 
-void update_nearest_point(const Vec3 &x, BVHNode *node, NearPoint &p);
+void update_nearest_point(const Vec3 &x, const BVHTree &tree, NearPoint &p);
 
 Vec3 nearest_point(const Vec3 &x, const vector<AccelStruct*> &accs,
 				   double dmin)
 {
 	NearPoint p(dmin, x);
 	for (int a = 0; a < accs.size(); a++)
-		if (accs[a]->root)
-			update_nearest_point(x, accs[a]->root, p);
+		if (!accs[a]->tree.empty())
+			update_nearest_point(x, accs[a]->tree, p);
 	return p.x;
 }
 
@@ -92,17 +99,24 @@ void update_nearest_point(const Vec3 &x, const Face *face, NearPoint &p);
 
 double point_box_distance(const Vec3 &x, const BOX &box);
 
-void update_nearest_point(const Vec3 &x, BVHNode *node, NearPoint &p)
+void update_nearest_point(const Vec3 &x, const BVHTree &tree, NearPoint &p)
 {
-	if (node->isLeaf())
-		update_nearest_point(x, node->getFace(), p);
-	else
+	// the tree depth is at most 30 Morton bits plus log2 of the face count
+	int stack[64], top = 0;
+	stack[top++] = tree.getRoot();
+	while (top > 0)
 	{
-		double d = point_box_distance(x, node->_box);
-		if (d >= p.d)
-			return;
-		update_nearest_point(x, node->getLeftChild(), p);
-		update_nearest_point(x, node->getRightChild(), p);
+		int node = stack[--top];
+		if (tree.isLeaf(node))
+			update_nearest_point(x, tree.getFace(node), p);
+		else
+		{
+			double d = point_box_distance(x, tree._box[node]);
+			if (d >= p.d)
+				continue;
+			stack[top++] = tree.getRightChild(node);
+			stack[top++] = tree.getLeftChild(node);
+		}
 	}
 }
 
@@ -33,4 +33,9 @@ typedef std::pair<Vec3, Vec3> Plane;
 
 std::vector<Plane> nearest_obstacle_planes(const Mesh &mesh, const std::vector<Mesh*> &obs_meshes);
 
+struct AccelStruct;
+
+// same, using non-ccd obstacle accel structs kept by the caller
+std::vector<Plane> nearest_obstacle_planes(const Mesh &mesh, const std::vector<AccelStruct*> &obs_accs);
+
 #endif
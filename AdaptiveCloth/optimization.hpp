@@ -27,6 +27,7 @@
 #ifndef OPTIMIZATION_HPP
 #define OPTIMIZATION_HPP
 
+#include <vector>
 #include "sparse.hpp"
 #include "vectors.hpp"
 
@@ -59,6 +60,14 @@ struct NLConOpt
 	virtual void con_grad(const double *x, int j, double factor,
 						  double *grad) const = 0; // add factor*gradient
 	virtual void finalize(const double *x) const = 0;
+	// Constraints [first, ncon) mean the same thing in every problem with
+	// the same key, so their multipliers may carry over between runs;
+	// returns first, or ncon if none can.
+	virtual int warm_constraints(std::vector<int> &key) const
+	{
+		key.clear();
+		return ncon;
+	}
 };
 
 // Algorithms
@@ -85,7 +94,36 @@ void line_search_newtons_method(const NLOpt &problem,
 								OptOptions opts = OptOptions(),
 								bool verbose = false);
 
+// inner minimizations use magic.auglag_solver: native L-BFGS ("lbfgs") or
+// alglib's nonlinear CG ("cg")
+void augmented_lagrangian_method(const NLConOpt &problem,
+								 OptOptions opts = OptOptions(),
+								 bool verbose = false);
+
+// Multipliers, penalty and per-thread scratch of augmented_lagrangian_method.
+// The method keeps no other state, so runs on distinct contexts (and
+// problems touching distinct data) may proceed on different threads.
+// With warm_start, a run starts the problem's warm_constraints from the
+// multipliers left by the previous run if their key is unchanged, and every
+// other constraint from zero. The counters accumulate over runs.
+struct AugLagContext
+{
+	std::vector<double> lambda;
+	double mu;
+	bool warm_start;
+	std::vector<int> warm_key; // of the previous run's warm constraints
+	int warm_first;			   // index of the first of them in lambda
+	std::vector<double> values;				  // per-thread penalty sums
+	std::vector<std::vector<double> > grads; // per-thread penalty gradients
+	int outer_iterations, inner_iterations, evaluations;
+	AugLagContext() : mu(0), warm_start(false), warm_first(0),
+					  outer_iterations(0),
+					  inner_iterations(0), evaluations(0) {}
+};
+
+// same, keeping its state in context, whose scratch is reused across calls
 void augmented_lagrangian_method(const NLConOpt &problem,
+								 AugLagContext &context,
 								 OptOptions opts = OptOptions(),
 								 bool verbose = false);
 
@@ -0,0 +1,177 @@
+/*************************************************************************
+***************************    ARCSim_PCG    *****************************
+*************************************************************************/
+
+#include "pcg.hpp"
+#include <cmath>
+
+using namespace std;
+
+static bool cholesky(const Mat3x3 &A, Mat3x3 &L)
+{
+	L = Mat3x3(0);
+	for (int j = 0; j < 3; j++)
+	{
+		double d = A(j, j);
+		for (int k = 0; k < j; k++)
+			d -= sq(L(j, k));
+		if (!(d > 0))
+			return false;
+		L(j, j) = sqrt(d);
+		for (int i = j + 1; i < 3; i++)
+		{
+			double s = A(i, j);
+			for (int k = 0; k < j; k++)
+				s -= L(i, k) * L(j, k);
+			L(i, j) = s / L(j, j);
+		}
+	}
+	return true;
+}
+
+static void setup_jacobi(const BlockSpMat &A, vector<Mat3x3> &inv)
+{
+	inv.resize(A.n);
+	for (int i = 0; i < A.n; i++)
+		inv[i] = inverse(A.blocks[A.diag[i]]);
+}
+
+// block IC(0): L_ij = (A_ij - sum_{k<j} L_ik L_jk^T) L_jj^-T on the lower
+// pattern of A; inv holds L_ii^-1. Fails if a pivot block is not SPD.
+static bool setup_ic0(const BlockSpMat &A, vector<Mat3x3> &L,
+					  vector<Mat3x3> &inv)
+{
+	L.resize(A.blocks.size());
+	inv.resize(A.n);
+	for (int i = 0; i < A.n; i++)
+	{
+		for (int s = A.rowptr[i]; s <= A.diag[i]; s++)
+		{
+			int j = A.colind[s];
+			Mat3x3 S = A.blocks[s];
+			// merge rows i and j over columns k < j
+			int si = A.rowptr[i], sj = A.rowptr[j];
+			while (si < s && sj < A.diag[j])
+			{
+				int ki = A.colind[si], kj = A.colind[sj];
+				if (ki == kj)
+					S -= L[si++] * L[sj++].t();
+				else if (ki < kj)
+					si++;
+				else
+					sj++;
+			}
+			if (j < i)
+				L[s] = S * inv[j].t();
+			else
+			{
+				if (!cholesky(S, L[s]))
+					return false;
+				inv[i] = inverse(L[s]);
+			}
+		}
+	}
+	return true;
+}
+
+static void apply_ic0(const BlockSpMat &A, const vector<Mat3x3> &L,
+					  const vector<Mat3x3> &inv, const vector<Vec3> &r,
+					  vector<Vec3> &z)
+{
+	// L y = r
+	for (int i = 0; i < A.n; i++)
+	{
+		Vec3 y = r[i];
+		for (int s = A.rowptr[i]; s < A.diag[i]; s++)
+			y -= L[s] * z[A.colind[s]];
+		z[i] = inv[i] * y;
+	}
+	// L^T z = y, column-oriented over the rows of L
+	for (int i = A.n - 1; i >= 0; i--)
+	{
+		z[i] = inv[i].t() * z[i];
+		for (int s = A.rowptr[i]; s < A.diag[i]; s++)
+			z[A.colind[s]] -= L[s].t() * z[i];
+	}
+}
+
+static void multiply(const BlockSpMat &A, const vector<Vec3> &x,
+					 vector<Vec3> &y)
+{
+#pragma omp parallel for
+	for (int i = 0; i < A.n; i++)
+	{
+		Vec3 yi = Vec3(0);
+		for (int s = A.rowptr[i]; s < A.rowptr[i + 1]; s++)
+			yi += A.blocks[s] * x[A.colind[s]];
+		y[i] = yi;
+	}
+}
+
+static double dot(const vector<Vec3> &a, const vector<Vec3> &b)
+{
+	double d = 0;
+	for (int i = 0; i < a.size(); i++)
+		d += dot(a[i], b[i]);
+	return d;
+}
+
+vector<Vec3> PcgSolver::solve(const BlockSpMat &A, const vector<Vec3> &b,
+							  Preconditioner precond, double tolerance,
+							  int max_iterations)
+{
+	int n = A.n;
+	if (topology != A.topology || x.size() != n)
+		x.assign(n, Vec3(0));
+	topology = A.topology;
+	fallback = false;
+	if (precond == IncompleteCholesky && !setup_ic0(A, L, inv))
+		fallback = true;
+	if (precond == BlockJacobi || fallback)
+		setup_jacobi(A, inv);
+	bool use_ic0 = precond == IncompleteCholesky && !fallback;
+	solves++;
+
+	vector<Vec3> r(n), z(n), p(n), q(n);
+	multiply(A, x, q);
+	for (int i = 0; i < n; i++)
+		r[i] = b[i] - q[i];
+	double bnorm = sqrt(dot(b, b));
+	if (bnorm == 0)
+	{
+		x.assign(n, Vec3(0));
+		iterations = 0;
+		residual = 0;
+		return x;
+	}
+	double rz = 0;
+	for (iterations = 0; iterations < max_iterations; iterations++)
+	{
+		residual = sqrt(dot(r, r)) / bnorm;
+		if (residual <= tolerance)
+			break;
+		if (use_ic0)
+			apply_ic0(A, L, inv, r, z);
+		else
+			for (int i = 0; i < n; i++)
+				z[i] = inv[i] * r[i];
+		double rz_new = dot(r, z);
+		if (iterations == 0)
+			p = z;
+		else
+			for (int i = 0; i < n; i++)
+				p[i] = z[i] + (rz_new / rz) * p[i];
+		rz = rz_new;
+		multiply(A, p, q);
+		double alpha = rz / dot(p, q);
+		for (int i = 0; i < n; i++)
+		{
+			x[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+		}
+	}
+	if (iterations == max_iterations)
+		residual = sqrt(dot(r, r)) / bnorm;
+	total_iterations += iterations;
+	return x;
+}
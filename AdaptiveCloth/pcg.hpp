@@ -0,0 +1,34 @@
+/*************************************************************************
+***************************    ARCSim_PCG    *****************************
+*************************************************************************/
+#pragma once
+
+#include "blocksparse.hpp"
+#include "vectors.hpp"
+#include <vector>
+
+// Preconditioned conjugate gradients on a symmetric BlockSpMat, as an
+// alternative to the direct TAUCS path. Warm-starts from the previous
+// solution while the mesh topology is unchanged.
+struct PcgSolver
+{
+	enum Preconditioner
+	{
+		BlockJacobi,		// inverse of the 3x3 diagonal blocks
+		IncompleteCholesky, // block IC(0) on the pattern of A
+	};
+	int topology;			 // BlockSpMat::topology of the warm start
+	std::vector<Vec3> x;	 // last solution
+	std::vector<Mat3x3> L;	 // IC(0) factor, indexed like A.blocks
+	std::vector<Mat3x3> inv; // inverse diagonal (factor) blocks
+	// statistics of the last solve, and totals
+	int iterations;
+	double residual; // relative to |b|
+	bool fallback;	 // IC(0) broke down, block Jacobi was used instead
+	int solves, total_iterations;
+	PcgSolver() : topology(-1), iterations(0), residual(0), fallback(false),
+				  solves(0), total_iterations(0) {}
+	std::vector<Vec3> solve(const BlockSpMat &A, const std::vector<Vec3> &b,
+							Preconditioner precond, double tolerance,
+							int max_iterations);
+};
@@ -28,6 +28,7 @@
 
 #include "blockvectors.hpp"
 #include "collisionutil.hpp"
+#include "magic.hpp"
 #include "sparse.hpp"
 #include "taucs.hpp"
 
@@ -35,8 +36,6 @@ using namespace std;
 
 static const bool verbose = false;
 
-static const vector<Cloth::Material *> *materials;
-
 typedef Mat<9, 9> Mat9x9;
 typedef Mat<9, 6> Mat9x6;
 typedef Mat<6, 6> Mat6x6;
@@ -79,25 +78,27 @@ Mat<1, n> rowmat(const Vec<n> &v)
 }
 
 template <Space s>
-double stretching_energy(const Face *face)
+double stretching_energy(const Face *face,
+						 const vector<Cloth::Material *> &materials)
 {
 	Mat3x2 F = derivative(pos<s>(face->v[0]->node), pos<s>(face->v[1]->node),
 						  pos<s>(face->v[2]->node), face);
 	Mat2x2 G = (F.t() * F - Mat2x2(1)) / 2.;
-	Vec4 k = stretching_stiffness(G, (*::materials)[face->label]->stretching);
-	double weakening = (*::materials)[face->label]->weakening;
+	Vec4 k = stretching_stiffness(G, materials[face->label]->stretching);
+	double weakening = materials[face->label]->weakening;
 	k *= 1 / (1 + weakening * face->damage);
 	return face->a * (k[0] * sq(G(0, 0)) + k[2] * sq(G(1, 1)) + 2 * k[1] * G(0, 0) * G(1, 1) + k[3] * sq(G(0, 1))) / 2.;
 }
 
 template <Space s>
-pair<Mat9x9, Vec9> stretching_force(const Face *face)
+pair<Mat9x9, Vec9> stretching_force(const Face *face,
+								   const vector<Cloth::Material *> &materials)
 {
 	Mat3x2 F = derivative(pos<s>(face->v[0]->node), pos<s>(face->v[1]->node),
 						  pos<s>(face->v[2]->node), face);
 	Mat2x2 G = (F.t() * F - Mat2x2(1)) / 2.;
-	Vec4 k = stretching_stiffness(G, (*::materials)[face->label]->stretching);
-	double weakening = (*::materials)[face->label]->weakening;
+	Vec4 k = stretching_stiffness(G, materials[face->label]->stretching);
+	double weakening = materials[face->label]->weakening;
 	k *= 1 / (1 + weakening * face->damage);
 	// eps = 1/2(F'F - I) = 1/2([x_u^2 & x_u x_v \\ x_u x_v & x_v^2] - I)
 	// e = 1/2 k0 eps00^2 + k1 eps00 eps11 + 1/2 k2 eps11^2 + k3 eps01^2
@@ -120,7 +121,8 @@ typedef Mat<12, 12> Mat12x12;
 typedef Vec<12> Vec12;
 
 template <Space s>
-double bending_energy(const Edge *edge)
+double bending_energy(const Edge *edge,
+					  const vector<Cloth::Material *> &materials)
 {
 	const Face *face0 = edge->adjf[0];
 	const Face *face1 = edge->adjf[1];
@@ -132,13 +134,13 @@ double bending_energy(const Edge *edge)
 
 	double a = face0->a + face1->a;
 
-	const BendingData &bend0 = (*::materials)[face0->label]->bending;
-	const BendingData &bend1 = (*::materials)[face1->label]->bending;
+	const BendingData &bend0 = materials[face0->label]->bending;
+	const BendingData &bend1 = materials[face1->label]->bending;
 
 	double ke = min(bending_stiffness(edge, 0, bend0),
 					bending_stiffness(edge, 1, bend1));
 
-	double weakening = max((*::materials)[face0->label]->weakening, (*::materials)[face1->label]->weakening);
+	double weakening = max(materials[face0->label]->weakening, materials[face1->label]->weakening);
 
 	ke *= 1 / (1 + weakening * edge->damage);
 
@@ -172,14 +174,26 @@ double cot_vec(const Vec3 &v0, const Vec3 &v1)
 }
 typedef Mat<3, 12> Mat3x12;
 std::vector<Mat12x12> gQBendingHessianArray = {};
-static std::vector<bool> gQBendingCalced = {};
+static std::vector<char> gQBendingCalced = {};
+
+// must be called before the (parallel) force loops so that they only
+// ever touch their own edge's entry
+static void reserve_qbending_cache(const Mesh &mesh)
+{
+	if (gQBendingHessianArray.size() < mesh.edges.size())
+	{
+		gQBendingHessianArray.resize(mesh.edges.size());
+		gQBendingCalced.resize(mesh.edges.size(), false);
+	}
+}
 template <Space s>
-pair<Mat12x12, Vec12> bending_force_qbending(const Edge *edge)
+pair<Mat12x12, Vec12> bending_force_qbending(const Edge *edge,
+											 const vector<Cloth::Material *> &materials)
 {
 	// 1. calculate the bs of edge
 	const Face *face0 = edge->adjf[0], *face1 = edge->adjf[1];
-	const BendingData &bend0 = (*::materials)[face0->label]->bending,
-					  &bend1 = (*::materials)[face1->label]->bending;
+	const BendingData &bend0 = materials[face0->label]->bending,
+					  &bend1 = materials[face1->label]->bending;
 	double bs = std::min(bending_stiffness(edge, 0, bend0),
 						 bending_stiffness(edge, 1, bend1));
 	Mat12x12 hessian;
@@ -196,10 +210,8 @@ pair<Mat12x12, Vec12> bending_force_qbending(const Edge *edge)
 		 x3 = pos<s>(v3);
 	Vec12 x_vec = mat_to_vec(Mat3x4(x0, x1, x2, x3));
 	// not avaliable, begin to calc
-	if (gQBendingHessianArray.size() <= edge->index || gQBendingCalced[edge->index] == false)
+	if (!gQBendingCalced[edge->index])
 	{
-		gQBendingHessianArray.resize(edge->index + 1);
-		gQBendingCalced.resize(edge->index + 1);
 		gQBendingCalced[edge->index] = true;
 		// 2.2 get e0, e1, e2, e3
 		/*
@@ -255,7 +267,8 @@ pair<Mat12x12, Vec12> bending_force_qbending(const Edge *edge)
 }
 
 template <Space s>
-pair<Mat12x12, Vec12> bending_force_dihedral(const Edge *edge)
+pair<Mat12x12, Vec12> bending_force_dihedral(const Edge *edge,
+											 const vector<Cloth::Material *> &materials)
 {
 	const Face *face0 = edge->adjf[0], *face1 = edge->adjf[1];
 	if (!face0 || !face1)
@@ -274,12 +287,12 @@ pair<Mat12x12, Vec12> bending_force_dihedral(const Edge *edge)
 									 -(w_f0[1] * n0 / h0 + w_f1[1] * n1 / h1),
 									 n0 / h0,
 									 n1 / h1));
-	const BendingData &bend0 = (*::materials)[face0->label]->bending,
-					  &bend1 = (*::materials)[face1->label]->bending;
+	const BendingData &bend0 = materials[face0->label]->bending,
+					  &bend1 = materials[face1->label]->bending;
 	double ke = min(bending_stiffness(edge, 0, bend0),
 					bending_stiffness(edge, 1, bend1));
-	double weakening = max((*::materials)[face0->label]->weakening,
-						   (*::materials)[face1->label]->weakening);
+	double weakening = max(materials[face0->label]->weakening,
+						   materials[face1->label]->weakening);
 	ke *= 1 / (1 + weakening * edge->damage);
 	double shape = sq(edge->l) / (2 * a);
 
@@ -297,15 +310,16 @@ pair<Mat12x12, Vec12> bending_force_dihedral(const Edge *edge)
 bool gUseQBending = false;
 
 template <Space s>
-pair<Mat12x12, Vec12> bending_force(const Edge *edge)
+pair<Mat12x12, Vec12> bending_force(const Edge *edge,
+									const vector<Cloth::Material *> &materials)
 {
 	if (gUseQBending == true)
 	{
-		return bending_force_qbending<s>(edge);
+		return bending_force_qbending<s>(edge, materials);
 	}
 	else
 	{
-		return bending_force_dihedral<s>(edge);
+		return bending_force_dihedral<s>(edge, materials);
 	}
 }
 
@@ -336,6 +350,14 @@ void add_submat(const Mat<m * 3, m * 3> &Asub, const Vec<m, int> &ix, SpMat<Mat3
 			A(ix[i], ix[j]) += submat3(Asub, i, j);
 }
 
+template <int m>
+void add_submat(const Mat<m * 3, m * 3> &Asub, const Vec<m * m, int> &slots, BlockSpMat &A)
+{
+	for (int i = 0; i < m; i++)
+		for (int j = 0; j < m; j++)
+			A.blocks[slots[i * m + j]] += submat3(Asub, i, j);
+}
+
 template <int m>
 void add_subvec(const Vec<m * 3> &bsub, const Vec<m, int> &ix, vector<Vec3> &b)
 {
@@ -370,18 +392,17 @@ template <Space s>
 double internal_energy(const Cloth &cloth)
 {
 	const Mesh &mesh = cloth.mesh;
-	::materials = &cloth.materials;
 
 	double E = 0;
 
 	for (int f = 0; f < mesh.faces.size(); f++)
 	{
-		E += stretching_energy<s>(mesh.faces[f]);
+		E += stretching_energy<s>(mesh.faces[f], cloth.materials);
 	}
 
 	for (int e = 0; e < mesh.edges.size(); e++)
 	{
-		E += bending_energy<s>(mesh.edges[e]);
+		E += bending_energy<s>(mesh.edges[e], cloth.materials);
 	}
 	return E;
 }
@@ -392,66 +413,145 @@ template double internal_energy<WS>(const Cloth &);
 // A = dt^2 J + dt damp J
 // b = dt f + dt^2 J v + dt damp J v
 
+// local system contribution of one face / one bending stencil:
+// A_sub += dt^2 J + dt damp J, b_sub += dt f + dt^2 J v + dt damp J v
+// (A_sub += -J, b_sub += f if dt == 0)
+
+template <Space s>
+void face_system(const Face *face, const vector<Cloth::Material *> &materials,
+				 double dt, Mat9x9 &Asub, Vec9 &bsub)
+{
+	const Node *n0 = face->v[0]->node, *n1 = face->v[1]->node,
+			   *n2 = face->v[2]->node;
+	Vec9 vs = mat_to_vec(Mat3x3(n0->v, n1->v, n2->v));
+	pair<Mat9x9, Vec9> membF = stretching_force<s>(face, materials);
+	Mat9x9 J = membF.first;
+	Vec9 F = membF.second;
+	if (dt == 0)
+	{
+		Asub = -J;
+		bsub = F;
+	}
+	else
+	{
+		double damping = materials[face->label]->damping;
+		Asub = -dt * (dt + damping) * J;
+		bsub = dt * (F + (dt + damping) * J * vs);
+	}
+}
+
+template <Space s>
+void edge_system(const Edge *edge, const vector<Cloth::Material *> &materials,
+				 double dt, Mat12x12 &Asub, Vec12 &bsub)
+{
+	pair<Mat12x12, Vec12> bendF = bending_force<s>(edge, materials);
+	const Node *n0 = edge->n[0],
+			   *n1 = edge->n[1],
+			   *n2 = edge_opp_vert(edge, 0)->node,
+			   *n3 = edge_opp_vert(edge, 1)->node;
+	Vec12 vs = mat_to_vec(Mat3x4(n0->v, n1->v, n2->v, n3->v));
+	Mat12x12 J = bendF.first;
+	Vec12 F = bendF.second;
+	if (dt == 0)
+	{
+		Asub = -J;
+		bsub = F;
+	}
+	else
+	{
+		double damping = (materials[edge->adjf[0]->label]->damping +
+						  materials[edge->adjf[1]->label]->damping) /
+						 2.;
+		Asub = -dt * (dt + damping) * J;
+		bsub = dt * (F + (dt + damping) * J * vs);
+	}
+}
+
+Vec<4, int> indices(const Edge *edge)
+{
+	return indices(edge->n[0], edge->n[1], edge_opp_vert(edge, 0)->node,
+				   edge_opp_vert(edge, 1)->node);
+}
+
 template <Space s>
 void add_internal_forces(const Cloth &cloth, SpMat<Mat3x3> &A,
 						 vector<Vec3> &b, double dt)
 {
 	const Mesh &mesh = cloth.mesh;
-	::materials = &cloth.materials;
+	reserve_qbending_cache(mesh);
 	for (int f = 0; f < mesh.faces.size(); f++)
 	{
 		const Face *face = mesh.faces[f];
-		const Node *n0 = face->v[0]->node, *n1 = face->v[1]->node,
-				   *n2 = face->v[2]->node;
-		Vec9 vs = mat_to_vec(Mat3x3(n0->v, n1->v, n2->v));
-		pair<Mat9x9, Vec9> membF = stretching_force<s>(face);
-		Mat9x9 J = membF.first;
-		Vec9 F = membF.second;
-		if (dt == 0)
-		{
-			add_submat(-J, indices(n0, n1, n2), A);
-			add_subvec(F, indices(n0, n1, n2), b);
-		}
-		else
-		{
-			double damping = (*::materials)[face->label]->damping;
-			// printf("[fint] stretch f %d damping %.3f\n", f, damping);
-			add_submat(-dt * (dt + damping) * J, indices(n0, n1, n2), A);
-			add_subvec(dt * (F + (dt + damping) * J * vs), indices(n0, n1, n2), b);
-		}
+		Mat9x9 Asub;
+		Vec9 bsub;
+		face_system<s>(face, cloth.materials, dt, Asub, bsub);
+		Vec<3, int> ix = indices(face->v[0]->node, face->v[1]->node,
+								 face->v[2]->node);
+		add_submat(Asub, ix, A);
+		add_subvec(bsub, ix, b);
 	}
 	for (int e = 0; e < mesh.edges.size(); e++)
 	{
 		const Edge *edge = mesh.edges[e];
 		if (!edge->adjf[0] || !edge->adjf[1])
 			continue;
-		pair<Mat12x12, Vec12> bendF = bending_force<s>(edge);
-		const Node *n0 = edge->n[0],
-				   *n1 = edge->n[1],
-				   *n2 = edge_opp_vert(edge, 0)->node,
-				   *n3 = edge_opp_vert(edge, 1)->node;
-		Vec12 vs = mat_to_vec(Mat3x4(n0->v, n1->v, n2->v, n3->v));
-		Mat12x12 J = bendF.first;
-		Vec12 F = bendF.second;
-		if (dt == 0)
+		Mat12x12 Asub;
+		Vec12 bsub;
+		edge_system<s>(edge, cloth.materials, dt, Asub, bsub);
+		add_submat(Asub, indices(edge), A);
+		add_subvec(bsub, indices(edge), b);
+	}
+}
+template void add_internal_forces<PS>(const Cloth &, SpMat<Mat3x3> &,
+									  vector<Vec3> &, double);
+template void add_internal_forces<WS>(const Cloth &, SpMat<Mat3x3> &,
+									  vector<Vec3> &, double);
+
+// elements of one color share no node, so they write disjoint blocks of A
+// and entries of b; colors are visited in a fixed order, which keeps the
+// sums independent of the thread count
+template <Space s>
+void add_internal_forces(const Cloth &cloth, BlockSpMat &A,
+						 vector<Vec3> &b, double dt)
+{
+	const Mesh &mesh = cloth.mesh;
+	const vector<Cloth::Material *> &materials = cloth.materials;
+	reserve_qbending_cache(mesh);
+	for (int c = 0; c < A.face_colors.size(); c++)
+	{
+		const vector<int> &color = A.face_colors[c];
+#pragma omp parallel for
+		for (int i = 0; i < color.size(); i++)
 		{
-			add_submat(-J, indices(n0, n1, n2, n3), A);
-			add_subvec(F, indices(n0, n1, n2, n3), b);
+			int f = color[i];
+			const Face *face = mesh.faces[f];
+			Mat9x9 Asub;
+			Vec9 bsub;
+			face_system<s>(face, materials, dt, Asub, bsub);
+			add_submat<3>(Asub, A.face_slots[f], A);
+			add_subvec(bsub, indices(face->v[0]->node, face->v[1]->node,
+									 face->v[2]->node), b);
 		}
-		else
+	}
+	for (int c = 0; c < A.edge_colors.size(); c++)
+	{
+		const vector<int> &color = A.edge_colors[c];
+#pragma omp parallel for
+		for (int i = 0; i < color.size(); i++)
 		{
-			double damping = ((*::materials)[edge->adjf[0]->label]->damping +
-							  (*::materials)[edge->adjf[1]->label]->damping) /
-							 2.;
-			// printf("[fint] bending e %d damping %.3f\n", e, damping);
-			add_submat(-dt * (dt + damping) * J, indices(n0, n1, n2, n3), A);
-			add_subvec(dt * (F + (dt + damping) * J * vs), indices(n0, n1, n2, n3), b);
+			int e = color[i];
+			const Edge *edge = mesh.edges[e];
+			Mat12x12 Asub;
+			Vec12 bsub;
+			edge_system<s>(edge, materials, dt, Asub, bsub);
+			add_submat<4>(Asub, A.edge_slots[e], A);
+			add_subvec(bsub, indices(edge), b);
 		}
 	}
 }
-template void add_internal_forces<PS>(const Cloth &, SpMat<Mat3x3> &,
+template void add_internal_forces<PS>(const Cloth &, BlockSpMat &,
 									  vector<Vec3> &, double);
-template void add_internal_forces<WS>(const Cloth &, SpMat<Mat3x3> &,
+template void add_internal_forces<WS>(const Cloth &, BlockSpMat &,
 									  vector<Vec3> &, double);
 
 bool contains(const Mesh &mesh, const Node *node)
@@ -471,79 +571,109 @@ double constraint_energy(const vector<Constraint *> &cons)
 	return E;
 }
 
-void add_constraint_forces(const Cloth &cloth, const vector<Constraint *> &cons,
-						   SpMat<Mat3x3> &A, vector<Vec3> &b, double dt)
+static void add_block(SpMat<Mat3x3> &A, int i, int j, const Mat3x3 &a)
 {
-	const Mesh &mesh = cloth.mesh;
-	for (int c = 0; c < cons.size(); c++)
+	A(i, j) += a;
+}
+
+static void add_block(BlockSpMat &A, int i, int j, const Mat3x3 &a)
+{
+	A.add(i, j, a);
+}
+
+// Con is either Constraint, dispatching virtually, or one of the final
+// constraint types, whose calls are resolved statically
+template <typename Matrix, typename Con>
+static void add_constraint_force(const Mesh &mesh, Con &con, Matrix &A,
+								 vector<Vec3> &b, double dt)
+{
+	double value = con.value();
+	double g = con.energy_grad(value);
+	double h = con.energy_hess(value);
+	MeshGrad grad = con.gradient();
+	// f = -g*grad
+	// J = -h*outer(grad,grad)
+	double v_dot_grad = 0;
+	for (int i = 0; i < grad.n; i++)
+		v_dot_grad += dot(grad.values[i], grad.keys[i]->v);
+	for (int i = 0; i < grad.n; i++)
 	{
-		double value = cons[c]->value();
-		double g = cons[c]->energy_grad(value);
-		double h = cons[c]->energy_hess(value);
-		MeshGrad grad = cons[c]->gradient();
-		// f = -g*grad
-		// J = -h*outer(grad,grad)
-		double v_dot_grad = 0;
-		for (MeshGrad::iterator it = grad.begin(); it != grad.end(); it++)
-		{
-			const Node *node = it->first;
-			v_dot_grad += dot(it->second, node->v);
-		}
-		for (MeshGrad::iterator it = grad.begin(); it != grad.end(); it++)
+		const Node *nodei = grad.keys[i];
+		if (!contains(mesh, nodei))
+			continue;
+		int ni = nodei->index;
+		for (int j = 0; j < grad.n; j++)
 		{
-			const Node *nodei = it->first;
-			if (!contains(mesh, nodei))
+			const Node *nodej = grad.keys[j];
+			if (!contains(mesh, nodej))
 				continue;
-			int ni = nodei->index;
-			for (MeshGrad::iterator jt = grad.begin(); jt != grad.end(); jt++)
-			{
-				const Node *nodej = jt->first;
-				if (!contains(mesh, nodej))
-					continue;
-				int nj = nodej->index;
-				if (dt == 0)
-					A(ni, nj) += h * outer(it->second, jt->second);
-				else
-					A(ni, nj) += dt * dt * h * outer(it->second, jt->second);
-			}
+			int nj = nodej->index;
 			if (dt == 0)
-				b[ni] -= g * it->second;
+				add_block(A, ni, nj, h * outer(grad.values[i], grad.values[j]));
 			else
-				b[ni] -= dt * (g + dt * h * v_dot_grad) * it->second;
+				add_block(A, ni, nj, dt * dt * h * outer(grad.values[i], grad.values[j]));
 		}
+		if (dt == 0)
+			b[ni] -= g * grad.values[i];
+		else
+			b[ni] -= dt * (g + dt * h * v_dot_grad) * grad.values[i];
 	}
 }
 
-void add_friction_forces(const Cloth &cloth, const vector<Constraint *> cons,
-						 SpMat<Mat3x3> &A, vector<Vec3> &b, double dt)
+template <typename Matrix, typename Con>
+static void add_friction_force(const Mesh &mesh, Con &con, Matrix &A,
+							   vector<Vec3> &b, double dt)
 {
-	const Mesh &mesh = cloth.mesh;
-	for (int c = 0; c < cons.size(); c++)
+	MeshHess jac;
+	MeshGrad force = con.friction(dt, jac);
+	for (int i = 0; i < force.n; i++)
 	{
-		MeshHess jac;
-		MeshGrad force = cons[c]->friction(dt, jac);
-		for (MeshGrad::iterator it = force.begin(); it != force.end(); it++)
-		{
-			const Node *node = it->first;
-			if (!contains(mesh, node))
-				continue;
-			b[node->index] += dt * it->second;
-		}
-		for (MeshHess::iterator it = jac.begin(); it != jac.end(); it++)
-		{
-			const Node *nodei = it->first.first, *nodej = it->first.second;
-			if (!contains(mesh, nodei) || !contains(mesh, nodej))
-				continue;
-			A(nodei->index, nodej->index) -= dt * it->second;
-		}
+		const Node *node = force.keys[i];
+		if (!contains(mesh, node))
+			continue;
+		b[node->index] += dt * force.values[i];
 	}
+	for (int i = 0; i < jac.n; i++)
+	{
+		const Node *nodei = jac.keys[i].first, *nodej = jac.keys[i].second;
+		if (!contains(mesh, nodei) || !contains(mesh, nodej))
+			continue;
+		add_block(A, nodei->index, nodej->index, -dt * jac.values[i]);
+	}
+}
+
+void add_constraint_forces(const Cloth &cloth, const vector<Constraint *> &cons,
+						   SpMat<Mat3x3> &A, vector<Vec3> &b, double dt)
+{
+	for (int c = 0; c < cons.size(); c++)
+		add_constraint_force(cloth.mesh, *cons[c], A, b, dt);
+}
+
+void add_constraint_forces(const Cloth &cloth, const Constraints &cons,
+						   BlockSpMat &A, vector<Vec3> &b, double dt)
+{
+	const Mesh &mesh = cloth.mesh;
+	for (int c = 0; c < cons.eqs.size(); c++)
+		add_constraint_force(mesh, cons.eqs[c], A, b, dt);
+	for (int c = 0; c < cons.glues.size(); c++)
+		add_constraint_force(mesh, cons.glues[c], A, b, dt);
+	for (int c = 0; c < cons.ineqs.size(); c++)
+		add_constraint_force(mesh, cons.ineqs[c], A, b, dt);
 }
 
-void project_outside(Mesh &mesh, const vector<Constraint *> &cons);
-#include "utils/TimeUtil.hpp"
+// only IneqCon has friction
+void add_friction_forces(const Cloth &cloth, const Constraints &cons,
+						 BlockSpMat &A, vector<Vec3> &b, double dt)
+{
+	for (int c = 0; c < cons.ineqs.size(); c++)
+		add_friction_force(cloth.mesh, cons.ineqs[c], A, b, dt);
+}
+
+void project_outside(Mesh &mesh, const Constraints &cons);
+#include "utils/Profiler.h"
 void implicit_update(Cloth &cloth, const vector<Vec3> &fext,
 					 const vector<Mat3x3> &Jext,
-					 const vector<Constraint *> &cons, double dt,
+					 const Constraints &cons, double dt,
 					 bool update_positions)
 {
 	Mesh &mesh = cloth.mesh;
@@ -554,24 +684,36 @@ void implicit_update(Cloth &cloth, const vector<Vec3> &fext,
 	// Dv = Dt (M - Dt2 F)i F (x + Dt v)
 	// A = M - Dt2 F
 	// b = Dt F (x + Dt v)
-	SpMat<Mat3x3> A(nn, nn);
+	BlockSpMat &A = cloth.system;
+	prepare_system(A, mesh);
 	vector<Vec3> b(nn, Vec3(0));
 	for (int n = 0; n < mesh.nodes.size(); n++)
 	{
 		const Node *node = mesh.nodes[n];
-		A(n, n) += Mat3x3(node->m) - dt * dt * Jext[n];
+		A.blocks[A.diag[n]] += Mat3x3(node->m) - dt * dt * Jext[n];
 		b[n] += dt * fext[n];
 	}
-	cTimeUtil::Begin("fint");
-	add_internal_forces<WS>(cloth, A, b, dt);
-	add_constraint_forces(cloth, cons, A, b, dt);
-	add_friction_forces(cloth, cons, A, b, dt);
-	cTimeUtil::End("fint");
-	cTimeUtil::Begin("solve");
-	vector<Vec3> dv = taucs_linear_solve(A, b);
-	cTimeUtil::End("solve");
-
-	cTimeUtil::Begin("post_solve");
+	{
+		PROFILE_ZONE("fint");
+		add_internal_forces<WS>(cloth, A, b, dt);
+		add_constraint_forces(cloth, cons, A, b, dt);
+		add_friction_forces(cloth, cons, A, b, dt);
+		finalize_system(A);
+	}
+	vector<Vec3> dv;
+	{
+		PROFILE_ZONE("solve");
+		if (magic.linear_solver == "pcg")
+			dv = cloth.pcg.solve(A, b,
+								 magic.pcg_preconditioner == "ic0"
+									 ? PcgSolver::IncompleteCholesky
+									 : PcgSolver::BlockJacobi,
+								 magic.pcg_tolerance, magic.pcg_max_iterations);
+		else
+			dv = cloth.solver.solve(A, b);
+	}
+
+	PROFILE_ZONE("post_solve");
 	for (int n = 0; n < mesh.nodes.size(); n++)
 	{
 		Node *node = mesh.nodes[n];
@@ -582,7 +724,6 @@ void implicit_update(Cloth &cloth, const vector<Vec3> &fext,
 	}
 	project_outside(cloth.mesh, cons);
 	compute_ws_data(mesh);
-	cTimeUtil::End("post_solve");
 }
 
 Vec3 wind_force(const Face *face, const Wind &wind)
@@ -632,23 +773,24 @@ void add_morph_forces(const Cloth &cloth, const Morph &morph, double t,
 	}
 }
 
-void project_outside(Mesh &mesh, const vector<Constraint *> &cons)
+// only IneqCon projects
+void project_outside(Mesh &mesh, const Constraints &cons)
 {
 	int nn = mesh.nodes.size();
 	vector<double> w(nn, 0);
 	vector<Vec3> dx(nn, Vec3(0));
-	for (int c = 0; c < cons.size(); c++)
+	for (int c = 0; c < cons.ineqs.size(); c++)
 	{
-		MeshGrad dxc = cons[c]->project();
-		for (MeshGrad::iterator it = dxc.begin(); it != dxc.end(); it++)
+		MeshGrad dxc = cons.ineqs[c].project();
+		for (int i = 0; i < dxc.n; i++)
 		{
-			const Node *node = it->first;
-			double wn = norm2(it->second);
+			const Node *node = dxc.keys[i];
+			double wn = norm2(dxc.values[i]);
 			int n = node->index;
 			if (n >= mesh.nodes.size() || mesh.nodes[n] != node)
 				continue;
 			w[n] += wn;
-			dx[n] += wn * it->second;
+			dx[n] += wn * dxc.values[i];
 		}
 	}
 	for (int n = 0; n < nn; n++)
@@ -27,6 +27,7 @@
 #pragma once
 
 #include <vector>
+#include "blocksparse.hpp"
 #include "cloth.hpp"
 #include "geometry.hpp"
 #include "simulation.hpp"
@@ -41,10 +42,18 @@ double constraint_energy(const std::vector<Constraint*> &cons);
 template <Space s>
 void add_internal_forces(const Cloth &cloth, SpMat<Mat3x3> &A,
 						 std::vector<Vec3> &b, double dt);
+// same, scattering through the per-element slots of A,
+// whose pattern must have been prepared for cloth.mesh
+template <Space s>
+void add_internal_forces(const Cloth &cloth, BlockSpMat &A,
+						 std::vector<Vec3> &b, double dt);
 
 void add_constraint_forces(const Cloth &cloth,
 						   const std::vector<Constraint*> &cons,
 						   SpMat<Mat3x3> &A, std::vector<Vec3> &b, double dt);
+// same into a BlockSpMat, looping over each constraint type of cons in turn
+void add_constraint_forces(const Cloth &cloth, const Constraints &cons,
+						   BlockSpMat &A, std::vector<Vec3> &b, double dt);
 
 void add_external_forces(const Cloth &cloth, const Vec3 &gravity,
 						 const Wind &wind, std::vector<Vec3> &fext,
@@ -56,5 +65,5 @@ void add_morph_forces(const Cloth &cloth, const Morph &morph, double t,
 
 void implicit_update(Cloth &cloth, const std::vector<Vec3> &fext,
 					 const std::vector<Mat3x3> &Jext,
-					 const std::vector<Constraint*> &cons, double dt,
+					 const Constraints &cons, double dt,
 					 bool update_positions = true);
\ No newline at end of file
@@ -26,10 +26,10 @@
 
 #include "plasticity.hpp"
 
-#include "bah.hpp"
 #include "geometry.hpp"
 #include "optimization.hpp"
 #include "physics.hpp"
+#include "snapshot.hpp"
 #include <omp.h>
 
 using namespace std;
@@ -279,10 +279,6 @@ void recompute_edge_plasticity(Mesh &mesh)
 
 // ------------------------------------------------------------------ //
 
-const vector<Residual> *res_old;
-
-void resample_callback(Face *face_new, const Face *face_old);
-
 vector<Residual> back_up_residuals(Mesh &mesh)
 {
 	vector<Residual> res(mesh.faces.size());
@@ -301,11 +297,10 @@ vector<Residual> back_up_residuals(Mesh &mesh)
 	return res;
 }
 
-void restore_residuals(Mesh &mesh, const Mesh &old_mesh,
-					   const vector<Residual> &res_old)
+double overlap_area(const Face *face0, const Vec2 *u1);
+
+void restore_residuals(Mesh &mesh, const MeshSnapshot &old_mesh)
 {
-	::res_old = &res_old;
-	BahNode *tree = new_bah_tree(old_mesh);
 #pragma omp parallel for
 	for (int f = 0; f < mesh.faces.size(); f++)
 	{
@@ -315,37 +310,41 @@ void restore_residuals(Mesh &mesh, const Mesh &old_mesh,
 			theta[e] = dihedral_angle<PS>(face->adje[e]);
 		face->S_plastic = edges_to_face(theta, face);
 		face->damage = 0;
-		for_overlapping_faces(face, tree, resample_callback);
+		Vec2 umin(face->v[0]->u), umax(umin);
+		for (int i = 1; i < 3; i++)
+		{
+			umin = vec_min(umin, face->v[i]->u);
+			umax = vec_max(umax, face->v[i]->u);
+		}
+		vector<int> old_faces;
+		overlapping_faces(old_mesh, umin, umax, old_faces);
+		for (int o = 0; o < old_faces.size(); o++)
+		{
+			int f_old = old_faces[o];
+			double a = overlap_area(face, &old_mesh.u[f_old * 3]) / face->a;
+			const Residual &res = old_mesh.res[f_old];
+			face->S_plastic += a * res.S_res;
+			face->damage += a * res.damage;
+		}
 	}
-	delete_bah_tree(tree);
 	recompute_edge_plasticity(mesh);
 }
 
-double overlap_area(const Face *face0, const Face *face1);
-
-void resample_callback(Face *face_new, const Face *face_old)
-{
-	double a = overlap_area(face_new, face_old) / face_new->a;
-	const Residual &res = (*::res_old)[face_old->index];
-	face_new->S_plastic += a * res.S_res;
-	face_new->damage += a * res.damage;
-}
-
 // ------------------------------------------------------------------ //
 
 vector<Vec2> sutherland_hodgman(const vector<Vec2> &poly0,
 								const vector<Vec2> &poly1);
 double area(const vector<Vec2> &poly);
 
-double overlap_area(const Face *face0, const Face *face1)
+// overlap of face0 with the material-space triangle u1[0..2]
+double overlap_area(const Face *face0, const Vec2 *u1)
 {
-	vector<Vec2> u0(3), u1(3);
+	vector<Vec2> u0(3);
 	Vec2 u0min(face0->v[0]->u), u0max(u0min),
-		u1min(face1->v[0]->u), u1max(u1min);
+		u1min(u1[0]), u1max(u1min);
 	for (int i = 0; i < 3; i++)
 	{
 		u0[i] = face0->v[i]->u;
-		u1[i] = face1->v[i]->u;
 		u0min = vec_min(u0min, u0[i]);
 		u0max = vec_max(u0max, u0[i]);
 		u1min = vec_min(u1min, u1[i]);
@@ -356,7 +355,7 @@ double overlap_area(const Face *face0, const Face *face1)
 	{
 		return 0;
 	}
-	return area(sutherland_hodgman(u0, u1));
+	return area(sutherland_hodgman(u0, vector<Vec2>(u1, u1 + 3)));
 }
 
 vector<Vec2> clip(const vector<Vec2> &poly, const Vec2 &clip0,
@@ -35,9 +35,11 @@ void plastic_update (Cloth &cloth);
 
 void optimize_plastic_embedding (Cloth &cloth);
 
+struct MeshSnapshot;
+
 struct Residual {Mat2x2 S_res; double damage;};
 std::vector<Residual> back_up_residuals (Mesh &mesh);
-void restore_residuals (Mesh &mesh, const Mesh &old_mesh,
-                        const std::vector<Residual> &res);
+// resamples the residuals backed up in old_mesh.res onto the remeshed mesh
+void restore_residuals (Mesh &mesh, const MeshSnapshot &old_mesh);
 
 #endif
@@ -31,6 +31,8 @@
 #include "constraint.hpp"
 #include "simulation.hpp"
 #include "collisionutil.hpp"
+#include <unordered_set>
+#include <omp.h>
 
 template <typename T> struct Min
 {
@@ -52,57 +54,198 @@ static std::vector< Min<Edge*> > edge_prox[2];
 static std::vector< Min<Node*> > face_prox[2];
 
 void find_proximities(const Face *face0, const Face *face1);
-Constraint *make_constraint(const Node *node, const Face *face,
-							double mu, double mu_obs);
-Constraint *make_constraint(const Edge *edge0, const Edge *edge1,
-							double mu, double mu_obs);
+void make_constraint(const Node *node, const Face *face,
+					 double mu, double mu_obs, Constraints &cons);
+void make_constraint(const Edge *edge0, const Edge *edge1,
+					 double mu, double mu_obs, Constraints &cons);
 
-std::vector<Constraint*> proximity_constraints(const std::vector<Mesh*> &meshes,
-										  const std::vector<Mesh*> &obs_meshes,
-										  double mu, double mu_obs)
+void proximity_constraints(const std::vector<Mesh*> &meshes,
+						   const std::vector<Mesh*> &obs_meshes,
+						   double mu, double mu_obs, Constraints &cons)
 {
-	::meshes = &meshes;
-	const double dmin = 2 * ::magic.repulsion_thickness;
 	std::vector<AccelStruct*> accs = create_accel_structs(meshes, false),
 		obs_accs = create_accel_structs(obs_meshes, false);
-	int nn = size<Node>(meshes),
-		ne = size<Edge>(meshes),
-		nf = size<Face>(meshes);
+	proximity_constraints(meshes, obs_meshes, accs, obs_accs, mu, mu_obs, cons);
+	destroy_accel_structs(accs);
+	destroy_accel_structs(obs_accs);
+}
+
+static void clear_proximities(const MeshIndex &index);
+static void make_constraints(const MeshIndex &index, double mu,
+							 double mu_obs, Constraints &cons);
+
+void proximity_constraints(const std::vector<Mesh*> &meshes,
+						   const std::vector<Mesh*> &obs_meshes,
+						   const std::vector<AccelStruct*> &accs,
+						   const std::vector<AccelStruct*> &obs_accs,
+						   double mu, double mu_obs, Constraints &cons)
+{
+	set_meshes(meshes, obs_meshes);
+	const double dmin = 2 * ::magic.repulsion_thickness;
+	clear_proximities(::mesh_index);
+	for_overlapping_faces(accs, obs_accs, dmin, find_proximities);
+	make_constraints(::mesh_index, mu, mu_obs, cons);
+}
+
+static void clear_proximities(const MeshIndex &index)
+{
+	int nn = index.size<Node>(),
+		ne = index.size<Edge>(),
+		nf = index.size<Face>();
 	for (int i = 0; i < 2; i++)
 	{
 		::node_prox[i].assign(nn, Min<Face*>());
 		::edge_prox[i].assign(ne, Min<Edge*>());
 		::face_prox[i].assign(nf, Min<Node*>());
 	}
-	for_overlapping_faces(accs, obs_accs, dmin, find_proximities);
-	std::vector<Constraint*> cons;
+}
+
+static void make_constraints(const MeshIndex &index, double mu,
+							 double mu_obs, Constraints &cons)
+{
+	const double dmin = 2 * ::magic.repulsion_thickness;
+	int nn = ::node_prox[0].size(),
+		ne = ::edge_prox[0].size(),
+		nf = ::face_prox[0].size();
 	for (int n = 0; n < nn; n++)
 		for (int i = 0; i < 2; i++)
 		{
 			Min<Face*> &m = ::node_prox[i][n];
 			if (m.key < dmin)
-				cons.push_back(make_constraint(get<Node>(n, meshes), m.val,
-											   mu, mu_obs));
+				make_constraint(index.get<Node>(n), m.val, mu, mu_obs, cons);
 		}
 	for (int e = 0; e < ne; e++)
 		for (int i = 0; i < 2; i++)
 		{
 			Min<Edge*> &m = ::edge_prox[i][e];
 			if (m.key < dmin)
-				cons.push_back(make_constraint(get<Edge>(e, meshes), m.val,
-											   mu, mu_obs));
+				make_constraint(index.get<Edge>(e), m.val, mu, mu_obs, cons);
 		}
 	for (int f = 0; f < nf; f++)
 		for (int i = 0; i < 2; i++)
 		{
 			Min<Node*> &m = ::face_prox[i][f];
 			if (m.key < dmin)
-				cons.push_back(make_constraint(m.val, get<Face>(f, meshes),
-											   mu, mu_obs));
+				make_constraint(m.val, index.get<Face>(f), mu, mu_obs, cons);
 		}
-	destroy_accel_structs(accs);
-	destroy_accel_structs(obs_accs);
-	return cons;
+}
+
+// Tracked proximities
+
+typedef std::pair<const Face*, const Face*> FacePair;
+
+static int nthreads = 0;
+static std::vector<FacePair> *candidates = NULL;
+
+void add_candidate(const Face *face0, const Face *face1)
+{
+	::candidates[omp_get_thread_num()].push_back(FacePair(face0, face1));
+}
+
+static void find_candidates(const std::vector<AccelStruct*> &accs,
+							const std::vector<AccelStruct*> &obs_accs,
+							double margin, std::vector<FacePair> &pairs)
+{
+	if (!::candidates)
+	{
+		::nthreads = omp_get_max_threads();
+		::candidates = new std::vector<FacePair>[::nthreads];
+	}
+	for (int t = 0; t < ::nthreads; t++)
+		::candidates[t].clear();
+	for_overlapping_faces(accs, obs_accs, margin, add_candidate);
+	for (int t = 0; t < ::nthreads; t++)
+		append(pairs, ::candidates[t]);
+}
+
+void ProximityTracker::clear()
+{
+	pairs.clear();
+	meshes.clear();
+	topology.clear();
+	xref.clear();
+}
+
+void proximity_constraints(const std::vector<Mesh*> &meshes,
+						   const std::vector<Mesh*> &obs_meshes,
+						   const std::vector<AccelStruct*> &accs,
+						   const std::vector<AccelStruct*> &obs_accs,
+						   double mu, double mu_obs,
+						   ProximityTracker &tracker, Constraints &cons)
+{
+	set_meshes(meshes, obs_meshes);
+	const double dmin = 2 * ::magic.repulsion_thickness,
+				 slack = ::magic.proximity_slack;
+	std::vector<const Mesh*> all_meshes(meshes.begin(), meshes.end());
+	all_meshes.insert(all_meshes.end(), obs_meshes.begin(), obs_meshes.end());
+	std::vector<AccelStruct*> all_accs = accs;
+	append(all_accs, obs_accs);
+	bool full = tracker.slack != slack || tracker.meshes != all_meshes;
+	for (int m = 0; m < all_meshes.size() && !full; m++)
+		full = tracker.topology[m] != all_meshes[m]->topology;
+	// (mesh, index into xref) of each node that moved too far
+	std::vector<std::pair<int, int> > moved;
+	if (!full)
+	{
+		int i = 0;
+		for (int m = 0; m < all_meshes.size(); m++)
+			for (int n = 0; n < all_meshes[m]->nodes.size(); n++, i++)
+				if (norm2(all_meshes[m]->nodes[n]->x - tracker.xref[i]) > sq(slack))
+					moved.push_back(std::make_pair(m, i));
+		full = moved.size() > tracker.xref.size() / 2;
+	}
+	if (full)
+	{
+		tracker.clear();
+		tracker.slack = slack;
+		tracker.meshes = all_meshes;
+		for (int m = 0; m < all_meshes.size(); m++)
+		{
+			tracker.topology.push_back(all_meshes[m]->topology);
+			for (int n = 0; n < all_meshes[m]->nodes.size(); n++)
+				tracker.xref.push_back(all_meshes[m]->nodes[n]->x);
+		}
+		find_candidates(accs, obs_accs, dmin + 4 * slack, tracker.pairs);
+		tracker.full_queries++;
+	}
+	else if (!moved.empty())
+	{
+		std::unordered_set<const Face*> requeried;
+		for (int a = 0; a < all_accs.size(); a++)
+			mark_all_inactive(*all_accs[a]);
+		int offset = 0, m = 0;
+		for (int i = 0; i < moved.size(); i++)
+		{
+			for (; m < moved[i].first; m++)
+				offset += all_meshes[m]->nodes.size();
+			const Node *node = all_meshes[m]->nodes[moved[i].second - offset];
+			tracker.xref[moved[i].second] = node->x;
+			for (int v = 0; v < node->verts.size(); v++)
+				for (int f = 0; f < node->verts[v]->adjf.size(); f++)
+				{
+					const Face *face = node->verts[v]->adjf[f];
+					mark_active(*all_accs[m], face);
+					requeried.insert(face);
+				}
+		}
+		std::vector<FacePair> kept;
+		for (int p = 0; p < tracker.pairs.size(); p++)
+			if (!requeried.count(tracker.pairs[p].first)
+				&& !requeried.count(tracker.pairs[p].second))
+				kept.push_back(tracker.pairs[p]);
+		swap(tracker.pairs, kept);
+		find_candidates(accs, obs_accs, dmin + 4 * slack, tracker.pairs);
+		for (int a = 0; a < all_accs.size(); a++)
+			mark_all_active(*all_accs[a]);
+		tracker.partial_queries++;
+	}
+	else
+		tracker.reuses++;
+	clear_proximities(::mesh_index);
+#pragma omp parallel for
+	for (int p = 0; p < tracker.pairs.size(); p++)
+		find_proximities(tracker.pairs[p].first, tracker.pairs[p].second);
+	make_constraints(::mesh_index, mu, mu_obs, cons);
 }
 
 void add_proximity(const Node *node, const Face *face);
@@ -137,12 +280,12 @@ void add_proximity(const Node *node, const Face *face)
 	if (is_free(node))
 	{
 		int side = dot(n, node->n) >= 0 ? 0 : 1;
-		::node_prox[side][get_index(node, *::meshes)].add(d, (Face*)face);
+		::node_prox[side][::mesh_index.index(node)].add(d, (Face*)face);
 	}
 	if (is_free(face))
 	{
 		int side = dot(-n, face->n) >= 0 ? 0 : 1;
-		::face_prox[side][get_index(face, *::meshes)].add(d, (Node*)node);
+		::face_prox[side][::mesh_index.index(face)].add(d, (Node*)node);
 	}
 }
 
@@ -182,13 +325,13 @@ void add_proximity(const Edge *edge0, const Edge *edge1)
 	{
 		Vec3 edge0n = edge0->n[0]->n + edge0->n[1]->n;
 		int side = dot(n, edge0n) >= 0 ? 0 : 1;
-		::edge_prox[side][get_index(edge0, *::meshes)].add(d, (Edge*)edge1);
+		::edge_prox[side][::mesh_index.index(edge0)].add(d, (Edge*)edge1);
 	}
 	if (is_free(edge1))
 	{
 		Vec3 edge1n = edge1->n[0]->n + edge1->n[1]->n;
 		int side = dot(-n, edge1n) >= 0 ? 0 : 1;
-		::edge_prox[side][get_index(edge1, *::meshes)].add(d, (Edge*)edge0);
+		::edge_prox[side][::mesh_index.index(edge1)].add(d, (Edge*)edge0);
 	}
 }
 
@@ -196,10 +339,10 @@ double area(const Node *node);
 double area(const Edge *edge);
 double area(const Face *face);
 
-Constraint *make_constraint(const Node *node, const Face *face,
-							double mu, double mu_obs)
+void make_constraint(const Node *node, const Face *face,
+					 double mu, double mu_obs, Constraints &cons)
 {
-	IneqCon *con = new IneqCon;
+	IneqCon *con = cons.add_ineq();
 	con->nodes[0] = (Node*)node;
 	con->nodes[1] = (Node*)face->v[0]->node;
 	con->nodes[2] = (Node*)face->v[1]->node;
@@ -214,13 +357,12 @@ Constraint *make_constraint(const Node *node, const Face *face,
 	if (d < 0)
 		con->n = -con->n;
 	con->mu = (!is_free(node) || !is_free(face)) ? mu_obs : mu;
-	return con;
 }
 
-Constraint *make_constraint(const Edge *edge0, const Edge *edge1,
-							double mu, double mu_obs)
+void make_constraint(const Edge *edge0, const Edge *edge1,
+					 double mu, double mu_obs, Constraints &cons)
 {
-	IneqCon *con = new IneqCon;
+	IneqCon *con = cons.add_ineq();
 	con->nodes[0] = (Node*)edge0->n[0];
 	con->nodes[1] = (Node*)edge0->n[1];
 	con->nodes[2] = (Node*)edge1->n[0];
@@ -235,7 +377,6 @@ Constraint *make_constraint(const Edge *edge0, const Edge *edge1,
 	if (d < 0)
 		con->n = -con->n;
 	con->mu = (!is_free(edge0) || !is_free(edge1)) ? mu_obs : mu;
-	return con;
 }
 
 double area(const Node *node)
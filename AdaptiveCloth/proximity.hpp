@@ -24,13 +24,59 @@
   UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
 */
 
-#pragma 
+#pragma once
 
 #include <vector>
+#include "vectors.hpp"
 
 struct Mesh;
-struct Constraint;
+struct Face;
+struct Constraints;
+struct AccelStruct;
 
-std::vector<Constraint*> proximity_constraints(const std::vector<Mesh*> & meshes,
-											   const std::vector<Mesh*> & obs_meshes,
-											   double friction, double obs_friction);
\ No newline at end of file
+// adds an IneqCon to cons for each close vertex-face and edge-edge pair
+void proximity_constraints(const std::vector<Mesh*> & meshes,
+						   const std::vector<Mesh*> & obs_meshes,
+						   double friction, double obs_friction,
+						   Constraints & cons);
+
+// same, using non-ccd accel structs kept by the caller (see AccelCache)
+void proximity_constraints(const std::vector<Mesh*> & meshes,
+						   const std::vector<Mesh*> & obs_meshes,
+						   const std::vector<AccelStruct*> & accs,
+						   const std::vector<AccelStruct*> & obs_accs,
+						   double friction, double obs_friction,
+						   Constraints & cons);
+
+// Candidate face pairs kept from earlier proximity queries. A query with
+// margin repulsion_thickness*2 + 4*slack stays valid for faces none of whose
+// nodes has moved more than slack from where it was when last requeried:
+// any pair of such faces that has come within the proximity distance was
+// already within the margin when it was found. So each step only faces
+// touching a node that moved further are requeried, by marking them active
+// in the accel structs, and their old pairs are dropped. If too many nodes
+// moved, or a mesh changed topology, everything is requeried. Copies start
+// empty.
+struct ProximityTracker
+{
+	double slack;
+	std::vector<std::pair<const Face*, const Face*> > pairs;
+	std::vector<const Mesh*> meshes; // cloth meshes, then obstacle meshes
+	std::vector<int> topology;		 // Mesh::topology when last queried
+	std::vector<Vec3> xref;			 // node positions when last requeried
+	int full_queries, partial_queries, reuses;
+	ProximityTracker() : slack(0), full_queries(0), partial_queries(0),
+						 reuses(0) {}
+	ProximityTracker(const ProximityTracker &) : slack(0), full_queries(0),
+												 partial_queries(0), reuses(0) {}
+	ProximityTracker &operator=(const ProximityTracker &) { clear(); return *this; }
+	void clear();
+};
+
+// same, reusing the candidates of tracker and updating them
+void proximity_constraints(const std::vector<Mesh*> & meshes,
+						   const std::vector<Mesh*> & obs_meshes,
+						   const std::vector<AccelStruct*> & accs,
+						   const std::vector<AccelStruct*> & obs_accs,
+						   double friction, double obs_friction,
+						   ProximityTracker & tracker, Constraints & cons);
@@ -32,6 +32,7 @@
 #include "magic.hpp"
 #include "optimization.hpp"
 #include "simulation.hpp"
+#include "snapshot.hpp"
 #include "util.hpp"
 #include <omp.h>
 using namespace std;
@@ -39,7 +40,7 @@ using namespace std;
 static const int max_iter = 100;
 static const double &thickness = ::magic.projection_thickness;
 
-static const vector<Mesh*> *old_meshes;
+static const vector<MeshSnapshot> *old_meshes;
 static vector<Vec3> xold;
 
 typedef Vec3 Bary; // barycentric coordinates
@@ -65,15 +66,23 @@ vector<Ixn> find_intersections(const vector<AccelStruct*> &accs,
 
 void solve_ixns(const vector<Ixn> &ixns);
 
-void separate(vector<Mesh*> &meshes, const vector<Mesh*> &old_meshes,
+void separate(vector<Mesh*> &meshes, const vector<MeshSnapshot> &old_meshes,
 			  const vector<Mesh*> &obs_meshes)
 {
-	::meshes = &meshes;
-	::old_meshes = &old_meshes;
-	::obs_meshes = &obs_meshes;
-	::xold = node_positions(meshes);
 	vector<AccelStruct*> accs = create_accel_structs(meshes, false),
 		obs_accs = create_accel_structs(obs_meshes, false);
+	separate(meshes, old_meshes, obs_meshes, accs, obs_accs);
+	destroy_accel_structs(accs);
+	destroy_accel_structs(obs_accs);
+}
+
+void separate(vector<Mesh*> &meshes, const vector<MeshSnapshot> &old_meshes,
+			  const vector<Mesh*> &obs_meshes, const vector<AccelStruct*> &accs,
+			  const vector<AccelStruct*> &obs_accs)
+{
+	set_meshes(meshes, obs_meshes);
+	::old_meshes = &old_meshes;
+	::mesh_index.get_positions(::xold);
 	vector<Ixn> ixns;
 	int iter;
 	for (iter = 0; iter < max_iter; iter++)
@@ -102,8 +111,6 @@ void separate(vector<Mesh*> &meshes, const vector<Mesh*> &old_meshes,
 		compute_ws_data(*meshes[m]);
 		update_x0(*meshes[m]);
 	}
-	destroy_accel_structs(accs);
-	destroy_accel_structs(obs_accs);
 }
 
 Vec3 pos(const Face *face, const Bary &b)
@@ -118,13 +125,14 @@ Vec3 old_pos(const Face *face, const Bary &b)
 	if (!is_free(face))
 		return pos(face, b);
 	Vec2 u = b[0] * face->v[0]->u + b[1] * face->v[1]->u + b[2] * face->v[2]->u;
-	int m;
-	for (m = 0; m < ::meshes->size(); m++)
-		if ((*::meshes)[m]->faces[face->index] == face)
-			break;
-	Face *old_face = get_enclosing_face(*(*::old_meshes)[m], u);
-	Bary old_b = get_barycentric_coords(u, old_face);
-	return pos(old_face, old_b);
+	int m = ::mesh_index.mesh(face);
+	const MeshSnapshot &old_mesh = (*::old_meshes)[m];
+	Bary old_b;
+	int f = enclosing_face(old_mesh, u, old_b);
+	if (f < 0)
+		return pos(face, b);
+	return old_b[0] * old_mesh.x[f * 3] + old_b[1] * old_mesh.x[f * 3 + 1]
+		+ old_b[2] * old_mesh.x[f * 3 + 2];
 }
 
 void update_active(const vector<AccelStruct*> &accs, const vector<Ixn> &ixns)
@@ -381,7 +389,7 @@ double SeparationOpt::objective(const double *x) const
 	for (int n = 0; n < nodes.size(); n++)
 	{
 		const Node *node = nodes[n];
-		Vec3 dx = get_subvec(x, n) - ::xold[get_index(node, *::meshes)];
+		Vec3 dx = get_subvec(x, n) - ::xold[::mesh_index.index(node)];
 		f += inv_m * node->a*dot(dx, dx) / 2;
 	}
 	return f;
@@ -392,7 +400,7 @@ void SeparationOpt::obj_grad(const double *x, double *grad) const
 	for (int n = 0; n < nodes.size(); n++)
 	{
 		const Node *node = nodes[n];
-		Vec3 dx = get_subvec(x, n) - ::xold[get_index(node, *::meshes)];
+		Vec3 dx = get_subvec(x, n) - ::xold[::mesh_index.index(node)];
 		set_subvec(grad, n, inv_m*node->a*dx);
 	}
 }
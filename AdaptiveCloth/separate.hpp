@@ -29,7 +29,16 @@
 
 #include "mesh.hpp"
 
-void separate (std::vector<Mesh*> &meshes, const std::vector<Mesh*> &old_meshes,
+struct AccelStruct;
+struct MeshSnapshot;
+
+void separate (std::vector<Mesh*> &meshes, const std::vector<MeshSnapshot> &old_meshes,
                const std::vector<Mesh*> &obs_meshes);
 
+// same, using non-ccd accel structs kept by the caller (see AccelCache)
+void separate (std::vector<Mesh*> &meshes, const std::vector<MeshSnapshot> &old_meshes,
+               const std::vector<Mesh*> &obs_meshes,
+               const std::vector<AccelStruct*> &accs,
+               const std::vector<AccelStruct*> &obs_accs);
+
 #endif
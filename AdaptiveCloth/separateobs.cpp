@@ -66,22 +66,21 @@ namespace SO
 
 	void solve_ixns(const vector<Ixn> &ixns);
 
-	vector<Vec3> face_normals(const vector<Mesh*> &meshes)
+	vector<Vec3> face_normals(const MeshIndex &index)
 	{
-		int nf = size<Face>(meshes);
+		int nf = index.size<Face>();
 		vector<Vec3> n(nf);
 		for (int f = 0; f < nf; f++)
-			n[f] = get<Face>(f, meshes)->n;
+			n[f] = index.get<Face>(f)->n;
 		return n;
 	}
 
 	void separate_obstacles(vector<Mesh*> &obs_meshes,
 							const vector<Mesh*> &meshes)
 	{
-		::obs_meshes = &obs_meshes;
-		::meshes = &meshes;
-		SO::xold = node_positions(obs_meshes);
-		SO::nold = face_normals(obs_meshes);
+		set_meshes(meshes, obs_meshes);
+		::obs_mesh_index.get_positions(SO::xold);
+		SO::nold = face_normals(::obs_mesh_index);
 		vector<AccelStruct*> obs_accs = create_accel_structs(obs_meshes, false),
 			accs = create_accel_structs(meshes, false);
 		vector<Ixn> ixns;
@@ -173,7 +172,7 @@ namespace SO
 		bool is_ixn = intersection_midpoint(face0, face1, b0, b1);
 		if (!is_ixn)
 			return;
-		Vec3 n = -normalize(face0->n / 2. + SO::nold[get_index(face0, *::obs_meshes)]);
+		Vec3 n = -normalize(face0->n / 2. + SO::nold[::obs_mesh_index.index(face0)]);
 		farthest_points(face0, face1, n, b0, b1);
 		SO::ixns[t].push_back(Ixn(face0, b0, face1, b1, n));
 	}
@@ -372,7 +371,7 @@ namespace SO
 		for (int n = 0; n < nodes.size(); n++)
 		{
 			const Node *node = nodes[n];
-			Vec3 dx = get_subvec(x, n) - SO::xold[get_index(node, *::obs_meshes)];
+			Vec3 dx = get_subvec(x, n) - SO::xold[::obs_mesh_index.index(node)];
 			f += inv_m * dot(dx, dx) / 2;
 		}
 		return f;
@@ -383,7 +382,7 @@ namespace SO
 		for (int n = 0; n < nodes.size(); n++)
 		{
 			const Node *node = nodes[n];
-			Vec3 dx = get_subvec(x, n) - SO::xold[get_index(node, *::obs_meshes)];
+			Vec3 dx = get_subvec(x, n) - SO::xold[::obs_mesh_index.index(node)];
 			set_subvec(grad, n, inv_m*dx);
 		}
 	}
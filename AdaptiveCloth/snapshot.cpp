@@ -0,0 +1,136 @@
+/*************************************************************************
+*************************    ARCSim_Snapshot    **************************
+*************************************************************************/
+
+#include "snapshot.hpp"
+#include "geometry.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static void cell_of(const MeshSnapshot &snap, const Vec2 &u, int &i, int &j)
+{
+	i = (int)floor((u[0] - snap.umin[0]) / snap.cell[0]);
+	j = (int)floor((u[1] - snap.umin[1]) / snap.cell[1]);
+	i = min(max(i, 0), snap.nx - 1);
+	j = min(max(j, 0), snap.ny - 1);
+}
+
+// bounding box of face f, padded so that points get_enclosing_face would
+// still accept are inside it
+static void face_box(const MeshSnapshot &snap, int f, Vec2 &umin, Vec2 &umax)
+{
+	umin = umax = snap.u[f * 3];
+	for (int i = 1; i < 3; i++)
+	{
+		umin = vec_min(umin, snap.u[f * 3 + i]);
+		umax = vec_max(umax, snap.u[f * 3 + i]);
+	}
+	Vec2 pad = Vec2(1e-5 * max(umax[0] - umin[0], umax[1] - umin[1]));
+	umin -= pad;
+	umax += pad;
+}
+
+MeshSnapshot take_snapshot(const Mesh &mesh)
+{
+	MeshSnapshot snap;
+	int nf = mesh.faces.size();
+	snap.u.resize(nf * 3);
+	snap.x.resize(nf * 3);
+	for (int f = 0; f < nf; f++)
+		for (int i = 0; i < 3; i++)
+		{
+			snap.u[f * 3 + i] = mesh.faces[f]->v[i]->u;
+			snap.x[f * 3 + i] = mesh.faces[f]->v[i]->node->x;
+		}
+	// about one face per cell
+	Vec2 umin(infinity), umax(-infinity);
+	for (int i = 0; i < snap.u.size(); i++)
+	{
+		umin = vec_min(umin, snap.u[i]);
+		umax = vec_max(umax, snap.u[i]);
+	}
+	if (nf == 0)
+		umin = umax = Vec2(0);
+	Vec2 extent = umax - umin;
+	double h = max(sqrt(extent[0] * extent[1] / max(nf, 1)),
+				   max(extent[0], extent[1]) / max(nf, 1));
+	if (h <= 0)
+		h = 1;
+	snap.umin = umin;
+	snap.nx = max(1, (int)ceil(extent[0] / h));
+	snap.ny = max(1, (int)ceil(extent[1] / h));
+	snap.cell = Vec2(max(extent[0], h) / snap.nx, max(extent[1], h) / snap.ny);
+	// bin faces by their boxes, counting first, keeping mesh order per cell
+	vector<Vec<4, int> > ranges(nf);
+	snap.cell_start.assign(snap.nx * snap.ny + 1, 0);
+	for (int f = 0; f < nf; f++)
+	{
+		Vec2 fmin, fmax;
+		face_box(snap, f, fmin, fmax);
+		Vec<4, int> &r = ranges[f];
+		cell_of(snap, fmin, r[0], r[1]);
+		cell_of(snap, fmax, r[2], r[3]);
+		for (int j = r[1]; j <= r[3]; j++)
+			for (int i = r[0]; i <= r[2]; i++)
+				snap.cell_start[j * snap.nx + i + 1]++;
+	}
+	for (int c = 0; c < snap.nx * snap.ny; c++)
+		snap.cell_start[c + 1] += snap.cell_start[c];
+	snap.cell_faces.resize(snap.cell_start.back());
+	vector<int> next(snap.cell_start.begin(), snap.cell_start.end() - 1);
+	for (int f = 0; f < nf; f++)
+	{
+		const Vec<4, int> &r = ranges[f];
+		for (int j = r[1]; j <= r[3]; j++)
+			for (int i = r[0]; i <= r[2]; i++)
+				snap.cell_faces[next[j * snap.nx + i]++] = f;
+	}
+	return snap;
+}
+
+int enclosing_face(const MeshSnapshot &snap, const Vec2 &u, Vec3 &b)
+{
+	if (snap.size() == 0)
+		return -1;
+	int i, j;
+	cell_of(snap, u, i, j);
+	int c = j * snap.nx + i;
+	for (int k = snap.cell_start[c]; k < snap.cell_start[c + 1]; k++)
+	{
+		int f = snap.cell_faces[k];
+		b = get_barycentric_coords(u, snap.u[f * 3], snap.u[f * 3 + 1],
+								   snap.u[f * 3 + 2]);
+		if (is_inside(b))
+			return f;
+	}
+	return -1;
+}
+
+void overlapping_faces(const MeshSnapshot &snap, const Vec2 &umin,
+					   const Vec2 &umax, vector<int> &faces)
+{
+	faces.clear();
+	if (snap.size() == 0)
+		return;
+	int i0, j0, i1, j1;
+	cell_of(snap, umin, i0, j0);
+	cell_of(snap, umax, i1, j1);
+	for (int j = j0; j <= j1; j++)
+		for (int i = i0; i <= i1; i++)
+		{
+			int c = j * snap.nx + i;
+			for (int k = snap.cell_start[c]; k < snap.cell_start[c + 1]; k++)
+			{
+				int f = snap.cell_faces[k];
+				Vec2 fmin, fmax;
+				face_box(snap, f, fmin, fmax);
+				if (fmin[0] <= umax[0] && fmax[0] >= umin[0]
+					&& fmin[1] <= umax[1] && fmax[1] >= umin[1])
+					faces.push_back(f);
+			}
+		}
+	sort(faces.begin(), faces.end());
+	faces.erase(unique(faces.begin(), faces.end()), faces.end());
+}
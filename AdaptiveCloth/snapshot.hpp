@@ -0,0 +1,34 @@
+/*************************************************************************
+*************************    ARCSim_Snapshot    **************************
+*************************************************************************/
+#pragma once
+
+#include "mesh.hpp"
+#include "plasticity.hpp"
+#include <vector>
+
+// What remeshing needs of a cloth mesh's previous state: the material-space
+// triangles with the world-space positions of their corners, the plastic
+// residuals if backed up, and a uniform grid over material space to find the
+// triangles around a point or a box. Faces keep the order of mesh.faces.
+struct MeshSnapshot
+{
+	std::vector<Vec2> u;	   // 3 corners per face
+	std::vector<Vec3> x;	   // 3 corners per face
+	std::vector<Residual> res; // per face, if backed up
+	Vec2 umin, cell;		   // grid origin and cell size
+	int nx, ny;
+	std::vector<int> cell_start; // faces of cell c: cell_faces[cell_start[c]..]
+	std::vector<int> cell_faces;
+	int size() const { return u.size() / 3; }
+};
+
+MeshSnapshot take_snapshot(const Mesh &mesh);
+
+// the first face (in mesh order) containing u, or -1; b gets its
+// barycentric coordinates
+int enclosing_face(const MeshSnapshot &snap, const Vec2 &u, Vec3 &b);
+
+// faces whose bounding box overlaps [umin, umax], in mesh order
+void overlapping_faces(const MeshSnapshot &snap, const Vec2 &umin,
+					   const Vec2 &umax, std::vector<int> &faces);
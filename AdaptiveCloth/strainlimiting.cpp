@@ -29,6 +29,7 @@
 #include "optimization.hpp"
 #include "simulation.hpp"
 #include <omp.h>
+#include <unordered_map>
 
 using namespace std;
 
@@ -52,32 +53,45 @@ vector<Vec2> get_strain_limits(const vector<Cloth> &cloths)
 	return strain_limits;
 }
 
+// Moves nodes to satisfy the strain limits of faces and keeps cons at their
+// current values. Faces may have nodes that are not among the variables;
+// those stay put.
 struct SLOpt : public NLConOpt
 {
-	vector<Mesh*> meshes;
-	int nn, nf;
-	const vector<Vec2> &strain_limits;
-	const vector<Constraint*> &cons;
+	vector<Node*> nodes;
+	vector<const Face*> faces;
+	vector<Vec2> strain_limits; // per face
+	vector<Constraint*> cons;
+	unordered_map<const Node*, int> index; // into nodes
 	vector<Vec3> xold;
 	vector<double> conold;
+	vector<int> key; // strain_limiting_key, if faces are whole meshes
 	mutable vector<double> s;
 	mutable vector<Mat3x3> sg;
 	double inv_m;
-	SLOpt(vector<Mesh*> &meshes, const vector<Vec2> &strain_limits,
-		  const vector<Constraint*> &cons) :
-		meshes(meshes), nn(size<Node>(meshes)), nf(size<Face>(meshes)),
-		strain_limits(strain_limits), cons(cons),
-		xold(node_positions(meshes)), s(nf * 2), sg(nf * 2)
+	SLOpt(const vector<Node*> &nodes, const vector<const Face*> &faces,
+		  const vector<Vec2> &strain_limits, const vector<Constraint*> &cons,
+		  double inv_m) :
+		nodes(nodes), faces(faces), strain_limits(strain_limits), cons(cons),
+		xold(nodes.size()), s(faces.size() * 2), sg(faces.size() * 2),
+		inv_m(inv_m)
 	{
-		nvar = nn * 3;
-		ncon = cons.size() + nf * 4;
+		nvar = nodes.size() * 3;
+		ncon = cons.size() + faces.size() * 4;
+		index.reserve(nodes.size());
+		for (int n = 0; n < nodes.size(); n++)
+		{
+			index[nodes[n]] = n;
+			xold[n] = nodes[n]->x;
+		}
 		conold.resize(cons.size());
 		for (int j = 0; j < cons.size(); j++)
 			conold[j] = cons[j]->value();
-		inv_m = 0;
-		for (int n = 0; n < nn; n++)
-			inv_m += 1 / get<Node>(n, meshes)->m;
-		inv_m /= nn;
+	}
+	int node_index(const Node *node) const
+	{
+		unordered_map<const Node*, int>::const_iterator it = index.find(node);
+		return it == index.end() ? -1 : it->second;
 	}
 	void initialize(double *x) const;
 	double objective(const double *x) const;
@@ -86,35 +100,256 @@ struct SLOpt : public NLConOpt
 	double constraint(const double *x, int j, int &sign) const;
 	void con_grad(const double *x, int j, double factor, double *grad) const;
 	void finalize(const double *x) const;
+	// cons change from step to step, the 4 rows per face only with the
+	// meshes
+	int warm_constraints(vector<int> &key) const
+	{
+		key = this->key;
+		return key.empty() ? ncon : cons.size();
+	}
 };
 
+// the objective weighs node displacements by mass over the mean mass of all
+// cloth nodes, so that a region is solved with the same scaling as the whole
+static double mean_inverse_mass(const vector<Mesh*> &meshes)
+{
+	int nn = 0;
+	double inv_m = 0;
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		const vector<Node*> &nodes = meshes[m]->nodes;
+		for (int n = 0; n < nodes.size(); n++)
+			inv_m += 1 / nodes[n]->m;
+		nn += nodes.size();
+	}
+	return nn ? inv_m / nn : 0;
+}
+
+static SLOpt global_problem(vector<Mesh*> &meshes,
+							const vector<Vec2> &strain_limits,
+							const vector<Constraint*> &cons)
+{
+	vector<Node*> nodes;
+	vector<const Face*> faces;
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		nodes.insert(nodes.end(), meshes[m]->nodes.begin(),
+					 meshes[m]->nodes.end());
+		faces.insert(faces.end(), meshes[m]->faces.begin(),
+					 meshes[m]->faces.end());
+	}
+	SLOpt problem(nodes, faces, strain_limits, cons, mean_inverse_mass(meshes));
+	problem.key = strain_limiting_key(meshes);
+	return problem;
+}
+
+vector<int> strain_limiting_key(const vector<Mesh*> &meshes)
+{
+	vector<int> key;
+	int nf = 0;
+	for (int m = 0; m < meshes.size(); m++)
+	{
+		key.push_back(meshes[m]->topology);
+		nf += meshes[m]->faces.size();
+	}
+	key.push_back(nf);
+	return key;
+}
+
 void strain_limiting(vector<Mesh*> &meshes, const vector<Vec2> &strain_limits,
 					 const vector<Constraint*> &cons)
 {
-	augmented_lagrangian_method(SLOpt(meshes, strain_limits, cons));
+	augmented_lagrangian_method(global_problem(meshes, strain_limits, cons));
 }
 
-void SLOpt::initialize(double *x) const
+void strain_limiting(vector<Mesh*> &meshes, const vector<Vec2> &strain_limits,
+					 const vector<Constraint*> &cons, AugLagContext &context)
 {
-	for (int n = 0; n < nn; n++)
+	augmented_lagrangian_method(global_problem(meshes, strain_limits, cons),
+								context);
+}
+
+static Vec2 principal_strains(const Face *face)
+{
+	Mat3x2 F = derivative(face->v[0]->node->x, face->v[1]->node->x,
+						  face->v[2]->node->x, face);
+	SVD<3, 2> svd = singular_value_decomposition(F);
+	return Vec2(svd.s[0], svd.s[1]);
+}
+
+static int find_root(vector<int> &parent, int i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static void merge(vector<int> &parent, int i, int j)
+{
+	i = find_root(parent, i);
+	j = find_root(parent, j);
+	if (i != j)
+		parent[max(i, j)] = min(i, j);
+}
+
+struct SLIsland
+{
+	vector<Node*> nodes;
+	vector<const Face*> faces;
+	vector<Vec2> strain_limits;
+	vector<Constraint*> cons;
+};
+
+void local_strain_limiting(vector<Mesh*> &meshes,
+						   const vector<Vec2> &strain_limits,
+						   const vector<Constraint*> &cons,
+						   AugLagContext &context, StrainLimitingStats *stats)
+{
+	vector<const Face*> faces;
+	for (int m = 0; m < meshes.size(); m++)
+		faces.insert(faces.end(), meshes[m]->faces.begin(),
+					 meshes[m]->faces.end());
+	if (stats)
+		stats->calls++;
+	vector<char> violated(faces.size());
+#pragma omp parallel for
+	for (int f = 0; f < faces.size(); f++)
+	{
+		Vec2 s = principal_strains(faces[f]);
+		for (int i = 0; i < 2; i++)
+			if (s[i] < strain_limits[f][0] || s[i] > strain_limits[f][1])
+				violated[f] = true;
+	}
+	// the variables are the nodes of the violating faces' one-ring, and
+	// every face touching one of them is constrained
+	unordered_map<const Node*, int> free;
+	vector<Node*> nodes;
+	for (int f = 0; f < faces.size(); f++)
+	{
+		if (!violated[f])
+			continue;
+		for (int i = 0; i < 3; i++)
+		{
+			const Node *node = faces[f]->v[i]->node;
+			for (int v = 0; v < node->verts.size(); v++)
+			{
+				const vector<Face*> &adjf = node->verts[v]->adjf;
+				for (int a = 0; a < adjf.size(); a++)
+					for (int k = 0; k < 3; k++)
+					{
+						Node *ring = adjf[a]->v[k]->node;
+						if (free.insert(make_pair(ring, (int)nodes.size())).second)
+							nodes.push_back(ring);
+					}
+			}
+		}
+	}
+	if (nodes.empty())
+		return;
+	// variables coupled by a face or a constraint go into the same island
+	vector<int> parent(nodes.size());
+	for (int n = 0; n < nodes.size(); n++)
+		parent[n] = n;
+	vector<int> face_node(faces.size(), -1); // a free node of each face
+	for (int f = 0; f < faces.size(); f++)
+		for (int i = 0; i < 3; i++)
+		{
+			unordered_map<const Node*, int>::const_iterator it =
+				free.find(faces[f]->v[i]->node);
+			if (it == free.end())
+				continue;
+			if (face_node[f] == -1)
+				face_node[f] = it->second;
+			else
+				merge(parent, face_node[f], it->second);
+		}
+	vector<int> con_node(cons.size(), -1);
+	for (int j = 0; j < cons.size(); j++)
+	{
+		MeshGrad grad = cons[j]->gradient();
+		for (int k = 0; k < grad.n; k++)
+		{
+			unordered_map<const Node*, int>::const_iterator it =
+				free.find(grad.keys[k]);
+			if (it == free.end())
+				continue;
+			if (con_node[j] == -1)
+				con_node[j] = it->second;
+			else
+				merge(parent, con_node[j], it->second);
+		}
+	}
+	// roots have the smallest index of their island, so islands come out in
+	// the order of their first node
+	vector<int> island(nodes.size(), -1);
+	vector<SLIsland> islands;
+	for (int n = 0; n < nodes.size(); n++)
+	{
+		int root = find_root(parent, n);
+		if (island[root] == -1)
+		{
+			island[root] = islands.size();
+			islands.push_back(SLIsland());
+		}
+		island[n] = island[root];
+		islands[island[n]].nodes.push_back(nodes[n]);
+	}
+	for (int f = 0; f < faces.size(); f++)
+		if (face_node[f] != -1)
+		{
+			SLIsland &isl = islands[island[face_node[f]]];
+			isl.faces.push_back(faces[f]);
+			isl.strain_limits.push_back(strain_limits[f]);
+		}
+	for (int j = 0; j < cons.size(); j++)
+		if (con_node[j] != -1)
+			islands[island[con_node[j]]].cons.push_back(cons[j]);
+	// islands share no variables, so they are solved independently
+	double inv_m = mean_inverse_mass(meshes);
+	int nislands = islands.size();
+	vector<AugLagContext> contexts(nislands);
+#pragma omp parallel for schedule(dynamic) if (nislands > 1)
+	for (int i = 0; i < nislands; i++)
+	{
+		const SLIsland &isl = islands[i];
+		augmented_lagrangian_method(SLOpt(isl.nodes, isl.faces,
+										  isl.strain_limits, isl.cons, inv_m),
+									contexts[i]);
+	}
+	for (int i = 0; i < nislands; i++)
 	{
-		const Node *node = get<Node>(n, meshes);
-		set_subvec(x, n, node->x);
+		context.outer_iterations += contexts[i].outer_iterations;
+		context.inner_iterations += contexts[i].inner_iterations;
+		context.evaluations += contexts[i].evaluations;
+		if (stats)
+		{
+			stats->islands++;
+			stats->nodes += islands[i].nodes.size();
+			stats->faces += islands[i].faces.size();
+		}
 	}
 }
 
+void SLOpt::initialize(double *x) const
+{
+	for (int n = 0; n < nodes.size(); n++)
+		set_subvec(x, n, nodes[n]->x);
+}
+
 void SLOpt::precompute(const double *x) const
 {
+	int nn = nodes.size(), nf = faces.size();
+
 #pragma omp parallel for
 
 	for (int n = 0; n < nn; n++)
-		get<Node>(n, meshes)->x = get_subvec(x, n);
+		nodes[n]->x = get_subvec(x, n);
 
 #pragma omp parallel for
 
 	for (int f = 0; f < nf; f++)
 	{
-		const Face *face = get<Face>(f, meshes);
+		const Face *face = faces[f];
 		Mat3x2 F = derivative(face->v[0]->node->x, face->v[1]->node->x,
 							  face->v[2]->node->x, face);
 		SVD<3, 2> svd = singular_value_decomposition(F);
@@ -134,13 +369,14 @@ void SLOpt::precompute(const double *x) const
 
 double SLOpt::objective(const double *x) const
 {
+	int nn = nodes.size();
 	double f = 0;
 
 #pragma omp parallel for reduction (+: f)
 
 	for (int n = 0; n < nn; n++)
 	{
-		const Node *node = get<Node>(n, meshes);
+		const Node *node = nodes[n];
 		Vec3 dx = node->x - xold[n];
 		f += inv_m * node->m*norm2(dx) / 2.;
 	}
@@ -150,12 +386,13 @@ double SLOpt::objective(const double *x) const
 
 void SLOpt::obj_grad(const double *x, double *grad) const
 {
+	int nn = nodes.size();
 
 #pragma omp parallel for
 
 	for (int n = 0; n < nn; n++)
 	{
-		const Node *node = get<Node>(n, meshes);
+		const Node *node = nodes[n];
 		Vec3 dx = node->x - xold[n];
 		set_subvec(grad, n, inv_m*node->m*dx);
 	}
@@ -178,12 +415,12 @@ void SLOpt::con_grad(const double *x, int j, double factor,
 	if (j < cons.size())
 	{
 		MeshGrad mgrad = cons[j]->gradient();
-		for (MeshGrad::iterator it = mgrad.begin(); it != mgrad.end(); it++)
+		for (int k = 0; k < mgrad.n; k++)
 		{
-			int n = get_index(it->first, meshes);
+			int n = node_index(mgrad.keys[k]);
 			if (n == -1)
 				continue;
-			const Vec3 &g = it->second;
+			const Vec3 &g = mgrad.values[k];
 			for (int i = 0; i < 3; i++)
 				grad[n * 3 + i] += factor * g[i];
 		}
@@ -196,7 +433,7 @@ double strain_con(const SLOpt &sl, const double *x, int j, int &sign)
 {
 	int f = j / 4;
 	int a = j / 2; // index into s, sg
-	const Face *face = get<Face>(f, sl.meshes);
+	const Face *face = sl.faces[f];
 	double strain_min = sl.strain_limits[f][0],
 		strain_max = sl.strain_limits[f][1];
 	double c;
@@ -222,33 +459,35 @@ double strain_con(const SLOpt &sl, const double *x, int j, int &sign)
 	return c;
 }
 
-void add_strain_row(const Mat3x3 &sg, const Face *face,
-					const vector<Mesh*> &meshes, double factor, double *grad);
+void add_strain_row(const Mat3x3 &sg, const Face *face, const SLOpt &sl,
+					double factor, double *grad);
 
 void strain_con_grad(const SLOpt &sl, const double *x, int j, double factor,
 					 double *grad)
 {
 	int f = j / 4;
 	int a = j / 2; // index into s, sg
-	const Face *face = get<Face>(f, sl.meshes);
+	const Face *face = sl.faces[f];
 	double strain_min = sl.strain_limits[f][0],
 		strain_max = sl.strain_limits[f][1];
 	double w = sqrt(face->a);
 	if (strain_min == strain_max)
 	{
 		if (j % 2 == 0)
-			add_strain_row(w*sl.sg[a], face, sl.meshes, factor, grad);
+			add_strain_row(w*sl.sg[a], face, sl, factor, grad);
 	}
 	else
-		add_strain_row(w*sl.sg[a], face, sl.meshes, factor, grad);
+		add_strain_row(w*sl.sg[a], face, sl, factor, grad);
 }
 
-void add_strain_row(const Mat3x3 &sg, const Face *face,
-					const vector<Mesh*> &meshes, double factor, double *grad)
+void add_strain_row(const Mat3x3 &sg, const Face *face, const SLOpt &sl,
+					double factor, double *grad)
 {
 	for (int i = 0; i < 3; i++)
 	{
-		int n = get_index(face->v[i]->node, meshes);
+		int n = sl.node_index(face->v[i]->node);
+		if (n == -1)
+			continue;
 		for (int j = 0; j < 3; j++)
 			grad[n * 3 + j] += factor * sg(j, i);
 	}
@@ -256,6 +495,6 @@ void add_strain_row(const Mat3x3 &sg, const Face *face,
 
 void SLOpt::finalize(const double *x) const
 {
-	for (int n = 0; n < nn; n++)
-		get<Node>(n, meshes)->x = get_subvec(x, n);
-}
\ No newline at end of file
+	for (int n = 0; n < nodes.size(); n++)
+		nodes[n]->x = get_subvec(x, n);
+}
@@ -29,6 +29,7 @@
 
 #include "cloth.hpp"
 #include "constraint.hpp"
+#include "optimization.hpp"
 
 std::vector<Vec2> get_strain_limits (const std::vector<Cloth> &cloths);
 
@@ -36,4 +37,29 @@ void strain_limiting (std::vector<Mesh*> &meshes,
                       const std::vector<Vec2> &strain_limits,
                       const std::vector<Constraint*> &cons);
 
+// same, solving with (and warm-starting from) the caller's context; the
+// per-face multipliers carry over while strain_limiting_key is unchanged
+void strain_limiting (std::vector<Mesh*> &meshes,
+                      const std::vector<Vec2> &strain_limits,
+                      const std::vector<Constraint*> &cons,
+                      AugLagContext &context);
+
+// the meshes' topology stamps and face count
+std::vector<int> strain_limiting_key (const std::vector<Mesh*> &meshes);
+
+// regions solved by local_strain_limiting, accumulated over calls
+struct StrainLimitingStats
+{
+    int calls, islands, nodes, faces;
+    StrainLimitingStats () : calls(0), islands(0), nodes(0), faces(0) {}
+};
+
+// same, but only moving the nodes around faces that exceed their limits,
+// in independent islands; multipliers are not warm-started
+void local_strain_limiting (std::vector<Mesh*> &meshes,
+                            const std::vector<Vec2> &strain_limits,
+                            const std::vector<Constraint*> &cons,
+                            AugLagContext &context,
+                            StrainLimitingStats *stats = NULL);
+
 #endif
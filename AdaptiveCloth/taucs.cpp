@@ -25,12 +25,26 @@
 */
 
 #include "taucs.hpp"
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 using namespace std;
 
 extern "C" {
 #include "taucs.h"
+	void taucs_ccs_order(taucs_ccs_matrix* matrix,
+						 int** perm, int** invperm,
+						 char* which);
+	taucs_ccs_matrix* taucs_ccs_permute_symmetrically(taucs_ccs_matrix* A,
+													  int* perm, int* invperm);
+	void* taucs_ccs_factor_llt_symbolic(taucs_ccs_matrix* A);
+	int taucs_ccs_factor_llt_numeric(taucs_ccs_matrix* A, void* L);
+	int taucs_supernodal_solve_llt(void* L, void* x, void* b);
+	void taucs_supernodal_factor_free(void* L);
+	void taucs_supernodal_factor_free_numeric(void* L);
+	void taucs_vec_permute(int n, int flags, void* v, void* pv, int p[]);
+	void taucs_vec_ipermute(int n, int flags, void* pv, void* v, int invp[]);
 	int taucs_linsolve(taucs_ccs_matrix* A, // input matrix
 					   void** factorization, // an approximate inverse
 					   int nrhs, // number of right-hand sides
@@ -40,6 +54,12 @@ extern "C" {
 					   void* arguments[]); // option arguments
 }
 
+// the prebuilt blas/taucs libraries were compiled against the old CRT
+extern "C"
+{
+	FILE __iob_func[3] = {*stdin, *stdout, *stderr};
+}
+
 ostream &operator<< (ostream &out, taucs_ccs_matrix *A)
 {
 	out << "n: " << A->n << endl;
@@ -136,6 +156,40 @@ template <int m> taucs_ccs_matrix *sparse_to_taucs(const SpMat< Mat<m, m> > &As)
 	return At;
 }
 
+taucs_ccs_matrix *sparse_to_taucs(const BlockSpMat &As)
+{
+	// assumption: A is symmetric; pattern is sorted, so the upper blocks of
+	// row i give column 3i+k of the lower triangle directly
+	int n = As.n;
+	int nnz = 0;
+	for (int i = 0; i < n; i++)
+		for (int jj = As.diag[i]; jj < As.rowptr[i + 1]; jj++)
+			nnz += (As.colind[jj] == i) ? 6 : 9;
+	taucs_ccs_matrix *At = taucs_ccs_create
+	(n * 3, n * 3, nnz, TAUCS_DOUBLE | TAUCS_SYMMETRIC | TAUCS_LOWER);
+	int pos = 0;
+	for (int i = 0; i < n; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			At->colptr[i * 3 + k] = pos;
+			for (int jj = As.diag[i]; jj < As.rowptr[i + 1]; jj++)
+			{
+				int j = As.colind[jj];
+				const Mat3x3 &Aij = As.blocks[jj];
+				for (int l = (i == j) ? k : 0; l < 3; l++)
+				{
+					At->rowind[pos] = j * 3 + l;
+					At->values.d[pos] = Aij(k, l);
+					pos++;
+				}
+			}
+		}
+	}
+	At->colptr[n * 3] = pos;
+	return At;
+}
+
 vector<double> taucs_linear_solve(const SpMat<double> &A, const vector<double> &b)
 {
 	// taucs_logfile("stdout");
@@ -171,3 +225,87 @@ template <int m> vector< Vec<m> > taucs_linear_solve
 
 template vector<Vec3> taucs_linear_solve(const SpMat<Mat3x3> &A,
 										 const vector<Vec3> &b);
+
+TaucsSolver::TaucsSolver() : pattern(-1), perm(NULL), invperm(NULL), Ap(NULL),
+							 L(NULL), hits(0), misses(0)
+{
+}
+
+TaucsSolver::TaucsSolver(const TaucsSolver &) : pattern(-1), perm(NULL),
+												invperm(NULL), Ap(NULL), L(NULL),
+												hits(0), misses(0)
+{
+}
+
+TaucsSolver &TaucsSolver::operator=(const TaucsSolver &)
+{
+	clear();
+	return *this;
+}
+
+TaucsSolver::~TaucsSolver()
+{
+	clear();
+}
+
+void TaucsSolver::clear()
+{
+	if (L)
+		taucs_supernodal_factor_free(L);
+	if (Ap)
+		taucs_ccs_free((taucs_ccs_matrix*)Ap);
+	if (perm)
+		taucs_free(perm);
+	if (invperm)
+		taucs_free(invperm);
+	perm = invperm = NULL;
+	Ap = L = NULL;
+	pattern = -1;
+}
+
+vector<Vec3> TaucsSolver::solve(const BlockSpMat &A, const vector<Vec3> &b)
+{
+	int n = A.n * 3;
+	taucs_ccs_matrix *At = sparse_to_taucs(A);
+	if (A.pattern != pattern || !L)
+	{
+		misses++;
+		clear();
+		taucs_ccs_order(At, &perm, &invperm, (char*)"metis");
+		// permute a copy whose values are their own slot numbers to learn
+		// where every entry of At lands in the permuted matrix
+		vector<double> values(At->values.d, At->values.d + At->colptr[n]);
+		for (int k = 0; k < At->colptr[n]; k++)
+			At->values.d[k] = k;
+		taucs_ccs_matrix *Pt = taucs_ccs_permute_symmetrically(At, perm, invperm);
+		scatter.resize(Pt->colptr[n]);
+		for (int k = 0; k < Pt->colptr[n]; k++)
+			scatter[(int)Pt->values.d[k]] = k;
+		copy(values.begin(), values.end(), At->values.d);
+		Ap = Pt;
+		L = taucs_ccs_factor_llt_symbolic(Pt);
+		pattern = A.pattern;
+	}
+	else
+	{
+		hits++;
+		taucs_supernodal_factor_free_numeric(L);
+	}
+	taucs_ccs_matrix *Pt = (taucs_ccs_matrix*)Ap;
+	for (int k = 0; k < At->colptr[n]; k++)
+		Pt->values.d[scatter[k]] = At->values.d[k];
+	taucs_ccs_free(At);
+	int retval = taucs_ccs_factor_llt_numeric(Pt, L);
+	if (retval != TAUCS_SUCCESS)
+	{
+		cerr << "Error: TAUCS failed with return value " << retval << endl;
+		exit(EXIT_FAILURE);
+	}
+	vector<Vec3> x(b.size());
+	pb.resize(n);
+	px.resize(n);
+	taucs_vec_permute(n, TAUCS_DOUBLE, (double*)&b[0], &pb[0], perm);
+	taucs_supernodal_solve_llt(L, &px[0], &pb[0]);
+	taucs_vec_ipermute(n, TAUCS_DOUBLE, &px[0], (double*)&x[0], perm);
+	return x;
+}
@@ -27,6 +27,7 @@
 #ifndef TAUCS_HPP
 #define TAUCS_HPP
 
+#include "blocksparse.hpp"
 #include "sparse.hpp"
 #include "vectors.hpp"
 
@@ -34,4 +35,25 @@ std::vector<double> taucs_linear_solve(const SpMat<double> & A, const std::vecto
 
 template <int m> std::vector< Vec<m> > taucs_linear_solve(const SpMat< Mat<m, m> > & A, const std::vector< Vec<m> > & b);
 
+// Sparse Cholesky solver for a BlockSpMat that keeps the fill-reducing
+// ordering and symbolic factor of the last pattern it factored. While
+// A.pattern is unchanged only the numeric factorization is redone.
+// Copies start with an empty cache.
+struct TaucsSolver
+{
+	int pattern;				 // BlockSpMat::pattern the cache was built for
+	int *perm, *invperm;		 // fill-reducing ordering
+	void *Ap;					 // permuted lower triangle (taucs_ccs_matrix*)
+	void *L;					 // supernodal factor
+	std::vector<int> scatter;	 // Ap value slot of each unpermuted value
+	std::vector<double> pb, px; // permuted rhs and solution
+	int hits, misses;			 // symbolic factor reused / recomputed
+	TaucsSolver();
+	TaucsSolver(const TaucsSolver &);
+	TaucsSolver &operator=(const TaucsSolver &);
+	~TaucsSolver();
+	void clear();
+	std::vector<Vec3> solve(const BlockSpMat & A, const std::vector<Vec3> & b);
+};
+
 #endif
\ No newline at end of file
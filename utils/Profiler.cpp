@@ -0,0 +1,264 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+struct tEvent
+{
+    int zone, parent, tid;
+    int64_t begin, end; // ns since the profiler epoch
+};
+
+const int gRingSize = 1 << 16;  // events per thread between two EndStep
+const int gMaxDepth = 64;       // deeper zones are timed but lose their parent
+const int gMaxTrace = 1 << 22;  // events kept for the chrome trace
+
+struct tThreadBuffer
+{
+    int tid;
+    vector<tEvent> ring;
+    int64_t head = 0, drained = 0; // events written / read so far
+    int depth = 0;
+    int stack[gMaxDepth];
+};
+
+struct tProfilerState
+{
+    mutex lock; // guards names and buffers, only taken on first use
+    vector<string> names;
+    map<string, int> ids;
+    vector<unique_ptr<tThreadBuffer>> buffers;
+
+    int report_steps = 100, steps = 0, window_start = 0;
+    string trace_path;
+    bool exit_hook = false;
+    // durations (ns) of the current report window per (parent, zone)
+    map<pair<int, int>, vector<int64_t>> window;
+    vector<tEvent> trace;
+    int64_t dropped = 0;
+};
+
+tProfilerState &State()
+{
+    static tProfilerState *state = new tProfilerState; // outlives atexit
+    return *state;
+}
+
+int64_t Now()
+{
+    static const chrono::steady_clock::time_point epoch =
+        chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now() - epoch)
+        .count();
+}
+
+tThreadBuffer &ThreadBuffer()
+{
+    thread_local tThreadBuffer *buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        tProfilerState &state = State();
+        lock_guard<mutex> guard(state.lock);
+        state.buffers.emplace_back(new tThreadBuffer);
+        buffer = state.buffers.back().get();
+        buffer->tid = state.buffers.size() - 1;
+        buffer->ring.resize(gRingSize);
+    }
+    return *buffer;
+}
+
+void Drain()
+{
+    tProfilerState &state = State();
+    for (auto &buffer : state.buffers)
+    {
+        int64_t first = max(buffer->drained, buffer->head - gRingSize);
+        state.dropped += first - buffer->drained;
+        for (int64_t i = first; i < buffer->head; i++)
+        {
+            const tEvent &event = buffer->ring[i % gRingSize];
+            state.window[make_pair(event.parent, event.zone)].push_back(
+                event.end - event.begin);
+            if (state.trace_path.empty())
+                continue;
+            if (state.trace.size() < gMaxTrace)
+                state.trace.push_back(event);
+            else
+                state.dropped++;
+        }
+        buffer->drained = buffer->head;
+    }
+}
+
+void CollectZone(int parent, int depth, const string &prefix,
+                 vector<cProfiler::tZoneStats> &stats)
+{
+    tProfilerState &state = State();
+    for (auto &it : state.window)
+    {
+        if (it.first.first != parent)
+            continue;
+        int zone = it.first.second;
+        vector<int64_t> &d = it.second;
+        sort(d.begin(), d.end());
+        double sum = 0;
+        for (int64_t t : d)
+            sum += t;
+        int n = d.size();
+        cProfiler::tZoneStats zs;
+        zs.path = prefix + state.names[zone];
+        zs.depth = depth;
+        zs.count = n;
+        zs.total_ms = sum * 1e-6;
+        zs.mean_ms = sum / n * 1e-6;
+        zs.p50_ms = d[n / 2] * 1e-6;
+        zs.p99_ms = d[min(n - 1, (int)(0.99 * n))] * 1e-6;
+        stats.push_back(zs);
+        if (depth + 1 < gMaxDepth)
+            CollectZone(zone, depth + 1, zs.path + "/", stats);
+    }
+}
+
+void WriteTraceAtExit()
+{
+    tProfilerState &state = State();
+    if (state.trace_path.empty())
+        return;
+    Drain();
+    cProfiler::WriteChromeTrace(state.trace_path);
+}
+} // namespace
+
+void cProfiler::Configure(int report_steps, const std::string &trace_path)
+{
+    tProfilerState &state = State();
+    state.report_steps = report_steps;
+    state.trace_path = trace_path;
+    if (!trace_path.empty() && !state.exit_hook)
+    {
+        atexit(WriteTraceAtExit);
+        state.exit_hook = true;
+    }
+}
+
+bool cProfiler::Enabled()
+{
+#ifdef ENABLE_PROFILER
+    return true;
+#else
+    return false;
+#endif
+}
+
+int cProfiler::Intern(const char *name)
+{
+    tProfilerState &state = State();
+    lock_guard<mutex> guard(state.lock);
+    auto it = state.ids.find(name);
+    if (it != state.ids.end())
+        return it->second;
+    state.names.push_back(name);
+    return state.ids[name] = state.names.size() - 1;
+}
+
+void cProfiler::EndStep()
+{
+    tProfilerState &state = State();
+    state.steps++;
+    if (state.buffers.empty())
+        return;
+    Drain();
+    if (state.report_steps > 0 && state.steps % state.report_steps == 0)
+        Report();
+}
+
+std::vector<cProfiler::tZoneStats> cProfiler::Collect()
+{
+    tProfilerState &state = State();
+    Drain();
+    vector<tZoneStats> stats;
+    CollectZone(-1, 0, "", stats);
+    state.window.clear();
+    state.window_start = state.steps;
+    return stats;
+}
+
+void cProfiler::Report()
+{
+    tProfilerState &state = State();
+    int window_start = state.window_start;
+    vector<tZoneStats> stats = Collect();
+    if (stats.empty())
+        return;
+    printf("[prof] steps %d-%d\n", window_start, state.steps - 1);
+    for (const tZoneStats &zs : stats)
+    {
+        const char *name = zs.path.c_str() + zs.path.rfind('/') + 1;
+        printf("[prof] %*s%-*s %7d calls  mean %9.3f  p50 %9.3f  p99 %9.3f ms\n",
+               2 * zs.depth, "", max(32 - 2 * zs.depth, 1), name, zs.count,
+               zs.mean_ms, zs.p50_ms, zs.p99_ms);
+    }
+    if (state.dropped > 0)
+        printf("[prof] %lld events dropped\n", (long long)state.dropped);
+}
+
+void cProfiler::WriteChromeTrace(const std::string &path)
+{
+    tProfilerState &state = State();
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == nullptr)
+    {
+        printf("[error] cProfiler::WriteChromeTrace can't write %s\n",
+               path.c_str());
+        return;
+    }
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < state.trace.size(); i++)
+    {
+        const tEvent &event = state.trace[i];
+        fprintf(f,
+                "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                state.names[event.zone].c_str(), event.tid, event.begin * 1e-3,
+                (event.end - event.begin) * 1e-3,
+                i + 1 < state.trace.size() ? "," : "");
+    }
+    fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+}
+
+cProfiler::cScope::cScope(int zone) : mZone(zone)
+{
+    tThreadBuffer &buffer = ThreadBuffer();
+    if (buffer.depth < gMaxDepth)
+        buffer.stack[buffer.depth] = zone;
+    buffer.depth++;
+    mBegin = Now();
+}
+
+cProfiler::cScope::~cScope()
+{
+    int64_t end = Now();
+    tThreadBuffer &buffer = ThreadBuffer();
+    buffer.depth--;
+    tEvent &event = buffer.ring[buffer.head % gRingSize];
+    event.zone = mZone;
+    event.parent = buffer.depth > 0 && buffer.depth <= gMaxDepth
+                       ? buffer.stack[buffer.depth - 1]
+                       : -1;
+    event.tid = buffer.tid;
+    event.begin = mBegin;
+    event.end = end;
+    buffer.head++;
+}
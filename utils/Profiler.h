@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped, nested zone profiler. PROFILE_ZONE("name") times the rest of the
+// enclosing scope; the name is interned into a zone id once per call site,
+// and each thread appends finished zones to its own ring buffer without
+// locking. cProfiler::EndStep drains the buffers between steps, prints
+// count / mean / p50 / p99 per zone of the call tree every N steps, and keeps
+// the events for a chrome://tracing json written at exit.
+//
+// Built with ENABLE_PROFILER only; otherwise PROFILE_ZONE expands to nothing
+// and EndStep finds nothing to drain.
+class cProfiler
+{
+public:
+    // report every report_steps steps (<= 0: never); a non-empty trace_path
+    // gets the chrome trace of the whole run at exit
+    static void Configure(int report_steps, const std::string &trace_path);
+    // whether the zones were compiled in (ENABLE_PROFILER)
+    static bool Enabled();
+    static int Intern(const char *name);
+    // call between steps, outside of parallel regions
+    static void EndStep();
+    static void Report();
+
+    struct tZoneStats
+    {
+        std::string path; // zone names from the root, joined by '/'
+        int depth, count;
+        double total_ms, mean_ms, p50_ms, p99_ms;
+    };
+    // statistics since the last report, in call-tree order; starts a new
+    // report window like Report does
+    static std::vector<tZoneStats> Collect();
+    static void WriteChromeTrace(const std::string &path);
+
+    class cScope
+    {
+    public:
+        explicit cScope(int zone);
+        ~cScope();
+
+    private:
+        int mZone;
+        int64_t mBegin;
+    };
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef ENABLE_PROFILER
+#define PROFILE_ZONE(name)                                                     \
+    static const int PROFILE_CONCAT(prof_zone_, __LINE__) =                    \
+        cProfiler::Intern(name);                                               \
+    cProfiler::cScope PROFILE_CONCAT(prof_scope_, __LINE__)(                   \
+        PROFILE_CONCAT(prof_zone_, __LINE__))
+#else
+#define PROFILE_ZONE(name)
+#endif
@@ -18,4 +18,25 @@ int cSysUtil::GetPhyMemConsumedBytes()
 
     return physMemUsedByMe;
 }
-#endif
\ No newline at end of file
+
+long long cSysUtil::GetPeakPhyMemBytes()
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.PeakWorkingSetSize;
+}
+#else
+#include <sys/resource.h>
+long long cSysUtil::GetPeakPhyMemBytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss; // bytes
+#else
+    return usage.ru_maxrss * 1024LL; // kilobytes
+#endif
+}
+#endif
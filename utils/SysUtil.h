@@ -4,4 +4,6 @@ class cSysUtil
 {
 public:
     static int GetPhyMemConsumedBytes();
+    // high-water mark of the process resident set, 0 if unknown
+    static long long GetPeakPhyMemBytes();
 };
\ No newline at end of file